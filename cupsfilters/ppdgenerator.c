@@ -1429,6 +1429,24 @@ ppdCreateFromIPP(char   *buffer,	/* I - Filename buffer */
     cupsFilePuts(fp, "*cupsFilter2: \"application/vnd.cups-pdf application/pdf 0 -\"\n");
     formatfound = 1;
     is_pdf = 1;
+    /* If the printer understands PDF 1.5 or newer, let pdftopdf write
+       object streams and cross-reference streams, this makes the jobs
+       considerably smaller */
+    if ((attr = ippFindAttribute(response, "pdf-versions-supported",
+				 IPP_TAG_ZERO)) != NULL) {
+      count = ippGetCount(attr);
+      for (i = 0; i < count; i ++) {
+	const char *pdfver = ippGetString(attr, i, NULL);
+	if (pdfver &&
+	    (!strcasecmp(pdfver, "adobe-1.5") ||
+	     !strcasecmp(pdfver, "adobe-1.6") ||
+	     !strcasecmp(pdfver, "adobe-1.7") ||
+	     !strncasecmp(pdfver, "iso-32000-", 10))) {
+	  cupsFilePuts(fp, "*cupsPDFObjectStreams: True\n");
+	  break;
+	}
+      }
+    }
   }
   if (cupsArrayFind(pdl_list, "image/pwg-raster")) {
     if ((attr = ippFindAttribute(response, "pwg-raster-document-resolution-supported", IPP_TAG_RESOLUTION)) != NULL) {
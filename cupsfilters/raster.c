@@ -10,6 +10,15 @@
  *
  *   cupsRasterParseIPPOptions() - Parse IPP options from the command line
  *                                 and apply them to the CUPS Raster header.
+ *   paper_color()               - Fill a line with the paper color of the
+ *                                 page header's color space.
+ *   cupsRasterBlankPageSupported() - Check whether cupsRasterWriteBlankPage()
+ *                                 knows the paper color for the page header.
+ *   cupsRasterWriteBlankPage()  - Write a page in paper color.
+ *   cupsRasterInsertBlankPages() - Copy a raster stream, inserting blank
+ *                                  pages.
+ *   cupsRasterMergePages()      - Copy the raster streams of several
+ *                                 renderers, inserting blank pages.
  */
 
 #include <config.h>
@@ -23,6 +32,7 @@
  */
 
 #include "driver.h"
+#include "raster.h"
 #include <string.h>
 #include <ctype.h>
 #ifdef HAVE_CUPS_1_7
@@ -1083,6 +1093,267 @@ cupsRasterParseIPPOptions(cups_page_header2_t *h, /* I - Raster header */
 }
 
 
+/*
+ * 'paper_color()' - Fill a line with the paper color of the page header's
+ *                   color space, or only check whether it is known if
+ *                   "line" is NULL.
+ */
+
+static int				/* O - 0 on success, -1 if unknown */
+paper_color(cups_page_header2_t *h,	/* I - Page header */
+	    unsigned char       *line)	/* I - Line buffer or NULL */
+{
+  unsigned	x;			/* Current pixel */
+
+
+  switch (h->cupsColorSpace)
+  {
+   /*
+    * White is all bits set in the additive color spaces...
+    */
+
+    case CUPS_CSPACE_W :
+    case CUPS_CSPACE_SW :
+    case CUPS_CSPACE_RGB :
+    case CUPS_CSPACE_RGBA :
+    case CUPS_CSPACE_RGBW :
+    case CUPS_CSPACE_SRGB :
+    case CUPS_CSPACE_ADOBERGB :
+        if (line)
+	  memset(line, 0xff, h->cupsBytesPerLine);
+	return (0);
+
+   /*
+    * ... no ink in the subtractive ones...
+    */
+
+    case CUPS_CSPACE_K :
+    case CUPS_CSPACE_CMY :
+    case CUPS_CSPACE_YMC :
+    case CUPS_CSPACE_CMYK :
+    case CUPS_CSPACE_YMCK :
+    case CUPS_CSPACE_KCMY :
+    case CUPS_CSPACE_KCMYcm :
+    case CUPS_CSPACE_GMCK :
+    case CUPS_CSPACE_GMCS :
+    case CUPS_CSPACE_WHITE :
+    case CUPS_CSPACE_GOLD :
+    case CUPS_CSPACE_SILVER :
+        if (line)
+	  memset(line, 0, h->cupsBytesPerLine);
+	return (0);
+
+   /*
+    * ... and L = 100, a = b = 0 in CIE Lab, with a and b offset by half
+    * of the range (chunked only)
+    */
+
+    case CUPS_CSPACE_CIELab :
+        if (h->cupsColorOrder != CUPS_ORDER_CHUNKED ||
+	    (h->cupsBitsPerColor != 8 && h->cupsBitsPerColor != 16) ||
+	    h->cupsBitsPerPixel != 3 * h->cupsBitsPerColor)
+	  return (-1);
+	if (line == NULL)
+	  return (0);
+	memset(line, 0, h->cupsBytesPerLine);
+	if (h->cupsBitsPerColor == 8)
+	  for (x = 0; x < h->cupsWidth; x ++)
+	  {
+	    line[3 * x]     = 0xff;
+	    line[3 * x + 1] = 0x80;
+	    line[3 * x + 2] = 0x80;
+	  }
+	else
+	  for (x = 0; x < h->cupsWidth; x ++)
+	  {
+	   /*
+	    * 16-bit values are written in host byte order
+	    */
+
+	    unsigned short lab[3] = { 0xffff, 0x8000, 0x8000 };
+
+	    memcpy(line + 6 * x, lab, sizeof(lab));
+	  }
+	return (0);
+
+   /*
+    * CIE XYZ, the ICC-based and the device color spaces have no known
+    * white
+    */
+
+    default :
+	return (-1);
+  }
+}
+
+
+/*
+ * 'cupsRasterBlankPageSupported()' - Check whether cupsRasterWriteBlankPage()
+ *                                    knows the paper color for the page
+ *                                    header.
+ *
+ * Filters which leave blank pages to cupsRasterInsertBlankPages() or
+ * cupsRasterMergePages() must have them rendered normally otherwise.
+ */
+
+int					/* O - 1 if supported, 0 otherwise */
+cupsRasterBlankPageSupported(cups_page_header2_t *h)
+					/* I - Page header */
+{
+  return (paper_color(h, NULL) == 0);
+}
+
+
+/*
+ * 'cupsRasterWriteBlankPage()' - Write a page in paper color.
+ */
+
+int					/* O - 0 on success, -1 on error */
+cupsRasterWriteBlankPage(cups_raster_t *ras,	/* I - Raster stream */
+			 cups_page_header2_t *h)/* I - Page header */
+{
+  unsigned char	*line;			/* Line of paper color */
+  unsigned	y;			/* Current line */
+  int		ret = 0;		/* Return value */
+
+
+  if (paper_color(h, NULL))
+    return (-1);
+
+  if (!cupsRasterWriteHeader2(ras, h))
+    return (-1);
+
+  if ((line = malloc(h->cupsBytesPerLine)) == NULL)
+    return (-1);
+
+  paper_color(h, line);
+
+  for (y = 0; y < h->cupsHeight; y ++)
+    if (cupsRasterWritePixels(ras, line, h->cupsBytesPerLine) <
+	h->cupsBytesPerLine)
+    {
+      ret = -1;
+      break;
+    }
+
+  free(line);
+
+  return (ret);
+}
+
+
+/*
+ * 'cupsRasterInsertBlankPages()' - Copy a raster stream, inserting blank
+ *                                  pages.
+ *
+ * The pages of "in" are the output pages not listed in "blank_pages"
+ * (sorted, 1-based). A blank page gets the header of the page following
+ * it; blank pages at the end the one of the last page, or "h" when "in"
+ * has no pages at all.
+ */
+
+static cups_raster_t *
+single_input(void *ctx)
+{
+  cups_raster_t	**in = (cups_raster_t **)ctx;
+  cups_raster_t	*ras = *in;
+
+  *in = NULL;
+  return (ras);
+}
+
+int					/* O - Pages written, -1 on error */
+cupsRasterInsertBlankPages(
+    cups_raster_t       *in,		/* I - Raster stream of the renderer */
+    cups_raster_t       *out,		/* I - Output raster stream */
+    const int           *blank_pages,	/* I - Blank page numbers */
+    int                 num_blank_pages,/* I - Number of blank pages */
+    cups_page_header2_t *h)		/* I - Fallback page header */
+{
+  return (cupsRasterMergePages(single_input, &in, out, blank_pages,
+			       num_blank_pages, h));
+}
+
+
+/*
+ * 'cupsRasterMergePages()' - Copy the raster streams of several renderers,
+ *                            one after the other, inserting blank pages.
+ *
+ * Used when the pages are rendered in parts, each by its own renderer.
+ * "next_in" is called for the first stream and whenever a stream has no
+ * more pages, it may wait for the renderer to finish. Blank pages are
+ * numbered and inserted as with cupsRasterInsertBlankPages().
+ */
+
+int					/* O - Pages written, -1 on error */
+cupsRasterMergePages(
+    cups_raster_next_cb_t next_in,	/* I - Callback for the next input */
+    void                *ctx,		/* I - Context for "next_in" */
+    cups_raster_t       *out,		/* I - Output raster stream */
+    const int           *blank_pages,	/* I - Blank page numbers */
+    int                 num_blank_pages,/* I - Number of blank pages */
+    cups_page_header2_t *h)		/* I - Fallback page header */
+{
+  cups_raster_t		*in;		/* Current input stream */
+  cups_page_header2_t	header;		/* Page header of the renderer */
+  unsigned char		*line = NULL;	/* Line buffer */
+  unsigned		y;		/* Current line */
+  int			page = 1,	/* Current output page */
+			i = 0;		/* Current blank page */
+
+
+  while ((in = (*next_in)(ctx)) != NULL)
+    while (cupsRasterReadHeader2(in, &header))
+    {
+      while (i < num_blank_pages && blank_pages[i] <= page)
+      {
+	if (blank_pages[i] == page)
+	{
+	  if (cupsRasterWriteBlankPage(out, &header))
+	    goto error;
+	  page ++;
+	}
+	i ++;
+      }
+
+      if (!cupsRasterWriteHeader2(out, &header))
+	goto error;
+      free(line);
+      if ((line = malloc(header.cupsBytesPerLine)) == NULL)
+	goto error;
+      for (y = 0; y < header.cupsHeight; y ++)
+	if (cupsRasterReadPixels(in, line, header.cupsBytesPerLine) <
+		header.cupsBytesPerLine ||
+	    cupsRasterWritePixels(out, line, header.cupsBytesPerLine) <
+		header.cupsBytesPerLine)
+	  goto error;
+      page ++;
+      h = &header;
+    }
+
+ /*
+  * Blank pages at the end...
+  */
+
+  for (; i < num_blank_pages; i ++)
+    if (blank_pages[i] >= page)
+    {
+      if (cupsRasterWriteBlankPage(out, h))
+	goto error;
+      page ++;
+    }
+
+  free(line);
+
+  return (page - 1);
+
+error:
+  free(line);
+
+  return (-1);
+}
+
+
 /*
  * End
  */
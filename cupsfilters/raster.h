@@ -33,6 +33,14 @@ extern "C" {
 #  include <cups/cups.h>
 #  include <cups/raster.h>
 
+/*
+ * Types...
+ */
+
+typedef cups_raster_t *(*cups_raster_next_cb_t)(void *ctx);
+					/**** Returns the next input stream,
+					      NULL at the end ****/
+
 /*
  * Prototypes...
  */
@@ -42,6 +50,20 @@ extern int              cupsRasterParseIPPOptions(cups_page_header2_t *h,
 						  cups_option_t *options,
 						  int pwg_raster,
 						  int set_defaults);
+extern int              cupsRasterBlankPageSupported(cups_page_header2_t *h);
+extern int              cupsRasterWriteBlankPage(cups_raster_t *ras,
+						 cups_page_header2_t *h);
+extern int              cupsRasterInsertBlankPages(cups_raster_t *in,
+						   cups_raster_t *out,
+						   const int *blank_pages,
+						   int num_blank_pages,
+						   cups_page_header2_t *h);
+extern int              cupsRasterMergePages(cups_raster_next_cb_t next_in,
+					     void *ctx,
+					     cups_raster_t *out,
+					     const int *blank_pages,
+					     int num_blank_pages,
+					     cups_page_header2_t *h);
 
 #  ifdef __cplusplus
 }
@@ -0,0 +1,244 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @brief CCITT Group 4 (ITU-T T.6) encoder for bilevel images
+ * @file ccittg4.cpp
+ */
+
+#include "ccittg4.h"
+#include <vector>
+
+// Huffman code: number of bits, bits (right aligned)
+struct ccitt_code
+{
+    unsigned char length;
+    unsigned short code;
+};
+
+// Terminating codes for runs 0..63 (ITU-T T.4, Table 2)
+static const ccitt_code white_terminating[64] = {
+    {8, 0x35}, {6, 0x07}, {4, 0x07}, {4, 0x08}, {4, 0x0b}, {4, 0x0c},
+    {4, 0x0e}, {4, 0x0f}, {5, 0x13}, {5, 0x14}, {5, 0x07}, {5, 0x08},
+    {6, 0x08}, {6, 0x03}, {6, 0x34}, {6, 0x35}, {6, 0x2a}, {6, 0x2b},
+    {7, 0x27}, {7, 0x0c}, {7, 0x08}, {7, 0x17}, {7, 0x03}, {7, 0x04},
+    {7, 0x28}, {7, 0x2b}, {7, 0x13}, {7, 0x24}, {7, 0x18}, {8, 0x02},
+    {8, 0x03}, {8, 0x1a}, {8, 0x1b}, {8, 0x12}, {8, 0x13}, {8, 0x14},
+    {8, 0x15}, {8, 0x16}, {8, 0x17}, {8, 0x28}, {8, 0x29}, {8, 0x2a},
+    {8, 0x2b}, {8, 0x2c}, {8, 0x2d}, {8, 0x04}, {8, 0x05}, {8, 0x0a},
+    {8, 0x0b}, {8, 0x52}, {8, 0x53}, {8, 0x54}, {8, 0x55}, {8, 0x24},
+    {8, 0x25}, {8, 0x58}, {8, 0x59}, {8, 0x5a}, {8, 0x5b}, {8, 0x4a},
+    {8, 0x4b}, {8, 0x32}, {8, 0x33}, {8, 0x34}
+};
+
+static const ccitt_code black_terminating[64] = {
+    {10, 0x37}, {3, 0x02}, {2, 0x03}, {2, 0x02}, {3, 0x03}, {4, 0x03},
+    {4, 0x02}, {5, 0x03}, {6, 0x05}, {6, 0x04}, {7, 0x04}, {7, 0x05},
+    {7, 0x07}, {8, 0x04}, {8, 0x07}, {9, 0x18}, {10, 0x17}, {10, 0x18},
+    {10, 0x08}, {11, 0x67}, {11, 0x68}, {11, 0x6c}, {11, 0x37}, {11, 0x28},
+    {11, 0x17}, {11, 0x18}, {12, 0xca}, {12, 0xcb}, {12, 0xcc}, {12, 0xcd},
+    {12, 0x68}, {12, 0x69}, {12, 0x6a}, {12, 0x6b}, {12, 0xd2}, {12, 0xd3},
+    {12, 0xd4}, {12, 0xd5}, {12, 0xd6}, {12, 0xd7}, {12, 0x6c}, {12, 0x6d},
+    {12, 0xda}, {12, 0xdb}, {12, 0x54}, {12, 0x55}, {12, 0x56}, {12, 0x57},
+    {12, 0x64}, {12, 0x65}, {12, 0x52}, {12, 0x53}, {12, 0x24}, {12, 0x37},
+    {12, 0x38}, {12, 0x27}, {12, 0x28}, {12, 0x58}, {12, 0x59}, {12, 0x2b},
+    {12, 0x2c}, {12, 0x5a}, {12, 0x66}, {12, 0x67}
+};
+
+// Make-up codes for runs 64..1728 in steps of 64 (ITU-T T.4, Table 3a)
+static const ccitt_code white_makeup[27] = {
+    {5, 0x1b}, {5, 0x12}, {6, 0x17}, {7, 0x37}, {8, 0x36}, {8, 0x37},
+    {8, 0x64}, {8, 0x65}, {8, 0x68}, {8, 0x67}, {9, 0xcc}, {9, 0xcd},
+    {9, 0xd2}, {9, 0xd3}, {9, 0xd4}, {9, 0xd5}, {9, 0xd6}, {9, 0xd7},
+    {9, 0xd8}, {9, 0xd9}, {9, 0xda}, {9, 0xdb}, {9, 0x98}, {9, 0x99},
+    {9, 0x9a}, {6, 0x18}, {9, 0x9b}
+};
+
+static const ccitt_code black_makeup[27] = {
+    {10, 0x0f}, {12, 0xc8}, {12, 0xc9}, {12, 0x5b}, {12, 0x33}, {12, 0x34},
+    {12, 0x35}, {13, 0x6c}, {13, 0x6d}, {13, 0x4a}, {13, 0x4b}, {13, 0x4c},
+    {13, 0x4d}, {13, 0x72}, {13, 0x73}, {13, 0x74}, {13, 0x75}, {13, 0x76},
+    {13, 0x77}, {13, 0x52}, {13, 0x53}, {13, 0x54}, {13, 0x55}, {13, 0x5a},
+    {13, 0x5b}, {13, 0x64}, {13, 0x65}
+};
+
+// Make-up codes for runs 1792..2560, same for both colors (Table 3b)
+static const ccitt_code extended_makeup[13] = {
+    {11, 0x08}, {11, 0x0c}, {11, 0x0d}, {12, 0x12}, {12, 0x13}, {12, 0x14},
+    {12, 0x15}, {12, 0x16}, {12, 0x17}, {12, 0x1c}, {12, 0x1d}, {12, 0x1e},
+    {12, 0x1f}
+};
+
+// Two-dimensional mode codes (ITU-T T.4, Table 4)
+static const ccitt_code pass_code = {4, 0x1};
+static const ccitt_code horizontal_code = {3, 0x1};
+static const ccitt_code vertical_code[7] = {    // a1 - b1 = -3..3
+    {7, 0x02}, {6, 0x02}, {3, 0x02}, {1, 0x1}, {3, 0x03}, {6, 0x03}, {7, 0x03}
+};
+static const ccitt_code eol_code = {12, 0x1};
+
+class BitWriter
+{
+public:
+    BitWriter(std::string &out) : out(out), acc(0), bits(0) {}
+
+    void put(const ccitt_code &c)
+    {
+        acc = (acc << c.length) | c.code;
+        bits += c.length;
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back((char)((acc >> bits) & 0xff));
+        }
+    }
+
+    // pad the last byte with zero bits
+    void flush()
+    {
+        if (bits > 0)
+            out.push_back((char)((acc << (8 - bits)) & 0xff));
+        bits = 0;
+    }
+
+private:
+    std::string &out;
+    unsigned long acc;
+    unsigned bits;
+};
+
+static void put_run(BitWriter &bw, unsigned run, bool white)
+{
+    const ccitt_code *terminating = white ? white_terminating : black_terminating;
+    const ccitt_code *makeup = white ? white_makeup : black_makeup;
+
+    while (run >= 2624) // longest make-up code is 2560
+    {
+        bw.put(extended_makeup[12]);
+        run -= 2560;
+    }
+    if (run >= 1792)
+    {
+        bw.put(extended_makeup[(run - 1792) / 64]);
+        run %= 64;
+    }
+    else if (run >= 64)
+    {
+        bw.put(makeup[run / 64 - 1]);
+        run %= 64;
+    }
+    bw.put(terminating[run]);
+}
+
+// Convert a line into the positions of its changing elements (pixels with
+// a color different from the one left of them, starting with white).
+// The list is terminated with width twice, so that b1 and b2 always exist.
+static void find_changes(const unsigned char *line, unsigned width,
+                         std::vector<unsigned> &changes)
+{
+    changes.clear();
+    unsigned color = 0xff; // white
+    unsigned x = 0;
+    while (x < width)
+    {
+        // skip whole bytes of the current color
+        if ((x & 7) == 0)
+        {
+            while (x + 8 <= width && line[x >> 3] == color)
+                x += 8;
+            if (x >= width)
+                break;
+        }
+        unsigned bit = (line[x >> 3] >> (7 - (x & 7))) & 1 ? 0xff : 0;
+        if (bit != color)
+        {
+            changes.push_back(x);
+            color = bit;
+        }
+        x ++;
+    }
+    changes.push_back(width);
+    changes.push_back(width);
+}
+
+std::string ccittG4Encode(const unsigned char *data, unsigned width,
+                          unsigned height, unsigned bytes_per_line)
+{
+    std::string out;
+    BitWriter bw(out);
+    std::vector<unsigned> ref, cur;
+
+    ref.push_back(width); // imaginary all-white line above the image
+    ref.push_back(width);
+
+    for (unsigned y = 0; y < height; y ++)
+    {
+        find_changes(data + (size_t)y * bytes_per_line, width, cur);
+
+        // a0 starts on an imaginary white pixel left of the line
+        int a0 = -1;
+        bool white = true;
+        size_t ia1 = 0;  // index of a1 in cur
+        size_t ib = 0;   // search start in ref
+        while (a0 < (int)width)
+        {
+            unsigned a1 = cur[ia1];
+
+            // b1: first changing element on the reference line right of a0
+            // and of the opposite color of a0. Changing elements at even
+            // indices turn black, odd ones turn white.
+            while (ib > 0 && (int)ref[ib - 1] > a0)
+                ib --;
+            while ((int)ref[ib] <= a0 && ref[ib] < width)
+                ib ++;
+            if ((ib & 1) != (white ? 0 : 1))
+                ib ++;
+            unsigned b1 = ref[ib];
+            unsigned b2 = ref[ib + 1 < ref.size() ? ib + 1 : ib];
+
+            if (b2 < a1)
+            {
+                // pass mode
+                bw.put(pass_code);
+                a0 = b2;
+            }
+            else if ((int)a1 - (int)b1 >= -3 && (int)a1 - (int)b1 <= 3)
+            {
+                // vertical mode
+                bw.put(vertical_code[(int)a1 - (int)b1 + 3]);
+                a0 = a1;
+                white = !white;
+                ia1 ++;
+            }
+            else
+            {
+                // horizontal mode
+                unsigned a2 = cur[ia1 + 1];
+                bw.put(horizontal_code);
+                put_run(bw, a1 - (a0 < 0 ? 0 : a0), white);
+                put_run(bw, a2 - a1, !white);
+                a0 = a2;
+                ia1 += 2;
+            }
+            if (ia1 >= cur.size())
+                ia1 = cur.size() - 1;
+        }
+        ref.swap(cur);
+    }
+
+    // end of facsimile block
+    bw.put(eol_code);
+    bw.put(eol_code);
+    bw.flush();
+    return out;
+}
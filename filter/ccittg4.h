@@ -0,0 +1,35 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @brief CCITT Group 4 (ITU-T T.6) encoder for bilevel images
+ * @file ccittg4.h
+ */
+
+#ifndef _CCITTG4_H_
+#define _CCITTG4_H_
+
+#include <string>
+
+/**
+ * Encode a 1 bit per pixel image (most significant bit first, each line
+ * starting on a byte boundary, set bits are white) with CCITT Group 4.
+ * The result is suitable for a PDF stream with
+ *   /Filter /CCITTFaxDecode
+ *   /DecodeParms << /K -1 /Columns width /Rows height >>
+ * and decodes to exactly the same bits (/BlackIs1 false, the default).
+ */
+std::string ccittG4Encode(const unsigned char *data, unsigned width,
+                          unsigned height, unsigned bytes_per_line);
+
+#endif
@@ -0,0 +1,478 @@
+/*
+ *   Font resolution and subset cache for the text filters.
+ *
+ *   This file is licensed as noted in "COPYING"
+ *   which should have been included with this file.
+ *
+ *   Both caches live in $CUPS_CACHEDIR/fonts, without CUPS_CACHEDIR in
+ *   the environment nothing is cached. Files are written under a
+ *   temporary name and rename()d, so that concurrent jobs never see a
+ *   partially written entry.
+ *
+ *   font-<hash>.cache:    font pattern -> file name for otf_load(), with
+ *                         the files and directories fontconfig's answer
+ *                         depends on and their modification times
+ *   subset-<hash>.cache:  font file + glyph set -> subset font program
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fontconfig/fontconfig.h>
+#include "fontcache.h"
+#include "fontembed/sfnt.h"
+
+#define FONTCACHE_MAGIC        "cups-filters font cache 1"
+#define FONTCACHE_MAGIC_SUBSET "cups-filters-subset-1"
+#define FONTCACHE_MAX_AGE      86400  // resolve again daily, for new fonts
+#define FONTCACHE_MAX_SUBSETS  64     // older subsets are removed
+
+static unsigned long long fontcache_hash(unsigned long long hash,const void *buf,size_t len) // {{{ - FNV-1a
+{
+  const unsigned char *p=(const unsigned char *)buf;
+
+  while (len>0) {
+    hash^=*p++;
+    hash*=1099511628211ULL;
+    len--;
+  }
+  return hash;
+}
+// }}}
+#define FONTCACHE_HASH_INIT 14695981039346656037ULL
+
+static int fontcache_dir(char *dir,int size) // {{{ - returns false if there is no cache
+{
+  const char *cachedir=getenv("CUPS_CACHEDIR");
+
+  if (!cachedir) {
+    return 0;
+  }
+  return snprintf(dir,size,"%s/fonts",cachedir)<size;
+}
+// }}}
+
+static FILE *fontcache_create(const char *dir,char *tmp,int size) // {{{
+{
+  int fd;
+
+  mkdir(dir,0770);
+  snprintf(tmp,size,"%s/.tmpXXXXXX",dir);
+  if ((fd=mkstemp(tmp))<0) {
+    return NULL;
+  }
+  return fdopen(fd,"w");
+}
+// }}}
+
+static void fontcache_commit(FILE *f,const char *tmp,const char *path,int ok) // {{{
+{
+  if ( (fclose(f)!=0)||(!ok)||(rename(tmp,path)!=0) ) {
+    unlink(tmp);
+  } else {
+    fprintf(stderr,"DEBUG: Saved font data to %s\n",path);
+  }
+}
+// }}}
+
+// {{{ font resolution
+static char *fc_find(const char *font,char **fontfile) // {{{ - as texttopdf always did it
+{
+  FcPattern *pattern;
+  FcFontSet *candidates;
+  FcChar8   *fontname=NULL,*file;
+  FcResult   result;
+  int i;
+
+  FcInit();
+  pattern=FcNameParse((const FcChar8 *)font);
+  if (!pattern) {
+    return NULL;
+  }
+  FcPatternAddInteger(pattern,FC_SPACING,FC_MONO); // guide fc, in case substitution becomes necessary
+  FcConfigSubstitute(0,pattern,FcMatchPattern);
+  FcDefaultSubstitute(pattern);
+
+  /* Receive a sorted list of fonts matching our pattern */
+  candidates=FcFontSort(0,pattern,FcFalse,0,&result);
+  FcPatternDestroy(pattern);
+  if (!candidates) {
+    return NULL;
+  }
+
+  /* In the list of fonts returned by FcFontSort()
+     find the first one that is both in TrueType format and monospaced */
+  for (i=0;i<candidates->nfont;i++) {
+    FcChar8 *fontformat=NULL; // TODO? or just try?
+    int spacing=0; // sane default, as FC_MONO == 100
+    FcPatternGetString(candidates->fonts[i],FC_FONTFORMAT,0,&fontformat);
+    FcPatternGetInteger(candidates->fonts[i],FC_SPACING,0,&spacing);
+
+    if ( (fontformat)&&(spacing==FC_MONO) ) {
+      if (strcmp((const char *)fontformat,"TrueType")==0) {
+        fontname=FcPatternFormat(candidates->fonts[i],(const FcChar8 *)"%{file|cescape}/%{index}");
+      } else if (strcmp((const char *)fontformat,"CFF")==0) {
+        fontname=FcPatternFormat(candidates->fonts[i],(const FcChar8 *)"%{file|cescape}"); // TTC only possible with non-cff glyphs!
+      }
+      if (fontname) {
+        if (FcPatternGetString(candidates->fonts[i],FC_FILE,0,&file)==FcResultMatch) {
+          *fontfile=strdup((const char *)file);
+        }
+        break;
+      }
+    }
+  }
+  FcFontSetDestroy(candidates);
+  return (char *)fontname;
+}
+// }}}
+
+static int write_dep(FILE *f,const char *path) // {{{ - returns false if path cannot be stored
+{
+  struct stat st;
+
+  if (strchr(path,'\n')) {
+    return 0;
+  }
+  if (stat(path,&st)==0) {
+    fprintf(f,"D %ld %ld %s\n",(long)st.st_mtime,(long)st.st_size,path);
+  } else {
+    fprintf(f,"D -1 -1 %s\n",path);
+  }
+  return 1;
+}
+// }}}
+
+static int write_dep_list(FILE *f,FcStrList *list,int parents) // {{{
+{
+  FcChar8 *str;
+  char last[1024]="";
+  int ok=1;
+
+  if (!list) {
+    return 1;
+  }
+  while ( (ok)&&((str=FcStrListNext(list))!=NULL) ) {
+    ok=write_dep(f,(const char *)str);
+    if ( (ok)&&(parents) ) {
+      // new files in conf.d/ only show in the directory
+      const char *slash=strrchr((const char *)str,'/');
+      if ( (slash)&&(slash>(const char *)str)&&
+           (slash-(const char *)str<(int)sizeof(last)) ) {
+        char dir[1024];
+        memcpy(dir,str,slash-(const char *)str);
+        dir[slash-(const char *)str]=0;
+        if (strcmp(dir,last)!=0) {
+          ok=write_dep(f,dir);
+          strcpy(last,dir);
+        }
+      }
+    }
+  }
+  FcStrListDone(list);
+  return ok;
+}
+// }}}
+
+static void save_resolved(const char *dir,const char *path,const char *key,const char *fontname,const char *fontfile) // {{{
+{
+  char tmp[1024];
+  FILE *f;
+  int ok;
+
+  if ( (!fontfile)||(strchr(fontname,'\n')) ) {
+    return;
+  }
+  if ((f=fontcache_create(dir,tmp,sizeof(tmp)))==NULL) {
+    return;
+  }
+  fprintf(f,"%s\n"
+            "K %s\n"
+            "F %s\n",
+            FONTCACHE_MAGIC,key,fontname);
+  // fonts installed without running fc-cache only show in the font
+  // directories, fontconfig rescans them by itself
+  ok=write_dep(f,fontfile)&&
+     write_dep_list(f,FcConfigGetConfigFiles(NULL),1)&&
+     write_dep_list(f,FcConfigGetFontDirs(NULL),0)&&
+     write_dep_list(f,FcConfigGetCacheDirs(NULL),0);
+  fontcache_commit(f,tmp,path,ok);
+}
+// }}}
+
+static int read_line(FILE *f,char *line,int size) // {{{ - without '\n', false on EOF or too long lines
+{
+  int len;
+
+  if (!fgets(line,size,f)) {
+    return 0;
+  }
+  len=strlen(line);
+  if ( (len==0)||(line[len-1]!='\n') ) {
+    return 0;
+  }
+  line[len-1]=0;
+  return 1;
+}
+// }}}
+
+static char *load_resolved(const char *path,const char *key) // {{{
+{
+  FILE *f;
+  struct stat st;
+  char line[4096];
+  char *fontname=NULL;
+  int ok;
+
+  if ((f=fopen(path,"r"))==NULL) {
+    return NULL;
+  }
+  ok=(fstat(fileno(f),&st)==0)&&
+     (time(NULL)-st.st_mtime<FONTCACHE_MAX_AGE)&&
+     (read_line(f,line,sizeof(line)))&&(strcmp(line,FONTCACHE_MAGIC)==0)&&
+     (read_line(f,line,sizeof(line)))&&(strncmp(line,"K ",2)==0)&&
+     (strcmp(line+2,key)==0)&&
+     (read_line(f,line,sizeof(line)))&&(strncmp(line,"F ",2)==0);
+  if (ok) {
+    fontname=strdup(line+2);
+  }
+
+  // all files fontconfig looked at must be unchanged
+  while ( (ok)&&(read_line(f,line,sizeof(line))) ) {
+    long mtime,size;
+    int pos=0;
+    if ( (sscanf(line,"D %ld %ld %n",&mtime,&size,&pos)<2)||(pos<=0) ) {
+      ok=0;
+    } else if (stat(line+pos,&st)==0) {
+      ok=( (mtime==(long)st.st_mtime)&&(size==(long)st.st_size) );
+    } else {
+      ok=(mtime==-1);
+    }
+  }
+  if ( (!ok)||(ferror(f)) ) {
+    free(fontname);
+    fontname=NULL;
+  }
+  fclose(f);
+  return fontname;
+}
+// }}}
+
+char *fontcache_resolve(const char *font) // {{{
+{
+  char dir[1024],path[1024],key[2048];
+  char *fontname,*fontfile=NULL;
+  const char *fcfile=getenv("FONTCONFIG_FILE"),
+             *fcpath=getenv("FONTCONFIG_PATH");
+  int cache;
+
+  // the environment selects the fontconfig configuration
+  cache=(fontcache_dir(dir,sizeof(dir)))&&
+        (snprintf(key,sizeof(key),"%s\t%s\t%s",font,
+                  fcfile?fcfile:"",fcpath?fcpath:"")<(int)sizeof(key))&&
+        (!strchr(key,'\n'));
+  if (cache) {
+    snprintf(path,sizeof(path),"%s/font-%016llx.cache",dir,
+             fontcache_hash(FONTCACHE_HASH_INIT,key,strlen(key)));
+    if ((fontname=load_resolved(path,key))!=NULL) {
+      fprintf(stderr,"DEBUG: Using cached font %s for \"%s\"\n",fontname,font);
+      return fontname;
+    }
+  }
+
+  fontname=fc_find(font,&fontfile);
+  if ( (fontname)&&(cache) ) {
+    save_resolved(dir,path,key,fontname,fontfile);
+  }
+  free(fontfile);
+  return fontname;
+}
+// }}}
+// }}}
+
+// {{{ subset cache
+struct capture {
+  OUTPUT_FN output;
+  void *context;
+  char *buf;
+  int len,alloc;
+  int failed;
+};
+
+static void capture_outfn(const char *buf,int len,void *context) // {{{ - pass on, and keep a copy
+{
+  struct capture *cap=(struct capture *)context;
+
+  (*cap->output)(buf,len,cap->context);
+  if (cap->failed) {
+    return;
+  }
+  if (cap->len+len>cap->alloc) {
+    int alloc=cap->alloc*2+len;
+    char *tmp=realloc(cap->buf,alloc);
+    if (!tmp) {
+      cap->failed=1;
+      return;
+    }
+    cap->buf=tmp;
+    cap->alloc=alloc;
+  }
+  memcpy(cap->buf+cap->len,buf,len);
+  cap->len+=len;
+}
+// }}}
+
+static int subset_cmp(const void *a,const void *b) // {{{ - oldest first
+{
+  const time_t ta=*(const time_t *)a,tb=*(const time_t *)b;
+  return (ta<tb)?-1:(ta>tb);
+}
+// }}}
+
+struct subset_file {
+  time_t mtime; // first, for subset_cmp
+  char name[64];
+};
+
+static void prune_subsets(const char *dir) // {{{
+{
+  DIR *d;
+  struct dirent *de;
+  struct stat st;
+  struct subset_file *files=NULL;
+  int num=0,alloc=0,i;
+  char path[1024];
+
+  if ((d=opendir(dir))==NULL) {
+    return;
+  }
+  while ((de=readdir(d))!=NULL) {
+    if ( (strncmp(de->d_name,"subset-",7)!=0)||
+         (strlen(de->d_name)>=sizeof(files->name)) ) {
+      continue;
+    }
+    snprintf(path,sizeof(path),"%s/%s",dir,de->d_name);
+    if (stat(path,&st)!=0) {
+      continue;
+    }
+    if (num==alloc) {
+      struct subset_file *tmp;
+      alloc+=FONTCACHE_MAX_SUBSETS;
+      if ((tmp=realloc(files,alloc*sizeof(*files)))==NULL) {
+        break;
+      }
+      files=tmp;
+    }
+    files[num].mtime=st.st_mtime;
+    strcpy(files[num].name,de->d_name);
+    num++;
+  }
+  closedir(d);
+
+  if (num>FONTCACHE_MAX_SUBSETS) {
+    qsort(files,num,sizeof(*files),subset_cmp);
+    for (i=0;i<num-FONTCACHE_MAX_SUBSETS;i++) {
+      snprintf(path,sizeof(path),"%s/%s",dir,files[i].name);
+      unlink(path);
+    }
+  }
+  free(files);
+}
+// }}}
+
+static int load_subset(const char *path,const char *header,EMB_PARAMS *emb,int bslen,OUTPUT_FN output,void *context) // {{{ - returns -1 if not cached
+{
+  FILE *f;
+  char line[256];
+  int outlen,pos=0,ret=-1;
+  char *buf;
+
+  if ((f=fopen(path,"rb"))==NULL) {
+    return -1;
+  }
+  // header, input glyph set, glyph set after subsetting, font program
+  if ( (read_line(f,line,sizeof(line)))&&
+       (strncmp(line,FONTCACHE_MAGIC_SUBSET " ",sizeof(FONTCACHE_MAGIC_SUBSET))==0)&&
+       (sscanf(line+sizeof(FONTCACHE_MAGIC_SUBSET),"%d%n",&outlen,&pos)==1)&&(outlen>0)&&
+       (strcmp(line+sizeof(FONTCACHE_MAGIC_SUBSET)+pos,header)==0)&&
+       ((buf=malloc(2*bslen+outlen))!=NULL) ) {
+    if ( (fread(buf,1,2*bslen+outlen,f)==(size_t)(2*bslen+outlen))&&
+         (memcmp(buf,emb->subset,bslen)==0) ) {
+      memcpy(emb->subset,buf+bslen,bslen);
+      (*output)(buf+2*bslen,outlen,context);
+      ret=outlen;
+    }
+    free(buf);
+  }
+  fclose(f);
+  if (ret>=0) {
+    utime(path,NULL); // recently used, see prune_subsets()
+  }
+  return ret;
+}
+// }}}
+
+int fontcache_embed(EMB_PARAMS *emb,OUTPUT_FN output,void *context) // {{{
+{
+  assert(emb);
+
+  OTF_FILE *otf=emb->font->sfnt;
+  char dir[1024],path[1024],tmp[1024],header[128];
+  struct stat st;
+  int bslen,ret;
+
+  // only subsetting is worth caching, otherwise the font is just copied
+  if ( (emb->dest!=EMB_DEST_PDF16)||(!(emb->plan&EMB_A_SUBSET))||(!otf)||
+       ( (emb->outtype!=EMB_FMT_TTF)&&
+         ( (emb->outtype!=EMB_FMT_OTF)||(emb->plan&EMB_A_CFF_TO_OTF) ) )||
+       (!fontcache_dir(dir,sizeof(dir)))||
+       (fstat(fileno(otf->f),&st)!=0) ) {
+    return emb_embed(emb,output,context);
+  }
+
+  // the font file, as it is now, and the face in it
+  snprintf(header,sizeof(header)," %lx %lx %ld %ld %u %d %d",
+           (unsigned long)st.st_dev,(unsigned long)st.st_ino,
+           (long)st.st_size,(long)st.st_mtime,
+           otf->useTTC,emb->outtype,otf->numGlyphs);
+  bslen=((otf->numGlyphs+8*sizeof(int)-1)&~(8*sizeof(int)-1))/8;
+  snprintf(path,sizeof(path),"%s/subset-%016llx.cache",dir,
+           fontcache_hash(fontcache_hash(FONTCACHE_HASH_INIT,header,strlen(header)),
+                          emb->subset,bslen));
+
+  if ((ret=load_subset(path,header,emb,bslen,output,context))>=0) {
+    fprintf(stderr,"DEBUG: Using cached font subset %s\n",path);
+    return ret;
+  }
+
+  // subsetting adds glyphs (.notdef, composite parts) to emb->subset
+  struct capture cap={output,context,NULL,0,0,0};
+  char *glyphs=malloc(bslen);
+  if (!glyphs) {
+    return emb_embed(emb,output,context);
+  }
+  memcpy(glyphs,emb->subset,bslen);
+  ret=emb_embed(emb,capture_outfn,&cap);
+
+  FILE *f;
+  if ( (ret>0)&&(!cap.failed)&&(cap.len==ret)&&
+       ((f=fontcache_create(dir,tmp,sizeof(tmp)))!=NULL) ) {
+    fprintf(f,"%s %d%s\n",FONTCACHE_MAGIC_SUBSET,ret,header);
+    fwrite(glyphs,1,bslen,f);
+    fwrite(emb->subset,1,bslen,f);
+    fwrite(cap.buf,1,cap.len,f);
+    fontcache_commit(f,tmp,path,!ferror(f));
+    prune_subsets(dir);
+  }
+  free(glyphs);
+  free(cap.buf);
+  return ret;
+}
+// }}}
+// }}}
@@ -0,0 +1,28 @@
+/*
+ *   Font resolution and subset cache for the text filters.
+ *
+ *   This file is licensed as noted in "COPYING"
+ *   which should have been included with this file.
+ *
+ */
+#ifndef _FONTCACHE_H
+#define _FONTCACHE_H
+
+#include "fontembed/embed.h"
+
+/* Find a monospaced TrueType or CFF font for the fontconfig pattern >font,
+ * as file name for otf_load() (with "/index" for TrueType collections).
+ * The result is kept in $CUPS_CACHEDIR/fonts, later jobs use it without
+ * asking fontconfig, until the fontconfig configuration, its caches or
+ * the font file change.
+ * returns a malloc()ed string, or NULL if there is no viable font
+ */
+char *fontcache_resolve(const char *font);
+
+/* Same as emb_embed(), but a subset font program is taken from
+ * $CUPS_CACHEDIR/fonts if an earlier job already subset the same font
+ * file to the same glyphs. Otherwise it is saved there for later jobs.
+ */
+int fontcache_embed(EMB_PARAMS *emb,OUTPUT_FN output,void *context);
+
+#endif
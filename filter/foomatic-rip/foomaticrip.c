@@ -139,6 +139,7 @@ int spooler = SPOOLER_DIRECT;
 int dontparse = 0;
 int jobhasjcl;
 int pdfconvertedtops;
+int moredocuments = 0; /* more documents of the job follow the current one */
 
 
 /* cm-calibration flag */
@@ -1101,11 +1102,15 @@ int main(int argc, char** argv)
            PostScript file (all before the first page begins). */
         optionset_copy_values(optionset("userval"), optionset("header"));
 
+        moredocuments = (p && p[strspn(p, " ")] != '\0');
         if (!print_file(filename, 1))
 	    rip_die(EXIT_PRNERR_NORETRY, "Could not print file %s\n", filename);
         filename = strtok_r(NULL, " ", &p);
     }
 
+    /* Finish the renderer kept running for further documents */
+    close_kept_renderer();
+
     /* Close the last input file */
     fclose(stdin);
 
@@ -113,6 +113,7 @@ extern int do_docs;
 extern char printer_model[];
 extern int dontparse;
 extern int pdfconvertedtops;
+extern int moredocuments;
 extern char gspath[PATH_MAX];
 extern char echopath[PATH_MAX];
 
@@ -30,6 +30,7 @@
 #include <regex.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 /* qualifier -> filename mapping entry */
 typedef struct icc_mapping_entry_s {
@@ -78,6 +79,18 @@ list_t *qualifier_data = NULL;
 char **qualifier = NULL;
 
 option_t *optionlist = NULL;
+static option_t *optionlist_last = NULL;
+
+/* Hash index of optionlist by name, see option_index_add() */
+static option_t **option_index = NULL;
+static size_t option_index_size = 0;
+static size_t option_index_count = 0;
+
+/* Cleared when values of "pages:" optionsets are added or removed, see
+   compile_page_options() */
+static int page_options_valid = 0;
+static void free_page_options();
+
 option_t *optionlist_sorted_by_order = NULL;
 
 int optionset_alloc, optionset_count;
@@ -265,6 +278,7 @@ static void free_option(option_t *opt)
         opt->choicelist = opt->choicelist->next;
         free(choice);
     }
+    free(opt->choice_index);
     while (opt->paramlist) {
         param = opt->paramlist;
         opt->paramlist = opt->paramlist->next;
@@ -309,6 +323,12 @@ void options_free()
         optionlist = optionlist->next;
         free_option(opt);
     }
+    optionlist_last = NULL;
+    free_page_options();
+    free(option_index);
+    option_index = NULL;
+    option_index_size = 0;
+    option_index_count = 0;
 
     if (postpipe)
         free_dstr(postpipe);
@@ -318,14 +338,94 @@ void options_free()
     free_dstr(pagesetupprepend);
 }
 
-size_t option_count()
+/*
+ *  Hash indices of the options and of the choices of each option
+ *
+ *  PPDs generated by Foomatic can have hundreds of options with thousands
+ *  of choices, and options are looked up by name for every PPD line and
+ *  every command line option. Names are compared case-insensitively.
+ */
+
+static unsigned int name_hash(const char *name)
+{
+    unsigned int hash = 5381;
+
+    while (*name)
+        hash = hash * 33 + tolower((unsigned char)*name++);
+    return hash;
+}
+
+static void option_index_add(option_t *opt)
+{
+    option_t **index, *o, *next;
+    size_t size, i;
+
+    /* Keep at most one option per bucket on average */
+    if (option_index_count >= option_index_size) {
+        size = option_index_size ? 2 * option_index_size : 64;
+        index = calloc(size, sizeof(option_t *));
+        for (i = 0; i < option_index_size; i++)
+            for (o = option_index[i]; o; o = next) {
+                next = o->next_in_index;
+                o->next_in_index = index[o->hash % size];
+                index[o->hash % size] = o;
+            }
+        free(option_index);
+        option_index = index;
+        option_index_size = size;
+    }
+
+    opt->hash = name_hash(opt->name);
+    opt->next_in_index = option_index[opt->hash % option_index_size];
+    option_index[opt->hash % option_index_size] = opt;
+    option_index_count++;
+}
+
+static option_t * option_index_find(const char *name)
 {
     option_t *opt;
-    size_t cnt = 0;
+    unsigned int hash;
 
-    for (opt = optionlist; opt; opt = opt->next)
-        cnt++;
-    return cnt;
+    if (!option_index_size)
+        return NULL;
+
+    hash = name_hash(name);
+    for (opt = option_index[hash % option_index_size]; opt;
+         opt = opt->next_in_index) {
+        if (opt->hash == hash && !strcasecmp(opt->name, name))
+            return opt;
+    }
+    return NULL;
+}
+
+static void choice_index_add(option_t *opt, choice_t *choice)
+{
+    choice_t **index, *c, *next;
+    size_t size, i;
+
+    if (opt->choice_count >= opt->choice_index_size) {
+        size = opt->choice_index_size ? 2 * opt->choice_index_size : 8;
+        index = calloc(size, sizeof(choice_t *));
+        for (i = 0; i < opt->choice_index_size; i++)
+            for (c = opt->choice_index[i]; c; c = next) {
+                next = c->next_in_index;
+                c->next_in_index = index[c->hash % size];
+                index[c->hash % size] = c;
+            }
+        free(opt->choice_index);
+        opt->choice_index = index;
+        opt->choice_index_size = size;
+    }
+
+    choice->hash = name_hash(choice->value);
+    choice->next_in_index = opt->choice_index[choice->hash % opt->choice_index_size];
+    opt->choice_index[choice->hash % opt->choice_index_size] = choice;
+    opt->choice_count++;
+}
+
+size_t option_count()
+{
+    return option_index_count;
 }
 
 option_t * find_option(const char *name)
@@ -336,18 +436,19 @@ option_t * find_option(const char *name)
     if (!strcasecmp(name, "PageRegion"))
         return find_option("PageSize");
 
-    for (opt = optionlist; opt; opt = opt->next) {
-      if ((!strcasecmp(opt->name, name)) ||
-	  ((!strcasecmp(opt->name, &name[2])) &&
-	   (!prefixcasecmp(name, "no"))))
-            return opt;
-    }
+    if ((opt = option_index_find(name)))
+        return opt;
+
+    /* "noFoo" for the boolean option "Foo" */
+    if (!prefixcasecmp(name, "no"))
+        return option_index_find(&name[2]);
+
     return NULL;
 }
 
 option_t * assure_option(const char *name)
 {
-    option_t *opt, *last;
+    option_t *opt;
 
     if ((opt = find_option(name)))
         return opt;
@@ -371,12 +472,12 @@ option_t * assure_option(const char *name)
     opt->type = TYPE_NONE;
 
     /* append opt to optionlist */
-    if (optionlist) {
-        for (last = optionlist; last->next; last = last->next);
-        last->next = opt;
-    }
+    if (optionlist_last)
+        optionlist_last->next = opt;
     else
         optionlist = opt;
+    optionlist_last = opt;
+    option_index_add(opt);
 
     /* prepend opt to optionlist_sorted_by_order
        (0 is always at the beginning) */
@@ -451,6 +552,8 @@ static value_t * option_assure_value(option_t *opt, int optionset)
     if (!val) {
         val = calloc(1, sizeof(value_t));
         val->optionset = optionset;
+        if (startswith(optionset_name(optionset), "pages:"))
+            page_options_valid = 0;
 
         /* append to opt->valuelist */
         if (opt->valuelist) {
@@ -482,9 +585,14 @@ static param_t * option_find_param_index(option_t *opt, const char *name, int *i
 static choice_t * option_find_choice(option_t *opt, const char *name)
 {
     choice_t *choice;
+    unsigned int hash;
     assert(opt && name);
-    for (choice = opt->choicelist; choice; choice = choice->next) {
-        if (!strcasecmp(choice->value, name))
+    if (!opt->choice_index_size)
+        return NULL;
+    hash = name_hash(name);
+    for (choice = opt->choice_index[hash % opt->choice_index_size]; choice;
+         choice = choice->next_in_index) {
+        if (choice->hash == hash && !strcasecmp(choice->value, name))
             return choice;
     }
     return NULL;
@@ -1126,21 +1234,19 @@ void option_set_from_string(option_t *opt, const char *str)
 
 static choice_t * option_assure_choice(option_t *opt, const char *name)
 {
-    choice_t *choice, *last = NULL;
+    choice_t *choice;
 
-    for (choice = opt->choicelist; choice; choice = choice->next) {
-        if (!strcasecmp(choice->value, name))
-            return choice;
-        last = choice;
-    }
-    if (!choice) {
-        choice = calloc(1, sizeof(choice_t));
-        if (last)
-            last->next = choice;
-        else
-            opt->choicelist = choice;
-        strlcpy(choice->value, name, 128);
-    }
+    if ((choice = option_find_choice(opt, name)))
+        return choice;
+
+    choice = calloc(1, sizeof(choice_t));
+    if (opt->choicelist_last)
+        opt->choicelist_last->next = choice;
+    else
+        opt->choicelist = choice;
+    opt->choicelist_last = choice;
+    strlcpy(choice->value, name, 128);
+    choice_index_add(opt, choice);
     return choice;
 }
 
@@ -1502,6 +1608,9 @@ void optionset_delete_values(int optionset)
     option_t *opt;
     value_t *val, *prev_val;
 
+    if (startswith(optionset_name(optionset), "pages:"))
+        page_options_valid = 0;
+
     for (opt = optionlist; opt; opt = opt->next) {
         val = opt->valuelist;
         prev_val = NULL;
@@ -2184,43 +2293,55 @@ static void free_page_ranges(page_range_t *ranges)
     }
 }
 
-/* Parse a string containing page ranges and either check whether a
-   given page is in the ranges or, if the given page number is zero,
-   determine the score how specific this page range string is.*/
-int get_page_score(const char *pages, int page)
+static int page_ranges_score(page_range_t *ranges)
 {
-    page_range_t *ranges = parse_page_ranges(pages);
     page_range_t *pr;
     int totalscore = 0;
-    int pageinside = 0;
 
     for (pr = ranges; pr; pr = pr->next) {
-        if (pr->even) {
+        if (pr->even || pr->odd)
             totalscore += 50000;
+        else if (pr->first == pr->last)     /* Single page */
+            totalscore += 1;
+        else if (pr->last == 0)             /* To the end of the document */
+            totalscore += 100000;
+        else                                /* Sequence of pages */
+            totalscore += pr->last - pr->first +1;
+    }
+    return totalscore;
+}
+
+static int page_in_ranges(page_range_t *ranges, unsigned page)
+{
+    page_range_t *pr;
+
+    for (pr = ranges; pr; pr = pr->next) {
+        if (pr->even) {
             if (page % 2 == 0)
-                pageinside = 1;
+                return 1;
         }
         else if (pr->odd) {
-            totalscore += 50000;
             if (page % 2 == 1)
-                pageinside = 1;
-        }
-        else if (pr->first == pr->last) {   /* Single page */
-            totalscore += 1;
-            if (page == pr->first)
-                pageinside = 1;
+                return 1;
         }
-        else if (pr->last == 0) {           /* To the end of the document */
-            totalscore += 100000;
+        else if (pr->last == 0 && pr->first != 0) {
             if (page >= pr->first)
-                pageinside = 1;
-        }
-        else {                              /* Sequence of pages */
-            totalscore += pr->last - pr->first +1;
-            if (page >= pr->first && page <= pr->last)
-                pageinside = 1;
+                return 1;
         }
+        else if (page >= pr->first && page <= pr->last)
+            return 1;
     }
+    return 0;
+}
+
+/* Parse a string containing page ranges and either check whether a
+   given page is in the ranges or, if the given page number is zero,
+   determine the score how specific this page range string is.*/
+int get_page_score(const char *pages, int page)
+{
+    page_range_t *ranges = parse_page_ranges(pages);
+    int totalscore = page_ranges_score(ranges);
+    int pageinside = page_in_ranges(ranges, page);
 
     free_page_ranges(ranges);
 
@@ -2230,35 +2351,250 @@ int get_page_score(const char *pages, int page)
     return 0;
 }
 
-/* Set the options for a given page */
-void set_options_for_page(int optset, int page)
+/*
+ *  Page-dependent option values
+ *
+ *  The "pages:<ranges>" optionsets are parsed only once, and for every
+ *  option with such values the page numbers are split into segments in
+ *  which the best value only depends on whether the page is even or odd.
+ *  Setting the options for a page is then a lookup of its segment.
+ */
+
+typedef struct page_segment_s {
+    unsigned first;             /* lasts until the next segment starts */
+    value_t *value[2];          /* best value for even and odd pages */
+} page_segment_t;
+
+typedef struct page_option_s {
+    option_t *opt;
+    page_segment_t *segments;
+    size_t segment_count;
+} page_option_t;
+
+typedef struct page_optionset_s {
+    page_range_t *ranges;       /* NULL if not a "pages:" optionset */
+    int score;
+} page_optionset_t;
+
+static page_optionset_t *page_optionsets = NULL;    /* by optionset index */
+static int page_optionset_count = 0;
+static page_option_t *page_options = NULL;
+static size_t page_option_count = 0;
+static unsigned *page_boundaries = NULL;    /* first pages of all segments */
+static size_t page_boundary_count = 0;
+static int page_parity_matters = 0;
+
+static void free_page_options()
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < page_optionset_count; i++)
+        free_page_ranges(page_optionsets[i].ranges);
+    free(page_optionsets);
+    page_optionsets = NULL;
+    page_optionset_count = 0;
+
+    for (j = 0; j < page_option_count; j++)
+        free(page_options[j].segments);
+    free(page_options);
+    page_options = NULL;
+    page_option_count = 0;
+
+    free(page_boundaries);
+    page_boundaries = NULL;
+    page_boundary_count = 0;
+    page_parity_matters = 0;
+    page_options_valid = 0;
+}
+
+static int compare_pages(const void *a, const void *b)
+{
+    unsigned pa = *(const unsigned *)a, pb = *(const unsigned *)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+/* Add the pages where 'ranges' start or end to 'pages', sorted and
+   without duplicates. 'pages' has room for all of them. */
+static void add_page_boundaries(unsigned *pages, size_t *count,
+                                page_range_t *ranges)
+{
+    page_range_t *pr;
+    size_t i, n = *count;
+
+    for (pr = ranges; pr; pr = pr->next) {
+        if (pr->even || pr->odd)
+            continue;
+        if (pr->first > 1)
+            pages[n++] = pr->first;
+        if (pr->last != 0 && pr->last < UINT_MAX)
+            pages[n++] = pr->last + 1;
+    }
+
+    qsort(pages, n, sizeof(unsigned), compare_pages);
+    for (i = 0, *count = 0; i < n; i++)
+        if (*count == 0 || pages[*count - 1] != pages[i])
+            pages[(*count)++] = pages[i];
+}
+
+static size_t count_page_ranges(page_range_t *ranges)
+{
+    size_t cnt = 0;
+
+    for (; ranges; ranges = ranges->next)
+        cnt++;
+    return cnt;
+}
+
+/* Best value of 'opt' for 'page', same rules as get_page_score() */
+static value_t * best_page_value(option_t *opt, unsigned page)
+{
+    int score, bestscore = 10000000;
+    value_t *val, *bestvalue = NULL;
+    page_optionset_t *pos;
+
+    for (val = opt->valuelist; val; val = val->next) {
+        if (val->optionset >= page_optionset_count)
+            continue;
+        pos = &page_optionsets[val->optionset];
+        if (!pos->ranges)
+            continue;
+
+        score = (page == 0 || page_in_ranges(pos->ranges, page)) ?
+            pos->score : 0;
+        if (score && score < bestscore) {
+            bestscore = score;
+            bestvalue = val;
+        }
+    }
+    return bestvalue;
+}
+
+static void compile_page_options()
 {
-    int score, bestscore;
     option_t *opt;
-    value_t *val, *bestvalue;
-    const char *ranges;
+    value_t *val;
+    page_option_t *po;
+    page_range_t *pr;
+    unsigned *pages;
+    size_t npages, maxpages, allpages, i;
     const char *optsetname;
+    int k, has_page_values;
+
+    free_page_options();
+
+    /* Parse the ranges of all "pages:" optionsets */
+    page_optionset_count = optionset_count;
+    page_optionsets = calloc(page_optionset_count ? page_optionset_count : 1,
+                             sizeof(page_optionset_t));
+    maxpages = 1;
+    for (k = 0; k < page_optionset_count; k++) {
+        optsetname = optionset_name(k);
+        if (!startswith(optsetname, "pages:"))
+            continue;
+        page_optionsets[k].ranges = parse_page_ranges(&optsetname[6]);
+        page_optionsets[k].score = page_ranges_score(page_optionsets[k].ranges);
+        maxpages += 2 * count_page_ranges(page_optionsets[k].ranges);
+        for (pr = page_optionsets[k].ranges; pr; pr = pr->next)
+            if (pr->even || pr->odd)
+                page_parity_matters = 1;
+    }
+
+    page_options = calloc(option_count() ? option_count() : 1,
+                          sizeof(page_option_t));
+    /* Merged with the boundaries of one more option before removing
+       duplicates */
+    page_boundaries = calloc(2 * maxpages, sizeof(unsigned));
+    pages = calloc(maxpages, sizeof(unsigned));
+    allpages = 0;
 
     for (opt = optionlist; opt; opt = opt->next) {
+        /* Segment boundaries of this option */
+        pages[0] = 1;
+        npages = 1;
+        has_page_values = 0;
+        for (val = opt->valuelist; val; val = val->next)
+            if (val->optionset < page_optionset_count &&
+                page_optionsets[val->optionset].ranges) {
+                add_page_boundaries(pages, &npages,
+                                    page_optionsets[val->optionset].ranges);
+                has_page_values = 1;
+            }
+        if (!has_page_values)
+            continue;
 
-        bestscore = 10000000;
-        bestvalue = NULL;
-        for (val = opt->valuelist; val; val = val->next) {
+        po = &page_options[page_option_count++];
+        po->opt = opt;
+        po->segment_count = npages;
+        po->segments = calloc(npages, sizeof(page_segment_t));
+        for (i = 0; i < npages; i++) {
+            po->segments[i].first = pages[i];
+            po->segments[i].value[pages[i] % 2] = best_page_value(opt, pages[i]);
+            po->segments[i].value[(pages[i] + 1) % 2] =
+                best_page_value(opt, pages[i] + 1);
+        }
 
-            optsetname = optionset_name(val->optionset);
-            if (!startswith(optsetname, "pages:"))
-                continue;
+        memcpy(&page_boundaries[allpages], pages, npages * sizeof(unsigned));
+        allpages += npages;
+        qsort(page_boundaries, allpages, sizeof(unsigned), compare_pages);
+        for (i = 0, npages = allpages, allpages = 0; i < npages; i++)
+            if (allpages == 0 || page_boundaries[allpages - 1] != page_boundaries[i])
+                page_boundaries[allpages++] = page_boundaries[i];
+    }
+    page_boundary_count = allpages;
+
+    free(pages);
+    page_options_valid = 1;
+}
+
+/* Set the options for a given page */
+void set_options_for_page(int optset, int page)
+{
+    page_option_t *po;
+    page_segment_t *seg;
+    value_t *bestvalue;
+    size_t lo, hi, mid;
 
-            ranges = &optsetname[6]; /* after "pages:" */
-            score = get_page_score(ranges, page);
-            if (score && score < bestscore) {
-                bestscore = score;
-                bestvalue = val;
+    if (!page_options_valid)
+        compile_page_options();
+
+    for (po = page_options; po < page_options + page_option_count; po++) {
+        if (page < 1)
+            bestvalue = best_page_value(po->opt, 0);
+        else {
+            /* Last segment starting at or before the page */
+            lo = 0;
+            hi = po->segment_count;
+            while (hi - lo > 1) {
+                mid = (lo + hi) / 2;
+                if (po->segments[mid].first <= (unsigned)page)
+                    lo = mid;
+                else
+                    hi = mid;
             }
+            seg = &po->segments[lo];
+            bestvalue = seg->value[page % 2];
         }
 
         if (bestvalue)
-            option_set_value(opt, optset, bestvalue->value);
+            option_set_value(po->opt, optset, bestvalue->value);
     }
 }
 
+/* First page after 'page' for which set_options_for_page() can set
+   different values, 0 if all following pages get the same ones */
+int next_page_option_change(int page)
+{
+    size_t i;
+
+    if (!page_options_valid)
+        compile_page_options();
+
+    if (page_parity_matters)
+        return page + 1;
+
+    for (i = 0; i < page_boundary_count; i++)
+        if (page_boundaries[i] > (unsigned)page)
+            return page_boundaries[i];
+    return 0;
+}
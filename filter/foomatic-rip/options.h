@@ -57,6 +57,9 @@ typedef struct choice_s {
     char text [128];
     char command[65536];
     struct choice_s *next;
+
+    unsigned int hash;                  /* name_hash(value) */
+    struct choice_s *next_in_index;     /* same bucket of choice_index */
 } choice_t;
 
 /* Custom option parameter */
@@ -89,6 +92,12 @@ typedef struct option_s {
     int notfirst;               /* TODO remove */
 
     choice_t *choicelist;
+    choice_t *choicelist_last;
+
+    /* Hash index of choicelist by value, case-insensitive */
+    choice_t **choice_index;
+    size_t choice_index_size;
+    size_t choice_count;
 
     /* Foomatic PPD extensions */
     char *proto;                /* *FoomaticRIPOptionPrototype: if this is set
@@ -105,6 +114,9 @@ typedef struct option_s {
 
     struct option_s *next;
     struct option_s *next_by_order;
+
+    unsigned int hash;                  /* name_hash(name) */
+    struct option_s *next_in_index;     /* same bucket of option_index */
 } option_t;
 
 
@@ -175,6 +187,7 @@ void append_page_setup_section(dstr_t *str, int optset, int comments);
 int build_commandline(int optset, dstr_t *cmdline, int pdfcmdline);
 
 void set_options_for_page(int optset, int page);
+int next_page_option_change(int page);
 const char *get_icc_profile_for_qualifier(const char **qualifier);
 const char **get_ppd_qualifier(void);
 
@@ -26,6 +26,8 @@
 #include "options.h"
 #include "process.h"
 #include "renderer.h"
+#include "pdfpages.h"
+#include "postscript.h"
 
 #include <stdlib.h>
 #include <ctype.h>
@@ -46,6 +48,12 @@ static int pdf_count_pages(const char *filename)
     int pagecount;
     size_t bytes;
 
+    /* Reading the page tree with QPDF is much cheaper than starting
+     * Ghostscript, use Ghostscript only for files QPDF cannot open */
+    if ((pagecount = qpdf_count_pages(filename)) >= 0)
+        return pagecount;
+    _log("Could not count the pages with QPDF, using Ghostscript\n");
+
     snprintf(gscommand, CMDLINE_MAX, "%s -dNODISPLAY -q -c "
 	     "'/pdffile (%s) (r) file def pdfdict begin pdffile pdfopen begin "
 	     "(PageCount: ) print pdfpagecount == flush currentdict pdfclose "
@@ -66,9 +74,14 @@ static int pdf_count_pages(const char *filename)
 }
 
 pid_t kid3 = 0;
+static char kid3_tmpfile[PATH_MAX] = "";  /* Extracted pages kid3 reads */
 
 
-static int start_renderer(const char *cmd)
+/* Start the renderer when the previous one has finished. The command line
+   and the input file (if 'tmpfile' is not NULL) are prepared before, while
+   the previous renderer is still running. 'tmpfile' gets removed when the
+   renderer has finished. */
+static int start_renderer(const char *cmd, const char *tmpfile)
 {
     if (kid3 != 0)
         wait_for_renderer();
@@ -78,6 +91,7 @@ static int start_renderer(const char *cmd)
     if (kid3 < 0)
         rip_die(EXIT_STARVED, "Could not start renderer\n");
 
+    strlcpy(kid3_tmpfile, tmpfile ? tmpfile : "", PATH_MAX);
     return 1;
 }
 
@@ -87,6 +101,11 @@ static int wait_for_renderer()
 
     waitpid(kid3, &status, 0);
 
+    if (!isempty(kid3_tmpfile)) {
+        unlink(kid3_tmpfile);
+        kid3_tmpfile[0] = '\0';
+    }
+
     if (!WIFEXITED(status)) {
         _log("Kid3 did not finish normally.\n");
         exit(EXIT_PRNERR_NORETRY_BAD_SETTINGS);
@@ -120,6 +139,12 @@ static int pdf_extract_pages(char filename[PATH_MAX],
         rip_die(EXIT_STARVED, "Unable to create temporary file!\n");
     close (fd);
 
+    /* Copy the pages with QPDF, Ghostscript's pdfwrite only as fallback */
+    if (qpdf_extract_pages(filename, pdffilename, first, last) > 0)
+        return 1;
+    _log("Could not extract the pages with QPDF (error or interactive "
+         "form), using Ghostscript\n");
+
     snprintf(filename_arg, PATH_MAX, "-sOutputFile=%s", filename);
 
     first_arg[0] = '\0';
@@ -131,7 +156,7 @@ static int pdf_extract_pages(char filename[PATH_MAX],
             snprintf(last_arg, 50, "-dLastPage=%d", last);
     }
 
-    snprintf(gscommand, CMDLINE_MAX, "%s -q -dNOPAUSE -dBATCH -dPARANOIDSAFER -dNOINTERPOLATE -dNOMEDIAATTRS"
+    snprintf(gscommand, CMDLINE_MAX, "%s -q -dNOPAUSE -dBATCH -dPARANOIDSAFER -dNOINTERPOLATE -dNOMEDIAATTRS "
 	     "-sDEVICE=pdfwrite -dShowAcroForm %s %s %s %s",
 	     gspath, filename_arg, first_arg, last_arg, pdffilename);
 
@@ -156,19 +181,20 @@ static int render_pages_with_generic_command(dstr_t *cmd,
      * (maybe introduce a &filename; ??) */
 
     if (lastpage < 0)  /* i.e. print the whole document */
+    {
         dstrcatf(cmd, " < %s", filename);
+        result = start_renderer(cmd->data, NULL);
+    }
     else
     {
         if (!pdf_extract_pages(tmpfile, filename, firstpage, lastpage))
-            rip_die(EXIT_STARVED, "Could not run ghostscript to extract the pages!\n");
+            rip_die(EXIT_STARVED, "Could not extract the pages!\n");
         dstrcatf(cmd, " < %s", tmpfile);
+        /* The renderer reads the file only after it is started, so it
+           gets removed in wait_for_renderer() */
+        result = start_renderer(cmd->data, tmpfile);
     }
 
-    result = start_renderer(cmd->data);
-
-    if (lastpage > 0)
-        unlink(tmpfile);
-
     return result;
 }
 
@@ -205,16 +231,26 @@ static int render_pages_with_ghostscript(dstr_t *cmd,
                         " -dFirstPage=%d ", firstpage);
     }
 
-    return start_renderer(cmd->data);
+    return start_renderer(cmd->data, NULL);
 }
 
-static int render_pages(const char *filename, int firstpage, int lastpage)
+/* Render pages 'firstpage' through 'lastpage' ('lastpage' < 0: the whole
+   document) with the options of 'optset' */
+static int render_pages(const char *filename,
+                        int optset,
+                        int firstpage,
+                        int lastpage)
 {
     dstr_t *cmd = create_dstr();
     size_t start, end;
     int result;
 
-    build_commandline(optionset("currentpage"), cmd, 1);
+    if (lastpage < 0)
+        _log("Rendering all pages\n");
+    else
+        _log("Rendering pages %d through %d\n", firstpage, lastpage);
+
+    build_commandline(optset, cmd, 1);
 
     extract_command(&start, &end, cmd->data, "gs");
     if (start == end)
@@ -236,10 +272,15 @@ static int render_pages(const char *filename, int firstpage, int lastpage)
     return result;
 }
 
+/* Render the document with one renderer per run of consecutive pages
+   with the same options */
 static int print_pdf_file(const char *filename)
 {
     int page_count, i;
     int firstpage;
+    int header = optionset("header");
+    int currentpage = optionset("currentpage");
+    int previouspage = optionset("previouspage");
 
     page_count = pdf_count_pages(filename);
 
@@ -247,23 +288,31 @@ static int print_pdf_file(const char *filename)
         rip_die(EXIT_JOBERR, "Unable to determine number of pages, page count: %d\n", page_count);
     _log("File contains %d pages\n", page_count);
 
-    optionset_copy_values(optionset("header"), optionset("currentpage"));
-    optionset_copy_values(optionset("currentpage"), optionset("previouspage"));
     firstpage = 1;
-    for (i = 1; i <= page_count; i++)
+    /* Only look at the pages where page-specific options can change */
+    for (i = 1; i > 0 && i <= page_count; i = next_page_option_change(i))
     {
-        set_options_for_page(optionset("currentpage"), i);
-        if (!optionset_equal(optionset("currentpage"), optionset("previouspage"), 1))
+        /* Options of page i are the header options plus the ones given
+           for this page, not the ones of earlier pages */
+        optionset_delete_values(currentpage);
+        optionset_copy_values(header, currentpage);
+        set_options_for_page(currentpage, i);
+
+        /* Pages firstpage to i - 1 have the options in previouspage, if
+           page i has different ones, render them now */
+        if (i > firstpage && !optionset_equal(currentpage, previouspage, 1))
         {
-            render_pages(filename, firstpage, i);
+            render_pages(filename, previouspage, firstpage, i - 1);
             firstpage = i;
         }
-        optionset_copy_values(optionset("currentpage"), optionset("previouspage"));
+
+        optionset_delete_values(previouspage);
+        optionset_copy_values(currentpage, previouspage);
     }
     if (firstpage == 1)
-        render_pages(filename, 1, -1); /* Render the whole document */
+        render_pages(filename, previouspage, 1, -1); /* Render the whole document */
     else
-        render_pages(filename, firstpage, page_count);
+        render_pages(filename, previouspage, firstpage, page_count);
 
     wait_for_renderer();
 
@@ -279,6 +328,10 @@ int print_pdf(FILE *s,
     char tmpfilename[PATH_MAX] = "";
     int result;
 
+    /* The output of a renderer kept from a PostScript document has to come
+       before the one of this document */
+    close_kept_renderer();
+
     /* If reading from stdin, write everything into a temporary file */
     /* TODO don't do this if there aren't any pagerange-limited options */
     if (s == stdin)
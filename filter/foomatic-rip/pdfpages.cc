@@ -0,0 +1,80 @@
+/* pdfpages.cc
+ *
+ * This file is part of foomatic-rip.
+ *
+ * Foomatic-rip is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Foomatic-rip is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "pdfpages.h"
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFWriter.hh>
+#include <exception>
+#include <vector>
+
+int qpdf_count_pages(const char *filename)
+{
+    try {
+        QPDF pdf;
+        pdf.setSuppressWarnings(true);
+        pdf.processFile(filename);
+        return (int)pdf.getAllPages().size();
+    } catch (std::exception &e) {
+        return -1;
+    }
+}
+
+int qpdf_extract_pages(const char *filename,
+                       const char *pdffilename,
+                       int first,
+                       int last)
+{
+    try {
+        QPDF in, out;
+        int count, i;
+
+        in.setSuppressWarnings(true);
+        in.processFile(pdffilename);
+        /* Only the pages are copied, not the catalog's /AcroForm, and
+         * field contents that rely on NeedAppearances would get lost */
+        if (in.getRoot().hasKey("/AcroForm"))
+            return -1;
+        /* The copied pages must not depend on the page tree they came
+         * from, MediaBox, Resources, ... can be inherited */
+        in.pushInheritedAttributesToPage();
+        std::vector<QPDFObjectHandle> pages = in.getAllPages();
+        count = (int)pages.size();
+
+        if (first < 1)
+            first = 1;
+        if (last < first || last > count)
+            last = count;
+        if (first > last)
+            return -1;
+
+        out.emptyPDF();
+        /* addPage() copies pages of another document including everything
+         * they reference (contents, resources, annotations) */
+        for (i = first - 1; i < last; i++)
+            out.addPage(pages[i], false);
+
+        QPDFWriter writer(out, filename);
+        writer.write();
+        return last - first + 1;
+    } catch (std::exception &e) {
+        return -1;
+    }
+}
@@ -0,0 +1,48 @@
+/* pdfpages.h
+ *
+ * This file is part of foomatic-rip.
+ *
+ * Foomatic-rip is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Foomatic-rip is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef pdfpages_h
+#define pdfpages_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Page counting and page range extraction with QPDF, without starting
+ * Ghostscript. Both return -1 if QPDF cannot handle the file. */
+
+/* Number of pages of the PDF file */
+int qpdf_count_pages(const char *filename);
+
+/* Write pages 'first' through 'last' of the PDF file 'pdffilename' into
+ * 'filename', 'last' < 'first' means up to the end of the document.
+ * Returns the number of pages written. Documents with an interactive
+ * form are left to Ghostscript (-1), which renders the fields of the
+ * selected pages with -dShowAcroForm. */
+int qpdf_extract_pages(const char *filename,
+                       const char *pdffilename,
+                       int first,
+                       int last);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
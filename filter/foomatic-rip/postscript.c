@@ -31,9 +31,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 
 void get_renderer_handle(const dstr_t *prepend, FILE **fd, pid_t *pid);
 int close_renderer_handle(FILE *rendererhandle, pid_t rendererpid);
+static int keep_renderer(FILE *rendererhandle, pid_t rendererpid);
 
 #define LT_BEGIN_FEATURE 1
 #define LT_FOOMATIC_RIP_OPTION_SETTING 2
@@ -135,39 +137,125 @@ int line_type(const char *line)
 #define MAX_NON_DSC_LINES_IN_HEADER 1000
 #define MAX_LINES_FOR_PAGE_OPTIONS 200
 
-typedef struct {
-    size_t pos;
+#define STREAM_BUFSIZE 65536
 
+/* Input is read in blocks, lines are found with memchr() and handed out as
+   pointers into the buffer (see stream_next_slice()). They only get copied
+   if they have to be examined or modified as a dstr_t. */
+typedef struct {
     FILE *file;
-    const char *alreadyread;
+
+    char *buf;              /* Data not handed out yet is buf[pos..len[ */
+    size_t pos;
     size_t len;
+    size_t alloc;
+    int eof;
 } stream_t;
 
 void _print_ps(stream_t *stream);
 
-int stream_next_line(dstr_t *line, stream_t *s)
+/* Set when the data sent to the renderer leaves Ghostscript's job
+   encapsulation with exitserver or startjob, its changes then stay for
+   the following documents, so the renderer must not be kept */
+static int renderer_left_job = 0;
+
+/* Send data to the renderer, looking for exitserver and startjob */
+static void write_renderer(const char *data, size_t len, FILE *out)
 {
-    int c;
-    size_t cnt = 0;
-
-    dstrclear(line);
-    while (s->pos < s->len) {
-        c = s->alreadyread[s->pos++];
-        dstrputc(line, c);
-        cnt++;
-        if (c == '\n')
-            return cnt;
+    static const char *ops[] = { "exitserver", "startjob", NULL };
+    static char edge[32];   /* end of the previous data, for operators
+                               split between two writes */
+    static size_t edgelen = 0;
+    size_t n, i;
+
+    if (!renderer_left_job) {
+        for (i = 0; ops[i]; i++)
+            if (memmem(data, len, ops[i], strlen(ops[i])))
+                renderer_left_job = 1;
+        n = len < 9 ? len : 9;
+        memcpy(edge + edgelen, data, n);
+        edgelen += n;
+        for (i = 0; ops[i]; i++)
+            if (memmem(edge, edgelen, ops[i], strlen(ops[i])))
+                renderer_left_job = 1;
+        if (len >= 9) {
+            memcpy(edge, data + len - 9, 9);
+            edgelen = 9;
+        } else if (edgelen > 9) {
+            memmove(edge, edge + edgelen - 9, 9);
+            edgelen = 9;
+        }
     }
+    fwrite_or_die(data, len, 1, out);
+}
+
+/* Get the next line, including its newline, as slice of the stream's
+   buffer. It is valid until the stream is read again. Returns its length,
+   0 at the end of the input. */
+static size_t stream_next_slice(stream_t *s, const char **start)
+{
+    char *nl;
+    size_t n, scanned = 0;
+
+    for (;;) {
+        nl = memchr(s->buf + s->pos + scanned, '\n', s->len - s->pos - scanned);
+        if (nl || s->eof) {
+            n = nl ? (size_t)(nl - (s->buf + s->pos)) + 1 : s->len - s->pos;
+            *start = s->buf + s->pos;
+            s->pos += n;
+            return n;
+        }
 
-    while ((c = fgetc(s->file)) != EOF) {
-        dstrputc(line, c);
-        cnt++;
-        if (c == '\n')
-            return cnt;
+        /* The line continues beyond the buffered data, move it to the
+           beginning of the buffer and read more */
+        scanned = s->len - s->pos;
+        if (s->pos > 0) {
+            memmove(s->buf, s->buf + s->pos, scanned);
+            s->pos = 0;
+            s->len = scanned;
+        }
+        if (s->len == s->alloc) {
+            s->alloc *= 2;
+            s->buf = realloc(s->buf, s->alloc);
+        }
+        n = fread(s->buf + s->len, 1, s->alloc - s->len, s->file);
+        if (n == 0)
+            s->eof = 1;
+        s->len += n;
     }
+}
+
+int stream_next_line(dstr_t *line, stream_t *s)
+{
+    const char *start;
+    size_t cnt = stream_next_slice(s, &start);
+
+    dstrassure(line, cnt + 1);
+    memcpy(line->data, start, cnt);
+    line->data[cnt] = '\0';
+    line->len = cnt;
     return cnt;
 }
 
+/* Copy the rest of the input to the renderer 'out' without looking for
+   lines */
+static void stream_copy_rest(stream_t *s, FILE *out)
+{
+    size_t n;
+
+    if (s->len > s->pos)
+        write_renderer(s->buf + s->pos, s->len - s->pos, out);
+    s->pos = s->len = 0;
+
+    while (!s->eof) {
+        n = fread(s->buf, 1, s->alloc, s->file);
+        if (n == 0)
+            s->eof = 1;
+        else
+            write_renderer(s->buf, n, out);
+    }
+}
+
 int print_ps(FILE *file, const char *alreadyread, size_t len, const char *filename)
 {
     stream_t stream;
@@ -177,11 +265,15 @@ int print_ps(FILE *file, const char *alreadyread, size_t len, const char *filena
         return 0;
     }
 
-    stream.pos = 0;
     stream.file = stdin;
-    stream.alreadyread = alreadyread;
+    stream.alloc = len > STREAM_BUFSIZE ? len : STREAM_BUFSIZE;
+    stream.buf = malloc(stream.alloc);
+    memcpy(stream.buf, alreadyread, len);
+    stream.pos = 0;
     stream.len = len;
+    stream.eof = 0;
     _print_ps(&stream);
+    free(stream.buf);
     return 1;
 }
 
@@ -325,6 +417,10 @@ void _print_ps(stream_t *stream)
     int retval;
 
     dstr_t *tmp = create_dstr();
+
+    const char *slice;      /* line in the input buffer, not copied */
+    size_t slicelen;
+
     jobhasjcl = 0;
 
     /* We do not parse the PostScript to find Foomatic options, we check
@@ -1016,24 +1112,27 @@ void _print_ps(stream_t *stream)
 
                     if (!isempty(psfifo->data)) {
                         /* Send psfifo to renderer */
-                        fwrite_or_die(psfifo->data, psfifo->len, 1, rendererhandle);
+                        write_renderer(psfifo->data, psfifo->len, rendererhandle);
                         /* flush psfifo */
                         dstrclear(psfifo);
                     }
 
                     /* Send line to renderer */
                     if (!printprevpage) {
-                        fwrite_or_die(line->data, line->len, 1, rendererhandle);
+                        write_renderer(line->data, line->len, rendererhandle);
 
-                        while (stream_next_line(line, stream) > 0) {
-                            if (startswith(line->data, "%%")) {
+                        /* Pass the lines on as they are in the input
+                           buffer, only DSC comments get copied into 'line' */
+                        while ((slicelen = stream_next_slice(stream, &slice)) > 0) {
+                            if (slicelen >= 2 && slice[0] == '%' && slice[1] == '%') {
+                                dstrncpy(line, slice, slicelen);
                                 _log("Found: %s", line->data);
                                 _log(" --> Continue DSC parsing now.\n\n");
                                 saved = 1;
                                 break;
                             }
                             else {
-                                fwrite_or_die(line->data, line->len, 1, rendererhandle);
+                                write_renderer(slice, slicelen, rendererhandle);
                                 linect++;
                             }
                         }
@@ -1125,15 +1224,13 @@ void _print_ps(stream_t *stream)
 
         if (psfifo->len) {
             /* Send psfifo to the renderer */
-            fwrite_or_die(psfifo->data, psfifo->len, 1, rendererhandle);
+            write_renderer(psfifo->data, psfifo->len, rendererhandle);
             dstrclear(psfifo);
         }
 
         /* Print the rest of the input data */
-        if (more_stuff) {
-            while (stream_next_line(tmp, stream))
-                fwrite_or_die(tmp->data, tmp->len, 1, rendererhandle);
-        }
+        if (more_stuff)
+            stream_copy_rest(stream, rendererhandle);
     }
 
     /*  At every "%%Page:..." comment we have saved the PostScript state
@@ -1144,11 +1241,13 @@ void _print_ps(stream_t *stream)
         print $rendererhandle "foomatic-saved-state restore\n";
     } */
 
-    /* Close the renderer */
+    /* Close the renderer, or keep it for the next document of the job */
     if (rendererpid) {
-        retval = close_renderer_handle(rendererhandle, rendererpid);
-        if (retval != EXIT_PRINTED)
-            rip_die(retval, "Error closing renderer\n");
+        if (!keep_renderer(rendererhandle, rendererpid)) {
+            retval = close_renderer_handle(rendererhandle, rendererpid);
+            if (retval != EXIT_PRINTED)
+                rip_die(retval, "Error closing renderer\n");
+        }
         rendererpid = 0;
     }
 
@@ -1160,6 +1259,65 @@ void _print_ps(stream_t *stream)
     free_dstr(tmp);
 }
 
+/*
+ * Renderer kept running at the end of a document. If the next document of
+ * the job needs a renderer with the same command line and options, it gets
+ * fed into this one, so that Ghostscript does not need to start again.
+ */
+static FILE *kept_rendererhandle = NULL;
+static pid_t kept_rendererpid = 0;
+static dstr_t *kept_cmdline = NULL;
+
+/* Command line of the last renderer started, and whether it is Ghostscript
+   running as job server */
+static dstr_t *renderer_cmdline = NULL;
+static int renderer_jobserver = 0;
+
+/* Keep the renderer of the current document running, returns 0 if it
+   needs to be closed instead. Only Ghostscript started as job server
+   (see get_renderer_handle()) is kept: it runs every document as a job of
+   its own, ended by ^D, and restores its state (page device, userdict,
+   halftones, ...) at the end of the job. */
+static int keep_renderer(FILE *rendererhandle, pid_t rendererpid)
+{
+    if (!renderer_jobserver)
+        return 0;
+    if (renderer_left_job) {
+        _log("Document leaves the job encapsulation, not keeping the renderer\n");
+        return 0;
+    }
+
+    /* End of the job */
+    fwrite_or_die("\004", 1, 1, rendererhandle);
+    fflush(rendererhandle);
+    kept_rendererhandle = rendererhandle;
+    kept_rendererpid = rendererpid;
+    if (!kept_cmdline)
+        kept_cmdline = create_dstr();
+    dstrcpy(kept_cmdline, renderer_cmdline->data);
+    /* Options the renderer was started with */
+    optionset_delete_values(optionset("renderer"));
+    optionset_copy_values(optionset("currentpage"), optionset("renderer"));
+
+    _log("Keeping renderer for the next document\n");
+    return 1;
+}
+
+/* Close a renderer kept after the previous document */
+void close_kept_renderer()
+{
+    int retval;
+
+    if (!kept_rendererpid)
+        return;
+
+    retval = close_renderer_handle(kept_rendererhandle, kept_rendererpid);
+    kept_rendererhandle = NULL;
+    kept_rendererpid = 0;
+    if (retval != EXIT_PRINTED)
+        rip_die(retval, "Error closing renderer\n");
+}
+
 /*
  * Run the renderer command line (and if defined also the postpipe) and returns
  * a file handle for stuffing in the PostScript data.
@@ -1169,11 +1327,43 @@ void get_renderer_handle(const dstr_t *prepend, FILE **fd, pid_t *pid)
     pid_t kid3;
     FILE *kid3in;
     dstr_t *cmdline = create_dstr();
+    size_t start, end;
 
     /* Build the command line and get the JCL commands */
     build_commandline(optionset("currentpage"), cmdline, 0);
     massage_gs_commandline(cmdline);
 
+    if (kept_rendererpid) {
+        if (!strcmp(cmdline->data, kept_cmdline->data) &&
+            optionset_equal(optionset("currentpage"), optionset("renderer"), 0)) {
+            /* Same renderer as for the previous document, use it again */
+            _log("\nUsing the renderer of the previous document\n");
+            if (prepend)
+                write_renderer(prepend->data, prepend->len, kept_rendererhandle);
+            *fd = kept_rendererhandle;
+            *pid = kept_rendererpid;
+            kept_rendererhandle = NULL;
+            kept_rendererpid = 0;
+            free_dstr(cmdline);
+            return;
+        }
+        _log("\nCommand line/options differ from the previous document\n");
+        close_kept_renderer();
+    }
+
+    if (!renderer_cmdline)
+        renderer_cmdline = create_dstr();
+    dstrcpy(renderer_cmdline, cmdline->data);
+    renderer_left_job = 0;
+
+    /* If more documents follow, let Ghostscript run as job server, so that
+       it can be kept for them without carrying over the state of this
+       document */
+    extract_command(&start, &end, cmdline->data, gspath);
+    renderer_jobserver = (moredocuments && start < end);
+    if (renderer_jobserver)
+        dstrinsert(cmdline, start + strlen(gspath), " -dJOBSERVER");
+
     _log("\nStarting renderer with command: \"%s\"\n", cmdline->data);
     kid3 = start_process("kid3", exec_kid3, (void *)cmdline->data, &kid3in, NULL);
     if (kid3 < 0)
@@ -1181,7 +1371,7 @@ void get_renderer_handle(const dstr_t *prepend, FILE **fd, pid_t *pid)
 
     /* Feed the PostScript header and the FIFO contents */
     if (prepend)
-        fwrite_or_die(prepend->data, prepend->len, 1, kid3in);
+        write_renderer(prepend->data, prepend->len, kid3in);
 
     /* We are the parent, return glob to the file handle */
     *fd = kid3in;
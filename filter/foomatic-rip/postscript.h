@@ -26,5 +26,8 @@
 
 int print_ps(FILE *s, const char *alreadyread, size_t len, const char *filename);
 
+/* Close the renderer kept running after the last PostScript document */
+void close_kept_renderer();
+
 #endif
 
@@ -45,9 +45,14 @@ MIT Open Source License  -  http://www.opensource.org/
 #include <cupsfilters/colormanager.h>
 #include <cupsfilters/raster.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <errno.h>
+#include "render-common.h"
+#include "gstoraster-pool.h"
 
 #define PDF_MAX_CHECK_COMMENT_LINES	20
 
@@ -85,7 +90,8 @@ parse_doc_type(FILE *fp)
 }
 
 static void
-parse_pdf_header_options(FILE *fp, gs_page_header *h)
+parse_pdf_header_options(FILE *fp, gs_page_header *h, int *num_pages,
+			 int **blank_pages, int *num_blank_pages)
 {
   char buf[4096];
   int i;
@@ -114,6 +120,18 @@ parse_pdf_header_options(FILE *fp, gs_page_header *h)
       } else {
         h->Collate = CUPS_FALSE;
       }
+    } else if (strncmp(buf,"%%PDFTOPDFNumPages",18) == 0) {
+      char *p;
+
+      p = strchr(buf+18,':');
+      if (p)
+	*num_pages = atoi(p+1);
+    } else if (strncmp(buf,"%%PDFTOPDFBlankPages",20) == 0) {
+      char *p;
+
+      p = strchr(buf+20,':');
+      if (p && *blank_pages == NULL)
+	*blank_pages = parse_page_list(p+1, num_blank_pages);
     }
   }
 }
@@ -375,21 +393,306 @@ add_pdf_header_options(gs_page_header *h, cups_array_t *gs_args,
 #endif /* CUPS_RASTER_SYNCv1 */
 }
 
+/* Copy the Ghostscript output from fd to stdout, inserting the blank
+   pages */
+static int
+copy_output (int fd,
+	     const int *blank_pages,
+	     int num_blank_pages,
+	     gs_page_header *h,
+	     cups_mode_t mode)
+{
+  cups_raster_t *inras;
+  cups_raster_t *outras;
+  char buf[BUFSIZ];
+  int n;
+  int ret = 0;
+
+  if (num_blank_pages == 0) {
+    while ((n = read(fd, buf, BUFSIZ)) != 0) {
+      if (n < 0) {
+	if (errno == EINTR)
+	  continue;
+	ret = -1;
+	break;
+      }
+      if (write(1, buf, n) != n) {
+	ret = -1;
+	break;
+      }
+    }
+  } else {
+    inras = cupsRasterOpen(fd, CUPS_RASTER_READ);
+    outras = cupsRasterOpen(1, mode);
+    if ((n = cupsRasterInsertBlankPages(inras, outras, blank_pages,
+					num_blank_pages,
+					(cups_page_header2_t *)h)) < 0)
+      ret = -1;
+    else
+      fprintf(stderr, "DEBUG: %d pages written, %d of them blank\n", n,
+	      num_blank_pages);
+    cupsRasterClose(inras);
+    cupsRasterClose(outras);
+  }
+  if (ret < 0)
+    fprintf(stderr, "ERROR: Can't copy Ghostscript output\n");
+  return ret;
+}
+
+/*
+ * Environment variables which Ghostscript uses, the pool starts it with
+ * the ones of the job, all others are left out to let jobs of different
+ * queues share the Ghostscript processes
+ */
+static int
+gs_pool_env_var (const char *var)
+{
+  static const char * const prefixes[] = {
+    "GS_", "CUPS_", "LC_", "LANG=", "PATH=", "HOME=", "TMPDIR=", "TEMP=",
+    "TMP=", "TZ=", NULL
+  };
+  int i;
+
+  for (i = 0; prefixes[i]; i ++)
+    if (!strncmp(var, prefixes[i], strlen(prefixes[i])))
+      return 1;
+  return 0;
+}
+
+/*
+ * Ask gstoraster-pool for a Ghostscript which is already started with
+ * this command line, the Ghostscript environment variables of envp, and
+ * our nice value and resource limits, waiting for its input. Returns the
+ * connection to the pool, with the stdin and stdout of the Ghostscript in
+ * infd and outfd, or -1 if we have to start Ghostscript by ourselves.
+ */
+static int
+gs_pool_get (char **gsargv,
+	     char **envp,
+	     int *infd,
+	     int *outfd)
+{
+  static const int limit_resources[GS_POOL_NUM_LIMITS] = GS_POOL_LIMITS;
+  const char *path;
+  struct sockaddr_un addr;
+  gs_pool_request_t req;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  char *args;
+  char reply;
+  int fds[2];
+  int errfd = 2;
+  int sock;
+  int i;
+  size_t len;
+  size_t env_len;
+
+  if ((path = getenv(GS_POOL_SOCKET_ENV)) == NULL)
+    path = GS_POOL_SOCKET;
+  if (!path[0] || strlen(path) >= sizeof(addr.sun_path) ||
+      access(path, F_OK))
+    return -1;
+
+  /* Command line without argv[0], the pool uses its own Ghostscript,
+     followed by the environment */
+  for (i = 1, len = 0; gsargv[i]; i ++)
+    len += strlen(gsargv[i]) + 1;
+  for (i = 0, env_len = 0; envp[i]; i ++)
+    if (gs_pool_env_var(envp[i]))
+      env_len += strlen(envp[i]) + 1;
+  if (len == 0 || len > GS_POOL_MAX_ARGS_LEN ||
+      env_len > GS_POOL_MAX_ENV_LEN ||
+      (args = malloc(len + env_len)) == NULL)
+    return -1;
+  for (i = 1, len = 0; gsargv[i]; i ++) {
+    strcpy(args + len, gsargv[i]);
+    len += strlen(gsargv[i]) + 1;
+  }
+  for (i = 0; envp[i]; i ++)
+    if (gs_pool_env_var(envp[i])) {
+      strcpy(args + len, envp[i]);
+      len += strlen(envp[i]) + 1;
+    }
+
+  /* Ghostscript gets our nice value and resource limits */
+  memset(&req, 0, sizeof(req));
+  errno = 0;
+  req.nice = getpriority(PRIO_PROCESS, 0);
+  if (errno) {
+    free(args);
+    return -1;
+  }
+  for (i = 0; i < GS_POOL_NUM_LIMITS; i ++)
+    if (getrlimit(limit_resources[i], &req.limits[i])) {
+      free(args);
+      return -1;
+    }
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    free(args);
+    return -1;
+  }
+  fcntl(sock, F_SETFD, fcntl(sock, F_GETFD) | FD_CLOEXEC);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+    fprintf(stderr, "DEBUG: Can't connect to gstoraster-pool at %s: %s\n",
+	    path, strerror(errno));
+    goto fail;
+  }
+
+  /* Request with our stderr for Ghostscript's messages */
+  req.magic = GS_POOL_MAGIC;
+  req.length = len - env_len;
+  req.env_length = env_len;
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int));
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &errfd, sizeof(int));
+  if (sendmsg(sock, &msg, 0) != sizeof(req) ||
+      write(sock, args, len) != (ssize_t)len)
+    goto fail;
+
+  /* Reply, with Ghostscript's stdin and stdout if there is one for us */
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &reply;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1 || reply != GS_POOL_READY)
+    goto fail;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      *infd = fds[0];
+      *outfd = fds[1];
+      free(args);
+      return sock;
+    }
+
+fail:
+  free(args);
+  close(sock);
+  return -1;
+}
+
+/*
+ * Run the job with a Ghostscript from gstoraster-pool, returns the exit
+ * status like gs_spawn()
+ */
+static int
+gs_pool_run (int sock,
+	     int infd,
+	     int outfd,
+	     FILE *fp,
+	     const int *blank_pages,
+	     int num_blank_pages,
+	     gs_page_header *h,
+	     cups_mode_t mode)
+{
+  char buf[BUFSIZ];
+  int copy_failed;
+  int feed_failed = 0;
+  int pid;
+  int n;
+  int wstatus;
+  int status = 65536;
+  size_t got;
+
+  /* Feed the job in a child process, Ghostscript renders PostScript
+     while reading it */
+  if ((pid = fork()) < 0) {
+    fprintf(stderr, "ERROR: Can't fork: %s\n", strerror(errno));
+    close(infd);
+    close(outfd);
+    return status;
+  } else if (pid == 0) {
+    close(outfd);
+    close(sock);
+    while ((n = fread(buf, 1, BUFSIZ, fp)) > 0)
+      if (write(infd, buf, n) != n) {
+	fprintf(stderr, "ERROR: Can't feed job data into Ghostscript\n");
+	_exit(1);
+      }
+    _exit(0);
+  }
+  close(infd);
+
+  copy_failed = copy_output(outfd, blank_pages, num_blank_pages, h, mode) < 0;
+  close(outfd);
+
+  while (waitpid(pid, &wstatus, 0) == -1)
+    if (errno != EINTR) {
+      wstatus = 0;
+      break;
+    }
+  if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+    feed_failed = 1;
+
+  /* Ghostscript's exit status, the pool sends it when Ghostscript has
+     finished */
+  for (got = 0; got < sizeof(wstatus); got += n)
+    if ((n = read(sock, (char *)&wstatus + got, sizeof(wstatus) - got)) <= 0) {
+      if (n < 0 && errno == EINTR) {
+	n = 0;
+	continue;
+      }
+      fprintf(stderr, "ERROR: Lost connection to gstoraster-pool\n");
+      close(sock);
+      return status;
+    }
+  close(sock);
+
+  if (WIFEXITED(wstatus))
+    status = WEXITSTATUS(wstatus);
+  else if (WIFSIGNALED(wstatus))
+    status = 256 * WTERMSIG(wstatus);
+  if (status == 0 && (copy_failed || feed_failed))
+    status = 1;
+  return status;
+}
+
 static int
 gs_spawn (const char *filename,
           cups_array_t *gs_args,
           char **envp,
-          FILE *fp)
+          FILE *fp,
+          const int *blank_pages,
+          int num_blank_pages,
+          gs_page_header *h,
+          cups_mode_t mode)
 {
   char *argument;
   char buf[BUFSIZ];
   char **gsargv;
   const char* apos;
   int fds[2];
+  int outfds[2];
+  int copy_failed = 0;
   int i;
   int n;
   int numargs;
   int pid;
+  int pool;
   int status = 65536;
   int wstatus;
 
@@ -417,6 +720,15 @@ gs_spawn (const char *filename,
   for (i = 0; envp[i]; i ++)
     fprintf(stderr, "DEBUG: envp[%d]=\"%s\"\n", i, envp[i]);
 
+  /* Take a Ghostscript which gstoraster-pool has started ahead with the
+     same command line and environment, if there is one */
+  if ((pool = gs_pool_get(gsargv, envp, &fds[1], &outfds[0])) >= 0) {
+    fprintf(stderr, "DEBUG: Using a Ghostscript started by gstoraster-pool\n");
+    status = gs_pool_run(pool, fds[1], outfds[0], fp, blank_pages,
+			 num_blank_pages, h, mode);
+    goto out;
+  }
+
   /* Create a pipe for feeding the job into Ghostscript */
   if (pipe(fds))
   {
@@ -444,8 +756,27 @@ gs_spawn (const char *filename,
     goto out;
   }
 
+  /* Create a pipe for the Ghostscript output, we insert the blank pages */
+  if (num_blank_pages > 0 && pipe(outfds))
+  {
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "ERROR: Unable to establish pipe for Ghostscript output\n");
+    goto out;
+  }
+
   if ((pid = fork()) == 0)
   {
+    /* Couple pipe with STDOUT of Ghostscript process */
+    if (num_blank_pages > 0) {
+      if (dup2(outfds[1], 1) < 0) {
+	fprintf(stderr, "ERROR: Unable to couple pipe with STDOUT of Ghostscript process\n");
+	goto out;
+      }
+      close(outfds[0]);
+      close(outfds[1]);
+    }
+
     /* Couple pipe with STDIN of Ghostscript process */
     if (fds[0] != 0) {
       close(0);
@@ -483,6 +814,15 @@ retry_write:
   }
   close (fds[1]);
 
+  /* Copy the output, inserting the blank pages. Ghostscript reads a PDF
+     file completely before rendering it, so it has all job data now. */
+  if (num_blank_pages > 0) {
+    close(outfds[1]);
+    if (copy_output(outfds[0], blank_pages, num_blank_pages, h, mode) < 0)
+      copy_failed = 1;
+    close(outfds[0]);
+  }
+
 retry_wait:
   if (waitpid (pid, &wstatus, 0) == -1) {
     if (errno == EINTR)
@@ -498,12 +838,241 @@ retry_wait:
   else if (WIFSIGNALED(wstatus))
     /* Via signal */
     status = 256 * WTERMSIG(wstatus);
+  if (status == 0 && copy_failed)
+    status = 1;
 
 out:
   free(gsargv);
   return status;
 }
 
+/* One of the Ghostscript processes rendering a part of the pages */
+typedef struct gs_part_s {
+  int first_page;
+  int last_page;
+  int pid;		/* -1 when finished or not started */
+  int fd;		/* Output, -1 if nothing to render */
+  int is_file;		/* Output goes into a temporary file, only the
+			   first part is read while being rendered */
+  int status;
+  cups_raster_t *ras;
+} gs_part_t;
+
+typedef struct gs_parts_s {
+  gs_part_t *parts;
+  int num_parts;
+  int current;		/* Part being copied to the output */
+} gs_parts_t;
+
+/* cups_raster_next_cb_t for cupsRasterMergePages(): output of the next
+   part, waiting for its Ghostscript to finish if it goes to a file */
+static cups_raster_t *
+next_part (void *ctx)
+{
+  gs_parts_t *p = (gs_parts_t *)ctx;
+  gs_part_t *part;
+
+  if (p->current >= 0) {
+    part = &p->parts[p->current];
+    cupsRasterClose(part->ras);
+    part->ras = NULL;
+    close(part->fd);
+    part->fd = -1;
+    if (part->pid > 0) {
+      part->status = wait_status(part->pid, "gs");
+      part->pid = -1;
+    }
+  }
+
+  while (++ p->current < p->num_parts) {
+    part = &p->parts[p->current];
+    if (part->fd < 0)
+      continue;
+    if (part->is_file) {
+      if (part->pid > 0) {
+	part->status = wait_status(part->pid, "gs");
+	part->pid = -1;
+      }
+      if (lseek(part->fd, 0, SEEK_SET) < 0) {
+	fprintf(stderr, "ERROR: Can't rewind temporary file\n");
+	part->status = 1;
+	continue;
+      }
+    }
+    part->ras = cupsRasterOpen(part->fd, CUPS_RASTER_READ);
+    return part->ras;
+  }
+  return NULL;
+}
+
+/*
+ * Render the pages with several Ghostscript processes in parallel, each
+ * one a contiguous part of the pages, and merge their output in order.
+ * gs_args is the command line for rendering the whole file with
+ * Ghostscript reading from stdin, the processes read the file itself.
+ */
+static int
+gs_spawn_parallel (const char *filename,
+		   cups_array_t *gs_args,
+		   char **envp,
+		   const char *input,
+		   int num_pages,
+		   int num_processes,
+		   const int *blank_pages,
+		   int num_blank_pages,
+		   gs_page_header *h,
+		   cups_mode_t mode)
+{
+  char *argument;
+  char **args;
+  char **gsargv;
+  char buf[BUFSIZ];
+  char tmpname[1024];
+  char pagesel[2][BUFSIZ];
+  gs_parts_t p;
+  gs_part_t *part;
+  cups_raster_t *outras;
+  int fds[2];
+  int i;
+  int j;
+  int k;
+  int n;
+  int numargs;
+  int status = 0;
+
+  numargs = cupsArrayCount(gs_args);
+  args = calloc(numargs + 1, sizeof(char *));
+  gsargv = calloc(numargs + 3, sizeof(char *));
+  for (argument = (char *)cupsArrayFirst(gs_args), i = 0; argument;
+       argument = (char *)cupsArrayNext(gs_args), i++)
+    args[i] = argument;
+
+  p.parts = calloc(num_processes, sizeof(gs_part_t));
+  p.num_parts = num_processes;
+  p.current = -1;
+
+  fprintf(stderr, "DEBUG: Rendering %d pages with %d Ghostscript processes\n",
+	  num_pages, num_processes);
+  for (k = 0; k < num_processes; k ++) {
+    part = &p.parts[k];
+    render_part_pages(k, num_processes, num_pages, h->Duplex,
+		      &part->first_page, &part->last_page);
+    part->pid = -1;
+    part->fd = -1;
+
+    /* Ghostscript's PageList overrides FirstPage and LastPage, so with
+       blank pages we only give the non-blank ones of our part */
+    if (num_blank_pages > 0) {
+      if ((n = non_blank_page_list(part->first_page, part->last_page,
+				   blank_pages, num_blank_pages,
+				   buf, sizeof(buf))) <= 0) {
+	if (n < 0)
+	  status = 1;
+	continue;
+      }
+      snprintf(pagesel[0], sizeof(pagesel[0]), "-sPageList=%s", buf);
+      pagesel[1][0] = '\0';
+    } else {
+      snprintf(pagesel[0], sizeof(pagesel[0]), "-dFirstPage=%d",
+	       part->first_page);
+      snprintf(pagesel[1], sizeof(pagesel[1]), "-dLastPage=%d",
+	       part->last_page);
+    }
+
+    /* Command line with the page selection after argv[0], and the input
+       file instead of "-_" */
+    gsargv[0] = args[0];
+    for (i = 0, j = 1; i < 2; i ++)
+      if (pagesel[i][0])
+	gsargv[j ++] = pagesel[i];
+    for (i = 1; i < numargs; i ++)
+      gsargv[j ++] = (strcmp(args[i], "-_") ? args[i] : (char *)input);
+    gsargv[j] = NULL;
+
+    /* The first part is copied to the output while being rendered, the
+       others wait in temporary files */
+    for (i = 0; i < k && p.parts[i].fd < 0; i ++);
+    if (i == k) {
+      if (pipe(fds)) {
+	fprintf(stderr, "ERROR: Unable to establish pipe for Ghostscript output\n");
+	status = 1;
+	break;
+      }
+    } else {
+      if ((fds[0] = cupsTempFd(tmpname, sizeof(tmpname))) < 0) {
+	fprintf(stderr, "ERROR: Can't create temporary file\n");
+	status = 1;
+	break;
+      }
+      unlink(tmpname);
+      fds[1] = fds[0];
+      part->is_file = 1;
+    }
+
+    if ((part->pid = fork()) == 0) {
+      if (dup2(fds[1], 1) < 0) {
+	fprintf(stderr, "ERROR: Unable to couple output with STDOUT of Ghostscript process\n");
+	exit(1);
+      }
+      if (fds[0] != fds[1])
+	close(fds[0]);
+      close(fds[1]);
+      for (i = 0; i < k; i ++)
+	if (p.parts[i].fd >= 0)
+	  close(p.parts[i].fd);
+      execvpe(filename, gsargv, envp);
+      fprintf(stderr, "ERROR: Unable to launch Ghostscript: %s: %s\n",
+	      filename, strerror(errno));
+      exit(1);
+    }
+    if (fds[0] != fds[1])
+      close(fds[1]);
+    if (part->pid < 0) {
+      fprintf(stderr, "ERROR: Can't fork: %s\n", strerror(errno));
+      close(fds[0]);
+      status = 1;
+      break;
+    }
+    part->fd = fds[0];
+    fprintf(stderr, "DEBUG: Ghostscript (PID %d) renders pages %d-%d: %s\n",
+	    part->pid, part->first_page, part->last_page, pagesel[0]);
+  }
+
+  /* Merge the outputs, inserting the blank pages */
+  if (status == 0) {
+    outras = cupsRasterOpen(1, mode);
+    if ((n = cupsRasterMergePages(next_part, &p, outras, blank_pages,
+				  num_blank_pages,
+				  (cups_page_header2_t *)h)) < 0) {
+      fprintf(stderr, "ERROR: Can't copy Ghostscript output\n");
+      status = 1;
+    } else
+      fprintf(stderr, "DEBUG: %d pages written\n", n);
+    cupsRasterClose(outras);
+  }
+
+  /* Clean up after errors, get the exit status of all processes */
+  for (k = 0; k < num_processes; k ++) {
+    part = &p.parts[k];
+    if (part->ras)
+      cupsRasterClose(part->ras);
+    if (part->fd >= 0)
+      close(part->fd);
+    if (part->pid > 0) {
+      if (status != 0)
+	kill(part->pid, SIGTERM);
+      part->status = wait_status(part->pid, "gs");
+    }
+    if (status == 0)
+      status = part->status;
+  }
+
+  free(p.parts);
+  free(args);
+  free(gsargv);
+  return status;
+}
+
 #if 0
 static char *
 get_ppd_icc_fallback (ppd_file_t *ppd, char **qualifier)
@@ -581,6 +1150,21 @@ out:
 }
 #endif
 
+/* Copy of stdin, its name is only kept while the parallel Ghostscript
+   processes need it */
+static char tempfile[1024] = "";
+
+/* SIGTERM handler, so that cancelled jobs do not leave the copy of stdin
+   in TMPDIR */
+static void
+remove_tempfile (int sig)
+{
+  if (tempfile[0])
+    unlink(tempfile);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
 int
 main (int argc, char **argv, char *envp[])
 {
@@ -601,6 +1185,10 @@ main (int argc, char **argv, char *envp[])
   int cm_disabled;
   int n;
   int num_options;
+  int num_pages = 0;
+  int *blank_pages = NULL;
+  int num_blank_pages = 0;
+  int num_processes = 1;
   int status = 1;
   ppd_file_t *ppd = NULL;
   struct sigaction sa;
@@ -658,13 +1246,20 @@ main (int argc, char **argv, char *envp[])
   if (argc == 6) {
     /* stdin */
 
-    fd = cupsTempFd(buf,BUFSIZ);
+    fd = cupsTempFd(tempfile,sizeof(tempfile));
     if (fd < 0) {
+      tempfile[0] = '\0';
       fprintf(stderr, "ERROR: Can't create temporary file\n");
       goto out;
     }
-    /* remove name */
-    unlink(buf);
+    if (cupsGetOption("gstoraster-processes", num_options, options) == NULL) {
+      /* only rendering in parallel needs the file name */
+      unlink(tempfile);
+      tempfile[0] = '\0';
+    } else {
+      sa.sa_handler = remove_tempfile;
+      sigaction(SIGTERM, &sa, NULL);
+    }
 
     /* copy stdin to the tmp file */
     while ((n = read(0,buf,BUFSIZ)) > 0) {
@@ -838,16 +1433,62 @@ main (int argc, char **argv, char *envp[])
 
   /* set PDF-specific options */
   if (doc_type == GS_DOC_TYPE_PDF) {
-    parse_pdf_header_options(fp, &h);
+    parse_pdf_header_options(fp, &h, &num_pages, &blank_pages,
+			     &num_blank_pages);
   }
 
   /* fixed other values that pdftopdf handles */
   h.MirrorPrint = CUPS_FALSE;
   h.Orientation = CUPS_ORIENT_0;
 
+  /* blank pages can only be left out if we know the paper color */
+  if (num_blank_pages > 0 && !cupsRasterBlankPageSupported(&h)) {
+    fprintf(stderr, "DEBUG: No paper color for color space %d, rendering "
+	    "the blank pages\n", h.cupsColorSpace);
+    num_blank_pages = 0;
+  }
+
+  /* in a duplex job the renderer counts the pages to tell front and back
+     sides, leaving out a single blank page would turn the sheets over */
+  if (num_blank_pages > 0 && h.Duplex) {
+    n = duplex_blank_pages(blank_pages, num_blank_pages, num_pages);
+    if (n < num_blank_pages)
+      fprintf(stderr, "DEBUG: Rendering %d blank pages to keep the sides of "
+	      "the duplex sheets\n", num_blank_pages - n);
+    num_blank_pages = n;
+  }
+
   /* get all the data from the header and pass it to ghostscript */
   add_pdf_header_options (&h, gs_args, outformat, pxlcolor);
 
+  /* Render parts of the pages with several Ghostscript processes in
+     parallel? We need to know the number of pages for that. */
+  if (outformat == OUTPUT_FORMAT_RASTER && num_pages > 0)
+    num_processes =
+      num_render_processes(cupsGetOption("gstoraster-processes",
+					 num_options, options),
+			   num_pages,
+			   (long long)h.cupsBytesPerLine * h.cupsHeight);
+  if (num_processes == 1 && tempfile[0]) {
+    unlink(tempfile);
+    tempfile[0] = '\0';
+  }
+
+  /* Let Ghostscript render only the pages with content, pdftopdf told us
+     which ones are blank (e.g. filler pages for duplex); these go into
+     the raster stream without rendering */
+  if (num_blank_pages > 0 && num_processes == 1) {
+    if (outformat == OUTPUT_FORMAT_RASTER && num_pages > 0 &&
+	(n = non_blank_page_list(1, num_pages, blank_pages, num_blank_pages,
+				 buf, sizeof(buf))) > 0) {
+      fprintf(stderr, "DEBUG: Not rendering %d blank pages\n",
+	      num_pages - n);
+      snprintf(tmpstr, sizeof(tmpstr), "-sPageList=%s", buf);
+      cupsArrayAdd(gs_args, strdup(tmpstr));
+    } else
+      num_blank_pages = 0;
+  }
+
   /* CUPS font path */
   if ((t = getenv("CUPS_FONTPATH")) == NULL)
     t = CUPS_FONTPATH;
@@ -911,11 +1552,28 @@ main (int argc, char **argv, char *envp[])
 
   /* call Ghostscript */
   rewind(fp);
-  status = gs_spawn (tmpstr, gs_args, envp, fp);
+  if (num_processes > 1)
+    status = gs_spawn_parallel (tmpstr, gs_args, envp,
+				argc == 7 ? argv[6] : tempfile, num_pages,
+				num_processes, blank_pages, num_blank_pages,
+				&h,
+#ifdef HAVE_CUPS_1_7
+				pwgraster ? CUPS_RASTER_WRITE_PWG :
+#endif /* HAVE_CUPS_1_7 */
+				CUPS_RASTER_WRITE_COMPRESSED);
+  else
+    status = gs_spawn (tmpstr, gs_args, envp, fp, blank_pages,
+		       num_blank_pages, &h,
+#ifdef HAVE_CUPS_1_7
+		       pwgraster ? CUPS_RASTER_WRITE_PWG :
+#endif /* HAVE_CUPS_1_7 */
+		       CUPS_RASTER_WRITE_COMPRESSED);
   if (status != 0) status = 1;
 out:
   if (fp)
     fclose(fp);
+  if (tempfile[0])
+    unlink(tempfile);
   if (gs_args) {
     while ((tmp = cupsArrayFirst(gs_args)) != NULL) {
       cupsArrayRemove(gs_args,tmp);
@@ -924,6 +1582,7 @@ out:
     cupsArrayDelete(gs_args);
   }
   free(icc_profile);
+  free(blank_pages);
   if (ppd)
     ppdClose(ppd);
   return status;
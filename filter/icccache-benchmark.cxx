@@ -0,0 +1,228 @@
+/*
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+/*
+ icccache-benchmark.cxx
+ time to set up pdftoraster's color transform without, before and with
+ the transform cache
+
+ Usage: icccache-benchmark [-n runs] [printer.icc [source.icc]]
+
+ Without profiles sRGB is converted to a synthetic table based CMYK
+ printer profile, like the ones shipped with printer drivers.
+*/
+
+#include "icccache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef USE_LCMS1
+
+int main()
+{
+  fprintf(stderr,"lcms 1.x: no transform cache\n");
+  return 77;
+}
+
+#else
+
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* simple Lab -> CMYK separation with gray component replacement */
+static cmsInt32Number labToCmyk(const cmsUInt16Number in[],
+  cmsUInt16Number out[], void *cargo)
+{
+  cmsCIELab lab;
+  double r, g, b, c, m, y, k;
+
+  (void)cargo;
+  cmsLabEncoded2Float(&lab,in);
+  r = lab.L / 100.0 + lab.a / 300.0 + lab.b / 600.0;
+  g = lab.L / 100.0 - lab.a / 400.0 + lab.b / 500.0;
+  b = lab.L / 100.0 - lab.b / 250.0;
+  c = 1.0 - (r < 0 ? 0 : r > 1 ? 1 : r);
+  m = 1.0 - (g < 0 ? 0 : g > 1 ? 1 : g);
+  y = 1.0 - (b < 0 ? 0 : b > 1 ? 1 : b);
+  k = c < m ? (c < y ? c : y) : (m < y ? m : y);
+  k *= 0.8;
+  out[0] = (cmsUInt16Number)((c - k) * 65535.0 + 0.5);
+  out[1] = (cmsUInt16Number)((m - k) * 65535.0 + 0.5);
+  out[2] = (cmsUInt16Number)((y - k) * 65535.0 + 0.5);
+  out[3] = (cmsUInt16Number)(k * 65535.0 + 0.5);
+  return TRUE;
+}
+
+static cmsHPROFILE cmykProfile()
+{
+  cmsHPROFILE profile, ret;
+  cmsPipeline *lut;
+  cmsStage *clut;
+  cmsUInt32Number size;
+  void *data;
+
+  profile = cmsCreateProfilePlaceholder(NULL);
+  cmsSetProfileVersion(profile,2.1);
+  cmsSetDeviceClass(profile,cmsSigOutputClass);
+  cmsSetColorSpace(profile,cmsSigCmykData);
+  cmsSetPCS(profile,cmsSigLabData);
+  lut = cmsPipelineAlloc(NULL,3,4);
+  clut = cmsStageAllocCLut16bit(NULL,33,3,4,NULL);
+  cmsStageSampleCLut16bit(clut,labToCmyk,NULL,0);
+  cmsPipelineInsertStage(lut,cmsAT_BEGIN,clut);
+  cmsWriteTag(profile,cmsSigBToA0Tag,lut);
+  cmsPipelineFree(lut);
+
+  /* as if read from a file */
+  cmsSaveProfileToMem(profile,NULL,&size);
+  data = malloc(size);
+  cmsSaveProfileToMem(profile,data,&size);
+  cmsCloseProfile(profile);
+  ret = cmsOpenProfileFromMem(data,size);
+  free(data);
+  return ret;
+}
+
+/* convert a grid of RGB values, for comparing transforms */
+static unsigned char *convert(cmsHTRANSFORM transform, int channels)
+{
+  static const int steps = 64;
+  unsigned char *in = (unsigned char *)malloc(steps * steps * steps * 3);
+  unsigned char *out = (unsigned char *)malloc(steps * steps * steps *
+					       channels);
+  int i;
+
+  for (i = 0;i < steps * steps * steps;i++) {
+    in[i * 3] = (i % steps) * 255 / (steps - 1);
+    in[i * 3 + 1] = (i / steps % steps) * 255 / (steps - 1);
+    in[i * 3 + 2] = (i / steps / steps) * 255 / (steps - 1);
+  }
+  cmsDoTransform(transform,in,out,steps * steps * steps);
+  free(in);
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  int runs = 20, i, channels;
+  cmsHPROFILE source, printer;
+  cmsHTRANSFORM transform;
+  unsigned int inFormat, outFormat;
+  char cachedir[] = "/tmp/icccache-benchmark.XXXXXX";
+  char cmd[1100];
+  double t, direct = 0, miss = 0, hit = 0;
+  unsigned char *first, *later;
+  int same;
+
+  if (argc > 2 && strcmp(argv[1],"-n") == 0) {
+    runs = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if (runs < 1) {
+    fprintf(stderr,"Usage: icccache-benchmark [-n runs] [printer.icc [source.icc]]\n");
+    return 1;
+  }
+  printer = (argc > 1) ? cmsOpenProfileFromFile(argv[1],"r") : cmykProfile();
+  source = (argc > 2) ? cmsOpenProfileFromFile(argv[2],"r") :
+    cmsCreate_sRGBProfile();
+  if (printer == NULL || source == NULL) {
+    fprintf(stderr,"Cannot open the profiles\n");
+    return 1;
+  }
+  channels = cmsChannelsOf(cmsGetColorSpace(printer));
+  inFormat = COLORSPACE_SH(PT_RGB) | CHANNELS_SH(3) | BYTES_SH(1);
+  outFormat = COLORSPACE_SH(_cmsLCMScolorSpace(cmsGetColorSpace(printer))) |
+    CHANNELS_SH(channels) | BYTES_SH(1);
+
+  if (mkdtemp(cachedir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  setenv("CUPS_CACHEDIR",cachedir,1);
+  snprintf(cmd,sizeof(cmd),"rm -rf %s/icc-transforms",cachedir);
+
+  for (i = 0;i < runs;i++) {
+    t = now();
+    transform = cmsCreateTransform(source,inFormat,printer,outFormat,
+				   INTENT_PERCEPTUAL,0);
+    direct += now() - t;
+    cmsDeleteTransform(transform);
+
+    if (system(cmd) != 0)
+      return 1;
+    t = now();
+    transform = iccCreateCachedTransform(source,inFormat,printer,outFormat,
+					 INTENT_PERCEPTUAL,0);
+    miss += now() - t;
+    cmsDeleteTransform(transform);
+  }
+
+  /* the cache is filled now */
+  for (i = 0;i < runs;i++) {
+    t = now();
+    transform = iccCreateCachedTransform(source,inFormat,printer,outFormat,
+					 INTENT_PERCEPTUAL,0);
+    hit += now() - t;
+    cmsDeleteTransform(transform);
+  }
+
+  /* the first job must get the same transform as the later ones */
+  if (system(cmd) != 0)
+    return 1;
+  transform = iccCreateCachedTransform(source,inFormat,printer,outFormat,
+				       INTENT_PERCEPTUAL,0);
+  first = convert(transform,channels);
+  cmsDeleteTransform(transform);
+  transform = iccCreateCachedTransform(source,inFormat,printer,outFormat,
+				       INTENT_PERCEPTUAL,0);
+  later = convert(transform,channels);
+  cmsDeleteTransform(transform);
+  same = (memcmp(first,later,64 * 64 * 64 * channels) == 0);
+  free(first);
+  free(later);
+
+  printf("transform setup, average of %d runs:\n",runs);
+  printf("  without cache:   %8.3f ms\n",direct / runs);
+  printf("  cache miss:      %8.3f ms\n",miss / runs);
+  printf("  cache hit:       %8.3f ms\n",hit / runs);
+  if (hit < direct)
+    printf("the cache pays off after %.1f hits per miss\n",
+	   (miss - direct) / (direct - hit));
+  else
+    printf("the cache does not pay off\n");
+  printf("first and later jobs: %s\n",same ? "identical" : "DIFFERENT");
+
+  snprintf(cmd,sizeof(cmd),"rm -rf %s",cachedir);
+  if (system(cmd) != 0)
+    return 1;
+  return same ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,279 @@
+/*
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+/*
+ icccache.cxx
+ cache of color transforms (as device link profiles) across jobs
+*/
+
+#include "icccache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define ICCCACHE_MAX_ENTRIES 64	/* least recently used ones are removed */
+
+#ifdef USE_LCMS1
+
+/* lcms 1.x cannot compute profile IDs, no caching */
+cmsHTRANSFORM iccCreateCachedTransform(cmsHPROFILE input,
+  unsigned int inputFormat, cmsHPROFILE output,
+  unsigned int outputFormat, int intent,
+  unsigned int flags)
+{
+  return cmsCreateTransform(input,inputFormat,output,outputFormat,intent,
+			    flags);
+}
+
+#else
+
+/*
+ * Get the MD5 of the profile as hex string, computing it if the
+ * profile does not carry it in its header
+ */
+static bool getProfileID(cmsHPROFILE profile, char *hex)
+{
+  cmsUInt8Number id[16];
+  int i;
+
+  cmsGetHeaderProfileID(profile,id);
+  for (i = 0;i < 16 && id[i] == 0;i++);
+  if (i == 16) {
+    if (!cmsMD5computeID(profile))
+      return false;
+    cmsGetHeaderProfileID(profile,id);
+  }
+  for (i = 0;i < 16;i++)
+    sprintf(hex + 2 * i,"%02x",id[i]);
+  return true;
+}
+
+/*
+ * Build the transform from a serialized device link profile, the same
+ * way for a freshly computed link and for one from the cache
+ */
+static cmsHTRANSFORM linkTransform(const void *data, size_t size,
+  unsigned int inputFormat, unsigned int outputFormat,
+  int intent, unsigned int flags)
+{
+  cmsHPROFILE link;
+  cmsHTRANSFORM transform = NULL;
+
+  if ((link = cmsOpenProfileFromMem(data,size)) == NULL)
+    return NULL;
+  if (cmsGetDeviceClass(link) == cmsSigLinkClass)
+    transform = cmsCreateTransform(link,inputFormat,NULL,outputFormat,
+				   intent,flags);
+  cmsCloseProfile(link);
+  return transform;
+}
+
+static cmsHTRANSFORM loadTransform(const char *path,
+  unsigned int inputFormat, unsigned int outputFormat,
+  int intent, unsigned int flags)
+{
+  int fd;
+  struct stat st;
+  void *data;
+  cmsHTRANSFORM transform;
+
+  if ((fd = open(path,O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd,&st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+  data = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+  transform = linkTransform(data,st.st_size,inputFormat,outputFormat,intent,
+			    flags);
+  munmap(data,st.st_size);
+  return transform;
+}
+
+struct cacheEntry {
+  time_t mtime;
+  char name[128];
+};
+
+static int entryCmp(const void *a, const void *b)
+{
+  const time_t ta = ((const cacheEntry *)a)->mtime,
+    tb = ((const cacheEntry *)b)->mtime;
+  return (ta < tb) ? -1 : (ta > tb);
+}
+
+/*
+ * Keep the ICCCACHE_MAX_ENTRIES most recently used device links, a hit
+ * updates the modification time of its file
+ */
+static void pruneCache(const char *dir)
+{
+  DIR *d;
+  struct dirent *de;
+  struct stat st;
+  cacheEntry *entries = NULL, *tmp;
+  int num = 0, alloc = 0, i;
+  size_t len;
+  char path[1024];
+
+  if ((d = opendir(dir)) == NULL)
+    return;
+  while ((de = readdir(d)) != NULL) {
+    len = strlen(de->d_name);
+    if (len < 4 || len >= sizeof(entries->name) ||
+	strcmp(de->d_name + len - 4,".icc") != 0)
+      continue;
+    snprintf(path,sizeof(path),"%s/%s",dir,de->d_name);
+    if (stat(path,&st) != 0)
+      continue;
+    if (num == alloc) {
+      alloc += ICCCACHE_MAX_ENTRIES;
+      if ((tmp = (cacheEntry *)realloc(entries,alloc * sizeof(*entries))) ==
+	  NULL)
+	break;
+      entries = tmp;
+    }
+    entries[num].mtime = st.st_mtime;
+    strcpy(entries[num].name,de->d_name);
+    num++;
+  }
+  closedir(d);
+
+  if (num > ICCCACHE_MAX_ENTRIES) {
+    qsort(entries,num,sizeof(*entries),entryCmp);
+    for (i = 0;i < num - ICCCACHE_MAX_ENTRIES;i++) {
+      snprintf(path,sizeof(path),"%s/%s",dir,entries[i].name);
+      unlink(path);
+    }
+  }
+  free(entries);
+}
+
+static void saveLink(const void *data, size_t size, const char *dir,
+  const char *path)
+{
+  char tmp[1024];
+  int fd;
+  bool ok;
+
+  mkdir(dir,0770);
+  snprintf(tmp,sizeof(tmp),"%s/.tmpXXXXXX",dir);
+  if ((fd = mkstemp(tmp)) < 0)
+    return;
+  ok = (write(fd,data,size) == (ssize_t)size);
+  /* rename() so that other jobs never see a partially written file */
+  if (close(fd) != 0 || !ok || rename(tmp,path) != 0) {
+    unlink(tmp);
+  } else {
+    fprintf(stderr,"DEBUG: Saved color transform to %s\n",path);
+    pruneCache(dir);
+  }
+}
+
+/*
+ * Serialize the transform as device link profile, returns a malloc()ed
+ * buffer or NULL
+ */
+static void *makeLink(cmsHTRANSFORM transform, cmsUInt32Number *size)
+{
+  cmsHPROFILE link;
+  void *data = NULL;
+
+  if ((link = cmsTransform2DeviceLink(transform,4.3,0)) == NULL)
+    return NULL;
+  if (cmsSaveProfileToMem(link,NULL,size) && *size > 0 &&
+      (data = malloc(*size)) != NULL &&
+      !cmsSaveProfileToMem(link,data,size)) {
+    free(data);
+    data = NULL;
+  }
+  cmsCloseProfile(link);
+  return data;
+}
+
+cmsHTRANSFORM iccCreateCachedTransform(cmsHPROFILE input,
+  unsigned int inputFormat, cmsHPROFILE output,
+  unsigned int outputFormat, int intent,
+  unsigned int flags)
+{
+  const char *cachedir;
+  char dir[1024], path[1024];
+  char inputID[33], outputID[33];
+  cmsHTRANSFORM transform;
+  void *data;
+  cmsUInt32Number size;
+
+  /*
+   * Matrix-shaper pairs are quickly set up and optimized to exact
+   * matrix-shaper math, a device link would turn them into a lookup
+   * table
+   */
+  if ((cachedir = getenv("CUPS_CACHEDIR")) == NULL ||
+      (cmsIsMatrixShaper(input) && cmsIsMatrixShaper(output)) ||
+      !getProfileID(input,inputID) || !getProfileID(output,outputID))
+    return cmsCreateTransform(input,inputFormat,output,outputFormat,intent,
+			      flags);
+
+  snprintf(dir,sizeof(dir),"%s/icc-transforms",cachedir);
+  snprintf(path,sizeof(path),"%s/%s-%s-%x-%x-%x-%x-%d.icc",dir,
+	   inputID,outputID,(unsigned)inputFormat,(unsigned)outputFormat,
+	   (unsigned)intent,(unsigned)flags,LCMS_VERSION);
+  if ((transform = loadTransform(path,inputFormat,outputFormat,intent,
+				 flags)) != NULL) {
+    fprintf(stderr,"DEBUG: Using cached color transform %s\n",path);
+    utime(path,NULL); /* recently used, see pruneCache() */
+    return transform;
+  }
+
+  if ((transform = cmsCreateTransform(input,inputFormat,output,outputFormat,
+				      intent,flags)) == NULL)
+    return NULL;
+
+  /*
+   * Also this job uses the transform built from the serialized device
+   * link, so that the output does not depend on whether the cache was
+   * already filled
+   */
+  if ((data = makeLink(transform,&size)) != NULL) {
+    cmsHTRANSFORM linked = linkTransform(data,size,inputFormat,outputFormat,
+					 intent,flags);
+    if (linked != NULL) {
+      saveLink(data,size,dir,path);
+      cmsDeleteTransform(transform);
+      transform = linked;
+    }
+    free(data);
+  }
+  return transform;
+}
+
+#endif
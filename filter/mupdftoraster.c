@@ -40,6 +40,7 @@ MIT Open Source License  -  http://www.opensource.org/
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <fcntl.h>
 #include <cups/raster.h>
 #include <cupsfilters/colormanager.h>
@@ -49,6 +50,7 @@ MIT Open Source License  -  http://www.opensource.org/
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include "render-common.h"
 
 #define PDF_MAX_CHECK_COMMENT_LINES	20
 
@@ -83,7 +85,8 @@ parse_doc_type(FILE *fp)
 }
 
 static void
-parse_pdf_header_options(FILE *fp, mupdf_page_header *h)
+parse_pdf_header_options(FILE *fp, mupdf_page_header *h, int *num_pages,
+			 int **blank_pages, int *num_blank_pages)
 {
   char buf[4096];
   int i;
@@ -112,6 +115,18 @@ parse_pdf_header_options(FILE *fp, mupdf_page_header *h)
       } else {
         h->Collate = CUPS_FALSE;
       }
+    } else if (strncmp(buf,"%%PDFTOPDFNumPages",18) == 0) {
+      char *p;
+
+      p = strchr(buf+18,':');
+      if (p)
+	*num_pages = atoi(p+1);
+    } else if (strncmp(buf,"%%PDFTOPDFBlankPages",20) == 0) {
+      char *p;
+
+      p = strchr(buf+20,':');
+      if (p && *blank_pages == NULL)
+	*blank_pages = parse_page_list(p+1, num_blank_pages);
     }
   }
 }
@@ -168,12 +183,17 @@ mutool_spawn (const char *filename,
 	      char **envp,
 	      FILE *fp,
 	      int ipfiledes,
-	      int opfiledes)
+	      int opfiledes,
+	      const int *blank_pages,
+	      int num_blank_pages,
+	      mupdf_page_header *h)
 {
   char *argument;
   char buf[BUFSIZ];
   char **mutoolargv;
   const char* apos;
+  cups_raster_t *inras;
+  cups_raster_t *outras;
   int i;
   int n;
   int numargs;
@@ -236,18 +256,225 @@ mutool_spawn (const char *filename,
     /* Via signal */
     status = 256 * WTERMSIG(wstatus);
 
-  /* write the output to stdout */
-  tempfp = fdopen(opfiledes, "rb");
-  while ((n = fread(buf, 1, BUFSIZ, tempfp)) > 0)
-    fwrite(buf, 1, BUFSIZ, stdout);
-  
-  fclose(tempfp);
+  /* write the output to stdout, inserting the blank pages */
+  if (num_blank_pages > 0) {
+    inras = cupsRasterOpen(opfiledes, CUPS_RASTER_READ);
+    outras = cupsRasterOpen(1, CUPS_RASTER_WRITE_PWG);
+    if ((n = cupsRasterInsertBlankPages(inras, outras, blank_pages,
+					num_blank_pages,
+					(cups_page_header2_t *)h)) < 0) {
+      fprintf(stderr, "ERROR: Can't copy Mutool output\n");
+      if (status == 0)
+	status = 1;
+    } else
+      fprintf(stderr, "DEBUG: %d pages written, %d of them blank\n", n,
+	      num_blank_pages);
+    cupsRasterClose(inras);
+    cupsRasterClose(outras);
+    close(opfiledes);
+  } else {
+    tempfp = fdopen(opfiledes, "rb");
+    while ((n = fread(buf, 1, BUFSIZ, tempfp)) > 0)
+      fwrite(buf, 1, n, stdout);
+
+    fclose(tempfp);
+  }
 
  out:
   free(mutoolargv);
   return status;
 }
 
+/* One of the Mutool processes rendering a part of the pages */
+typedef struct mutool_part_s {
+  int first_page;
+  int last_page;
+  int pid;		/* -1 when finished or not started */
+  int fd;		/* Output file, -1 if nothing to render */
+  char outfile[20];
+  int status;
+  cups_raster_t *ras;
+} mutool_part_t;
+
+typedef struct mutool_parts_s {
+  mutool_part_t *parts;
+  int num_parts;
+  int current;		/* Part being copied to the output */
+} mutool_parts_t;
+
+/* cups_raster_next_cb_t for cupsRasterMergePages(): output of the next
+   part, when its Mutool has finished */
+static cups_raster_t *
+next_part (void *ctx)
+{
+  mutool_parts_t *p = (mutool_parts_t *)ctx;
+  mutool_part_t *part;
+
+  if (p->current >= 0) {
+    part = &p->parts[p->current];
+    cupsRasterClose(part->ras);
+    part->ras = NULL;
+  }
+
+  while (++ p->current < p->num_parts) {
+    part = &p->parts[p->current];
+    if (part->fd < 0)
+      continue;
+    if (part->pid > 0) {
+      part->status = wait_status(part->pid, "mutool");
+      part->pid = -1;
+    }
+    /* Mutool has written the file by its name, reopen it to be sure to
+       read what it wrote */
+    close(part->fd);
+    if ((part->fd = open(part->outfile, O_RDONLY)) < 0) {
+      fprintf(stderr, "ERROR: Can't open Mutool output %s\n", part->outfile);
+      part->status = 1;
+      continue;
+    }
+    part->ras = cupsRasterOpen(part->fd, CUPS_RASTER_READ);
+    return part->ras;
+  }
+  return NULL;
+}
+
+/*
+ * Render the pages with several Mutool processes in parallel, each one a
+ * contiguous part of the pages into its own output file, and merge their
+ * output in order. mupdf_args is the command line for rendering all
+ * pages of the input file into outfile.
+ */
+static int
+mutool_spawn_parallel (const char *filename,
+		       cups_array_t *mupdf_args,
+		       char **envp,
+		       FILE *fp,
+		       int ipfiledes,
+		       const char *outfile,
+		       int num_pages,
+		       int num_processes,
+		       const int *blank_pages,
+		       int num_blank_pages,
+		       mupdf_page_header *h)
+{
+  char *argument;
+  char **args;
+  char **mutoolargv;
+  char buf[BUFSIZ];
+  char outopt[32];
+  char partopt[32];
+  mutool_parts_t p;
+  mutool_part_t *part;
+  cups_raster_t *outras;
+  FILE *tempfp;
+  int i;
+  int j;
+  int k;
+  int n;
+  int numargs;
+  int status = 0;
+
+  /* save the contents for the file to a temporary location */
+  tempfp = fdopen(ipfiledes, "wb");
+  while ((n = fread(buf, 1, BUFSIZ, fp)) > 0)
+    fwrite(buf, 1, n, tempfp);
+  fclose(tempfp);
+
+  numargs = cupsArrayCount(mupdf_args);
+  args = calloc(numargs + 1, sizeof(char *));
+  mutoolargv = calloc(numargs + 2, sizeof(char *));
+  for (argument = (char *)cupsArrayFirst(mupdf_args), i = 0; argument;
+       argument = (char *)cupsArrayNext(mupdf_args), i++)
+    args[i] = argument;
+  snprintf(outopt, sizeof(outopt), "-o%s", outfile);
+
+  p.parts = calloc(num_processes, sizeof(mutool_part_t));
+  p.num_parts = num_processes;
+  p.current = -1;
+
+  fprintf(stderr, "DEBUG: Rendering %d pages with %d Mutool processes\n",
+	  num_pages, num_processes);
+  for (k = 0; k < num_processes; k ++) {
+    part = &p.parts[k];
+    render_part_pages(k, num_processes, num_pages, h->Duplex,
+		      &part->first_page, &part->last_page);
+    part->pid = -1;
+    part->fd = -1;
+
+    if ((n = non_blank_page_list(part->first_page, part->last_page,
+				 blank_pages, num_blank_pages,
+				 buf, sizeof(buf))) <= 0) {
+      if (n < 0)
+	status = 1;
+      continue;
+    }
+
+    strncpy(part->outfile, CUPS_OPTEMPFILE, sizeof(part->outfile));
+    if ((part->fd = mkstemp(part->outfile)) < 0) {
+      fprintf(stderr, "ERROR: Can't create temporary file\n");
+      status = 1;
+      break;
+    }
+    snprintf(partopt, sizeof(partopt), "-o%s", part->outfile);
+
+    /* Command line with our output file and our pages after the input
+       file */
+    for (i = 0, j = 0; i < numargs; i ++)
+      mutoolargv[j ++] = (strcmp(args[i], outopt) ? args[i] : partopt);
+    mutoolargv[j ++] = buf;
+    mutoolargv[j] = NULL;
+
+    if ((part->pid = fork()) == 0) {
+      execvpe(filename, mutoolargv, envp);
+      perror(filename);
+      exit(1);
+    }
+    if (part->pid < 0) {
+      fprintf(stderr, "ERROR: Can't fork: %s\n", strerror(errno));
+      status = 1;
+      break;
+    }
+    fprintf(stderr, "DEBUG: Mutool (PID %d) renders pages %s\n",
+	    part->pid, buf);
+  }
+
+  /* Merge the outputs, inserting the blank pages */
+  if (status == 0) {
+    outras = cupsRasterOpen(1, CUPS_RASTER_WRITE_PWG);
+    if ((n = cupsRasterMergePages(next_part, &p, outras, blank_pages,
+				  num_blank_pages,
+				  (cups_page_header2_t *)h)) < 0) {
+      fprintf(stderr, "ERROR: Can't copy Mutool output\n");
+      status = 1;
+    } else
+      fprintf(stderr, "DEBUG: %d pages written\n", n);
+    cupsRasterClose(outras);
+  }
+
+  /* Clean up after errors, get the exit status of all processes */
+  for (k = 0; k < num_processes; k ++) {
+    part = &p.parts[k];
+    if (part->ras)
+      cupsRasterClose(part->ras);
+    if (part->pid > 0) {
+      if (status != 0)
+	kill(part->pid, SIGTERM);
+      part->status = wait_status(part->pid, "mutool");
+    }
+    if (part->fd >= 0) {
+      close(part->fd);
+      unlink(part->outfile);
+    }
+    if (status == 0)
+      status = part->status;
+  }
+
+  free(p.parts);
+  free(args);
+  free(mutoolargv);
+  return status;
+}
+
 int
 main (int argc, char **argv, char *envp[])
 {
@@ -267,6 +494,10 @@ main (int argc, char **argv, char *envp[])
   int cm_disabled;
   int n;
   int num_options;
+  int num_pages = 0;
+  int *blank_pages = NULL;
+  int num_blank_pages = 0;
+  int num_processes = 1;
   int status = 1;
   ppd_file_t *ppd = NULL;
   struct sigaction sa;
@@ -425,24 +656,71 @@ main (int argc, char **argv, char *envp[])
   }
 
   /* set PDF-specific options */
-  parse_pdf_header_options(fp, &h);
+  parse_pdf_header_options(fp, &h, &num_pages, &blank_pages,
+			   &num_blank_pages);
 
   /* fixed other values that pdftopdf handles */
   h.MirrorPrint = CUPS_FALSE;
   h.Orientation = CUPS_ORIENT_0;
 
+  /* blank pages can only be left out if we know the paper color */
+  if (num_blank_pages > 0 && !cupsRasterBlankPageSupported(&h)) {
+    fprintf(stderr, "DEBUG: No paper color for color space %d, rendering "
+	    "the blank pages\n", h.cupsColorSpace);
+    num_blank_pages = 0;
+  }
+
+  /* in a duplex job the renderer counts the pages to tell front and back
+     sides, leaving out a single blank page would turn the sheets over */
+  if (num_blank_pages > 0 && h.Duplex) {
+    n = duplex_blank_pages(blank_pages, num_blank_pages, num_pages);
+    if (n < num_blank_pages)
+      fprintf(stderr, "DEBUG: Rendering %d blank pages to keep the sides of "
+	      "the duplex sheets\n", num_blank_pages - n);
+    num_blank_pages = n;
+  }
+
   /* get all the data from the header and pass it to Mutool */
   add_pdf_header_options (&h, mupdf_args);
 
   snprintf(tmpstr, sizeof(tmpstr), "%s", ipfilebuf);
   cupsArrayAdd(mupdf_args, strdup(tmpstr));
 
+  /* Render parts of the pages with several Mutool processes in parallel?
+     We need to know the number of pages for that. */
+  if (num_pages > 0)
+    num_processes =
+      num_render_processes(cupsGetOption("mupdftoraster-processes",
+					 num_options, options),
+			   num_pages,
+			   (long long)h.cupsBytesPerLine * h.cupsHeight);
+
+  /* Let Mutool render only the pages with content, pdftopdf told us
+     which ones are blank (e.g. filler pages for duplex); these go into
+     the raster stream without rendering */
+  if (num_blank_pages > 0 && num_processes == 1) {
+    if (num_pages > 0 &&
+	(n = non_blank_page_list(1, num_pages, blank_pages, num_blank_pages,
+				 buf, sizeof(buf))) > 0) {
+      fprintf(stderr, "DEBUG: Not rendering %d blank pages\n",
+	      num_pages - n);
+      cupsArrayAdd(mupdf_args, strdup(buf));
+    } else
+      num_blank_pages = 0;
+  }
+
   /* Execute Mutool command line ... */
   snprintf(tmpstr, sizeof(tmpstr), "%s", CUPS_MUTOOL);
 		
   /* call mutool */
   rewind(fp);
-  status = mutool_spawn (tmpstr, mupdf_args, envp, fp, ipfiledes, opfiledes);
+  if (num_processes > 1)
+    status = mutool_spawn_parallel (tmpstr, mupdf_args, envp, fp, ipfiledes,
+				    opfilebuf, num_pages, num_processes,
+				    blank_pages, num_blank_pages, &h);
+  else
+    status = mutool_spawn (tmpstr, mupdf_args, envp, fp, ipfiledes,
+			   opfiledes, blank_pages, num_blank_pages, &h);
   if (status != 0) status = 1;
 out:
   if (fp)
@@ -451,6 +729,7 @@ out:
     cupsArrayDelete(mupdf_args);
 
   free(icc_profile);
+  free(blank_pages);
   if (ppd)
     ppdClose(ppd);
   unlink(ipfilebuf);
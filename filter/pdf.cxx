@@ -32,10 +32,9 @@
 extern "C" {
 #include <embed.h>
 #include <sfnt.h>
+#include "fontcache.h"
 }
 
-#include <fontconfig/fontconfig.h>
-
 /*
  * Useful reference:
  *
@@ -1171,81 +1170,6 @@ static void fill_font_stream(const char *buf, int len, void *context)
     s->append(buf, len);
 }
 
-/*
- * Use libfontconfig to pick up suitable font.
- * Memory should be freed.
- * XXX: doesn't work correctly. Need to do some revise.
- */
-static char *get_font_libfontconfig(const char *font) {
-    FcPattern *pattern = NULL;
-    FcFontSet *candidates = NULL;
-    FcChar8* found_font = NULL;
-    FcResult result;
-
-    FcInit ();
-    pattern = FcNameParse ((const FcChar8 *)font);
-
-    /* guide fc, in case substitution becomes necessary */
-    FcPatternAddInteger (pattern, FC_SPACING, FC_MONO);
-    FcConfigSubstitute (0, pattern, FcMatchPattern);
-    FcDefaultSubstitute (pattern);
-
-    /* Receive a sorted list of fonts matching our pattern */
-    candidates = FcFontSort (0, pattern, FcFalse, 0, &result);
-    FcPatternDestroy (pattern);
-
-    /* In the list of fonts returned by FcFontSort()
-       find the first one that is both in TrueType format and monospaced */
-    for (int i = 0; i < candidates->nfont; i++) {
-
-        /* TODO? or just try? */
-        FcChar8 *fontformat=NULL;
-
-        /* sane default, as FC_MONO == 100 */
-        int spacing=0;
-        FcPatternGetString(
-                candidates->fonts[i],
-                FC_FONTFORMAT,
-                0,
-                &fontformat);
-
-        FcPatternGetInteger(
-                candidates->fonts[i],
-                FC_SPACING,
-                0,
-                &spacing);
-
-        if ( (fontformat) && (spacing == FC_MONO) ) {
-            if (strcmp((const char *)fontformat, "TrueType") == 0) {
-                found_font = FcPatternFormat (
-                        candidates->fonts[i],
-                        (const FcChar8 *)"%{file|cescape}/%{index}");
-
-                /* Don't take into consideration remain candidates */
-                break;
-            } else if (strcmp((const char *)fontformat, "CFF") == 0) {
-
-                /* TTC only possible with non-cff glyphs! */
-                found_font = FcPatternFormat (
-                        candidates->fonts[i],
-                        (const FcChar8 *)"%{file|cescape}");
-
-                /* Don't take into consideration remain candidates */
-                break;
-            }
-        }
-    }
-
-    FcFontSetDestroy (candidates);
-
-    if ( ! found_font ) {
-        fprintf(stderr,"No viable font found\n");
-        return NULL;
-    }
-
-    return (char *)found_font;
-}
-
 /*
  * Load font file using fontembed file.
  * Test for requirements.
@@ -1303,9 +1227,14 @@ static EMB_PARAMS *get_font(const char *font)
         emb = load_font(fontname);
     }
 
-    /* Use libfontconfig. */
+    /* Use libfontconfig, or the result of an earlier job. */
     if ( ! emb ) {
-        fontname = get_font_libfontconfig(font);
+        free(fontname);
+        fontname = fontcache_resolve(font);
+        if ( ! fontname ) {
+            fprintf(stderr, "No viable font found\n");
+            return NULL;
+        }
         emb = load_font(fontname);
     }
 
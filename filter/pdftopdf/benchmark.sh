@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Run pdftopdf on the sample PDF files with common option sets and report
+# the wall clock time and peak memory of each processing phase, as
+# reported by pdftopdf when PDFTOPDF_PERF is set.
+#
+# Usage: benchmark.sh [<pdftopdf binary> [<directory with PDF files> [<runs>]]]
+#
+# Output: one line per file, option set, and phase:
+#   <file> <option set> <phase> <average wall time (ms)> <peak RSS (kB)>
+
+PDFTOPDF="${1:-./pdftopdf}"
+DATADIR="${2:-data}"
+RUNS="${3:-3}"
+
+if [ ! -x "$PDFTOPDF" ]; then
+    echo "pdftopdf binary $PDFTOPDF not found" >&2
+    exit 1
+fi
+
+TMPDIR="${TMPDIR:-/tmp}"
+LOG="$TMPDIR/pdftopdf-bench.$$.log"
+trap 'rm -f "$LOG"' 0 1 2 15
+
+# <name>:<copies>:<options>
+OPTIONSETS="
+plain:1:
+nup-4:1:number-up=4
+nup-2-border:1:number-up=2 page-border=single
+booklet:1:booklet=on
+copies-collated:5:Collate=true
+page-ranges:1:page-ranges=1-2,4
+"
+
+unset PPD
+export PDFTOPDF_PERF=1
+
+printf "%-24s %-16s %-12s %12s %12s\n" file options phase wall_ms maxrss_kb
+
+for file in "$DATADIR"/*.pdf; do
+    echo "$OPTIONSETS" | while IFS=: read name copies options; do
+	[ -z "$name" ] && continue
+	: > "$LOG"
+	run=0
+	while [ $run -lt "$RUNS" ]; do
+	    if ! "$PDFTOPDF" 1 bench bench "$copies" "$options" "$file" \
+		 2>>"$LOG" >/dev/null; then
+		echo "pdftopdf failed on $file ($name)" >&2
+	    fi
+	    run=`expr $run + 1`
+	done
+	grep '^DEBUG: PERF pdftopdf ' "$LOG" | \
+	    awk -v file="`basename "$file"`" -v name="$name" '
+		{
+		    for (i = 4; i <= NF; i ++) {
+			split($i, kv, "=");
+			val[kv[1]] = kv[2];
+		    }
+		    ph = val["phase"];
+		    if (!(ph in count))
+			order[n ++] = ph;
+		    count[ph] ++;
+		    wall[ph] += val["wall_ms"];
+		    if (val["maxrss_kb"] > rss[ph])
+			rss[ph] = val["maxrss_kb"];
+		}
+		END {
+		    for (i = 0; i < n; i ++) {
+			ph = order[i];
+			printf "%-24s %-16s %-12s %12.3f %12d\n", file, name,
+			       ph, wall[ph] / count[ph], rss[ph];
+		    }
+		}'
+    done
+done
@@ -24,6 +24,7 @@
 
 #include "pdftopdf_processor.h"
 #include "pdftopdf_jcl.h"
+#include "pdftopdf_perf.h"
 
 #include <stdarg.h>
 static void error(const char *fmt,...) // {{{
@@ -174,6 +175,36 @@ static bool ppdDefaultOrder(ppd_file_t *ppd) // {{{  -- is reverse?
 }
 // }}}
 
+// printing resolution in dpi (smaller value, if x and y differ)
+static int getResolution(ppd_file_t *ppd,int num_options,cups_option_t *options) // {{{
+{
+  const char *val=NULL;
+  ppd_choice_t *choice;
+  ppd_attr_t *attr;
+
+  if ((choice=ppdFindMarkedChoice(ppd,"Resolution")) != NULL) {
+    val=choice->choice;
+  } else if ((attr=ppdFindAttr(ppd,"DefaultResolution",NULL)) != NULL) {
+    val=attr->value;
+  } else if ((val=cupsGetOption("printer-resolution",num_options,options)) == NULL) {
+    val=cupsGetOption("Resolution",num_options,options);
+  }
+
+  int xres=0,yres=0;
+  if ((val)&&(sscanf(val,"%dx%d",&xres,&yres)>0)&&(xres>0)) {
+    if ((yres>0)&&(yres<xres)) {
+      xres=yres;
+    }
+    if (strcasestr(val,"dpc")) {
+      xres=xres*254/100;
+    }
+    return xres;
+  }
+  fprintf(stderr,"DEBUG: pdftopdf: No printing resolution found, assuming 300 dpi.\n");
+  return 300;
+}
+// }}}
+
 static bool optGetCollate(int num_options,cups_option_t *options) // {{{
 {
   if (is_true(cupsGetOption("Collate",num_options,options))) {
@@ -586,6 +617,41 @@ bool checkFeature(const char *feature, int num_options, cups_option_t *options)
     param.evenDuplex=is_true(attr->value);
   }
 
+  // compact output (object streams, xref stream) only makes sense when
+  // the printer itself parses our output and supports PDF 1.5
+  if ((val=cupsGetOption("pdf-object-streams",num_options,options)) != NULL) {
+    param.objectStreams=is_true(val);
+  } else if ((attr=ppdFindAttr(ppd,"cupsPDFObjectStreams",0)) != NULL) {
+    param.objectStreams=is_true(attr->value);
+  }
+
+  // merged documents often carry the same logo, font, ... on every page
+  if ((val=cupsGetOption("pdf-deduplicate-resources",num_options,options)) != NULL) {
+    param.dedupResources=is_true(val);
+  } else if ((attr=ppdFindAttr(ppd,"cupsPDFDeduplicateResources",0)) != NULL) {
+    param.dedupResources=is_true(attr->value);
+  }
+
+  // images with much higher resolution than the printer's are only a
+  // burden for the printer's PDF interpreter. Do not touch them if other
+  // filters follow, they may need the full resolution
+  bool downsample=false;
+  if ((val=cupsGetOption("pdf-downsample-images",num_options,options)) != NULL) {
+    downsample=is_true(val);
+  } else if ((attr=ppdFindAttr(ppd,"cupsPDFDownsampleImages",0)) != NULL) {
+    downsample=is_true(attr->value);
+  }
+  if (downsample) {
+    const char *final_content_type=getenv("FINAL_CONTENT_TYPE");
+    if ((final_content_type)&&
+	(strcasecmp(final_content_type,"application/pdf")==0)) {
+      param.downsampleDPI=getResolution(ppd,num_options,options);
+    } else {
+      fprintf(stderr,
+	      "DEBUG: pdftopdf: Not sending PDF directly to the printer, not downsampling images.\n");
+    }
+  }
+
   // TODO? pdftopdf* ?
   // TODO?! pdftopdfAutoRotate
 
@@ -1022,6 +1088,7 @@ int main(int argc,char **argv)
   }
 
   try {
+    PerfPhase perf("total");
     ProcessingParameters param;
 
     param.jobId=atoi(argv[1]);
@@ -1073,6 +1140,7 @@ int main(int argc,char **argv)
        the form, meaning that we integrate the filled in data into the
        pages themselves instead of holding them in an extra layer */
     if (proc->hasAcroForm()) {
+      PerfPhase perf("flatten");
       /* Prepare the input file for being read by the form flattening
 	 process */
       FILE *infile = NULL;
@@ -1182,6 +1250,7 @@ int main(int argc,char **argv)
 
     emitPreamble(ppd,param); // ppdEmit, JCL stuff
     emitComment(*proc,param); // pass information to subsequent filters via PDF comments
+    proc->setObjectStreams(param.objectStreams);
 
     //proc->emitFile(stdout);
     proc->emitFilename(NULL);
@@ -197,6 +197,23 @@ void emitComment(PDFTOPDF_Processor &proc,const ProcessingParameters &param) //
     }
   }
 
+  // the rasterizing filters need not render these
+  std::vector<int> blank=proc.blankPages();
+  if (!blank.empty()) {
+    std::string list;
+    for (size_t iA=0;iA<blank.size();iA++) {
+      char buf[20];
+      snprintf(buf,sizeof(buf),"%s%d",(iA)?",":"",blank[iA]);
+      list.append(buf);
+    }
+    if (list.size()<1000) { // keep the line short for the readers
+      char buf[20];
+      snprintf(buf,sizeof(buf),"%d",proc.numPages());
+      output.push_back(std::string("%%PDFTOPDFNumPages : ")+buf);
+      output.push_back("%%PDFTOPDFBlankPages : "+list);
+    }
+  }
+
   proc.setComments(output);
 }
 // }}}
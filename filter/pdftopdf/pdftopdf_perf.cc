@@ -0,0 +1,53 @@
+#include "pdftopdf_perf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+static double now_ms() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+// }}}
+
+bool PerfPhase::enabled() // {{{
+{
+  static int enabled=-1;
+  if (enabled<0) {
+    const char *val=getenv("PDFTOPDF_PERF");
+    enabled=(val)&&(*val)&&(strcmp(val,"0")!=0);
+  }
+  return enabled;
+}
+// }}}
+
+PerfPhase::PerfPhase(const char *name) // {{{
+  : name(name),
+    start(0)
+{
+  if (enabled()) {
+    start=now_ms();
+  }
+}
+// }}}
+
+PerfPhase::~PerfPhase() // {{{
+{
+  if (!enabled()) {
+    return;
+  }
+  const double wall=now_ms()-start;
+
+  struct rusage usage;
+  long maxrss=-1;
+  if (getrusage(RUSAGE_SELF,&usage)==0) {
+    maxrss=usage.ru_maxrss; // kB on Linux
+  }
+  fprintf(stderr,"DEBUG: PERF pdftopdf phase=%s wall_ms=%.3f maxrss_kb=%ld\n",
+          name,wall,maxrss);
+}
+// }}}
@@ -0,0 +1,23 @@
+#ifndef PDFTOPDF_PERF_H
+#define PDFTOPDF_PERF_H
+
+// Timing and memory instrumentation, enabled by setting the environment
+// variable PDFTOPDF_PERF (to anything but "0").
+// Each phase is reported on destruction of the PerfPhase object as
+//   DEBUG: PERF pdftopdf phase=<name> wall_ms=<ms> maxrss_kb=<kB>
+// where maxrss_kb is the peak resident set size of the process so far.
+class PerfPhase {
+ public:
+  PerfPhase(const char *name);
+  ~PerfPhase();
+
+  static bool enabled();
+ private:
+  PerfPhase(const PerfPhase &);
+  PerfPhase &operator=(const PerfPhase &);
+
+  const char *name;
+  double start; // ms
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "pdftopdf_processor.h"
 #include "qpdf_pdftopdf_processor.h"
+#include "pdftopdf_perf.h"
 #include <stdio.h>
 #include <assert.h>
 #include <numeric>
@@ -99,6 +100,12 @@ void ProcessingParameters::dump() const // {{{
 	  (deviceCollate)?"true":"false");
   fprintf(stderr,"setDuplex: %s\n",
 	  (setDuplex)?"true":"false");
+  fprintf(stderr,"objectStreams: %s\n",
+	  (objectStreams)?"true":"false");
+  fprintf(stderr,"downsampleDPI: %d\n",
+	  downsampleDPI);
+  fprintf(stderr,"dedupResources: %s\n",
+	  (dedupResources)?"true":"false");
 }
 // }}}
 
@@ -156,6 +163,8 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
     proc.autoRotateAll(dst_lscape,param.normal_landscape);
   }
 
+  std::unique_ptr<PerfPhase> perf(new PerfPhase("placement"));
+
   std::vector<std::shared_ptr<PDFTOPDF_PageHandle>> pages=proc.get_pages();
   const int numOrigPages=pages.size();
 
@@ -354,8 +363,20 @@ bool processPDFTOPDF(PDFTOPDF_Processor &proc,ProcessingParameters &param) // {{
       fprintf(stderr, "PAGE: %d %d\n", outputno + 1, param.copies_to_be_logged);
   }
 
+  perf.reset();
+
+  // only now the placements include the N-up and fit-to-page scaling;
+  // the copies of multiply() share the images
+  if (param.downsampleDPI>0) {
+    proc.downsampleImages(param.downsampleDPI);
+  }
+
   proc.multiply(param.numCopies,param.collate);
 
+  if (param.dedupResources) {
+    proc.deduplicateResources();
+  }
+
   return true;
 }
 // }}}
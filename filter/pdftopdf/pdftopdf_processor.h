@@ -37,6 +37,10 @@ ProcessingParameters()
     emitJCL(true),deviceCopies(1),
     deviceCollate(false),setDuplex(false),
 
+    objectStreams(false),
+    downsampleDPI(0),
+    dedupResources(false),
+
     page_logging(-1)
 
   {
@@ -87,6 +91,13 @@ ProcessingParameters()
   bool setDuplex;
   // unsetMirror  (always)
 
+  // output: object streams, xref stream, compress all streams (needs PDF 1.5)
+  bool objectStreams;
+  // downsample images to this resolution (0: off), only for PDF printers
+  int downsampleDPI;
+  // merge identical images, fonts, color spaces
+  bool dedupResources;
+
   int page_logging;
   int copies_to_be_logged;
 
@@ -137,8 +148,13 @@ class PDFTOPDF_Processor { // abstract interface
 
   virtual void autoRotateAll(bool dst_lscape,Rotation normal_landscape) =0; // TODO elsewhere?!
   virtual void addCM(const char *defaulticc,const char *outputicc) =0;
+  virtual void downsampleImages(int dpi) =0; // on the output pages, before multiply()
+  virtual void deduplicateResources() =0; // on the output pages
+  virtual int numPages() =0; // of the output
+  virtual std::vector<int> blankPages() =0; // output pages without any content, 1 based
 
   virtual void setComments(const std::vector<std::string> &comments) =0;
+  virtual void setObjectStreams(bool enable) =0; // must be called before emitFile()
 
   virtual void emitFile(FILE *dst,ArgOwnership take=WillStayAlive) =0;
   virtual void emitFilename(const char *name) =0; // NULL -> stdout
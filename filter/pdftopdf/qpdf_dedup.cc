@@ -0,0 +1,203 @@
+#include "qpdf_dedup.h"
+#include <map>
+#include <set>
+#include <string>
+#include <qpdf/MD5.hh>
+#include <qpdf/QUtil.hh>
+#include "qpdf_tools.h"
+
+// Objects are compared via a "key" string, which describes the object
+// recursively: direct values are unparsed, indirect objects are replaced
+// by their own key, streams are represented by their dictionary and
+// a checksum of the raw (still encoded) data.
+// Reference cycles and overly deep structures get unique keys,
+// i.e. they are never merged.
+
+typedef std::pair<int,int> objid_t; // object number, generation
+
+static objid_t getObjId(QPDFObjectHandle obj) // {{{
+{
+  return objid_t(obj.getObjectID(),obj.getGeneration());
+}
+// }}}
+
+class ResourceDedup {
+public:
+  ResourceDedup() : replaced(0) {}
+
+  void processResources(QPDFObjectHandle resources,int depth=0);
+
+  int replaced;
+private:
+  std::string getKey(QPDFObjectHandle obj,int depth);
+  std::string getDirectKey(QPDFObjectHandle obj,int depth);
+  std::string getDictKey(QPDFObjectHandle dict,bool is_stream,int depth);
+
+  QPDFObjectHandle canonical(QPDFObjectHandle obj);
+  bool replaceIndirect(QPDFObjectHandle &val);
+private:
+  std::map<objid_t,std::string> keys;
+  std::map<std::string,QPDFObjectHandle> canon;
+  std::set<objid_t> forms; // already processed form xobjects
+};
+
+static const int max_depth=32;
+
+static std::string uniqueKey(QPDFObjectHandle obj) // {{{
+{
+  return "R"+QUtil::int_to_string(obj.getObjectID())+"_"+QUtil::int_to_string(obj.getGeneration());
+}
+// }}}
+
+std::string ResourceDedup::getKey(QPDFObjectHandle obj,int depth) // {{{
+{
+  if (!obj.isIndirect()) {
+    return getDirectKey(obj,depth);
+  }
+
+  const objid_t id=getObjId(obj);
+  std::map<objid_t,std::string>::const_iterator it=keys.find(id);
+  if (it!=keys.end()) {
+    return it->second;
+  }
+  if (depth>max_depth) {
+    return uniqueKey(obj);
+  }
+
+  keys[id]=uniqueKey(obj); // placeholder, breaks cycles
+  std::string ret;
+  if (obj.isStream()) {
+    PointerHolder<Buffer> data=obj.getRawStreamData();
+    ret="S"+getDictKey(obj.getDict(),true,depth+1)+
+      "#"+QUtil::int_to_string(data->getSize())+
+      "#"+MD5::getDataChecksum((char *)data->getBuffer(),data->getSize());
+  } else {
+    ret="O"+getDirectKey(obj,depth+1);
+  }
+  keys[id]=ret;
+  return ret;
+}
+// }}}
+
+std::string ResourceDedup::getDirectKey(QPDFObjectHandle obj,int depth) // {{{
+{
+  if (obj.isArray()) {
+    std::string ret="[";
+    const int len=obj.getArrayNItems();
+    for (int iA=0;iA<len;iA++) {
+      ret.append(getKey(obj.getArrayItem(iA),depth));
+      ret.push_back(' ');
+    }
+    ret.push_back(']');
+    return ret;
+  } else if (obj.isDictionary()) {
+    return getDictKey(obj,false,depth);
+  }
+  return obj.unparse();
+}
+// }}}
+
+std::string ResourceDedup::getDictKey(QPDFObjectHandle dict,bool is_stream,int depth) // {{{
+{
+  std::string ret="<<";
+  const std::set<std::string> dkeys=dict.getKeys(); // sorted
+  for (std::set<std::string>::const_iterator it=dkeys.begin();it!=dkeys.end();++it) {
+    if ((is_stream)&&(*it=="/Length")) { // might be indirect
+      continue;
+    }
+    ret.append(*it);
+    ret.push_back(' ');
+    ret.append(getKey(dict.getKey(*it),depth));
+    ret.push_back(' ');
+  }
+  ret.append(">>");
+  return ret;
+}
+// }}}
+
+QPDFObjectHandle ResourceDedup::canonical(QPDFObjectHandle obj) // {{{
+{
+  const std::string key=getKey(obj,0);
+  std::map<std::string,QPDFObjectHandle>::const_iterator it=canon.find(key);
+  if (it!=canon.end()) {
+    return it->second;
+  }
+  canon[key]=obj;
+  return obj;
+}
+// }}}
+
+// returns true, if val was replaced
+bool ResourceDedup::replaceIndirect(QPDFObjectHandle &val) // {{{
+{
+  if (!val.isIndirect()) {
+    return false;
+  }
+  QPDFObjectHandle repl=canonical(val);
+  if (getObjId(repl)==getObjId(val)) {
+    return false;
+  }
+  val=repl;
+  replaced++;
+  return true;
+}
+// }}}
+
+void ResourceDedup::processResources(QPDFObjectHandle resources,int depth) // {{{
+{
+  static const char *categories[]={"/XObject","/Font","/ColorSpace",NULL};
+
+  if ((!resources.isDictionary())||(depth>max_depth)) {
+    return;
+  }
+  for (const char **cat=categories;*cat;cat++) {
+    QPDFObjectHandle dict=resources.getKey(*cat);
+    if (!dict.isDictionary()) {
+      continue;
+    }
+    const std::set<std::string> names=dict.getKeys();
+    for (std::set<std::string>::const_iterator it=names.begin();it!=names.end();++it) {
+      QPDFObjectHandle val=dict.getKey(*it);
+
+      if ((val.isStream())&&(val.getDict().getKey("/Subtype").isName())&&
+          (val.getDict().getKey("/Subtype").getName()=="/Form")) {
+        // forms (e.g. our n-up subpages) are kept, but their resources checked
+        if ((val.isIndirect())&&(forms.insert(getObjId(val)).second)) {
+          processResources(val.getDict().getKey("/Resources"),depth+1);
+        }
+        continue;
+      }
+
+      if ((val.isArray())&&(!val.isIndirect())) { // e.g. [/ICCBased 5 0 R]
+        const int len=val.getArrayNItems();
+        for (int iA=0;iA<len;iA++) {
+          QPDFObjectHandle item=val.getArrayItem(iA);
+          if (replaceIndirect(item)) {
+            val.setArrayItem(iA,item);
+          }
+        }
+        continue;
+      }
+
+      if (replaceIndirect(val)) {
+        dict.replaceKey(*it,val);
+      }
+    }
+  }
+}
+// }}}
+
+int deduplicateResources(QPDF &pdf) // {{{
+{
+  ResourceDedup dedup;
+
+  std::vector<QPDFObjectHandle> pages=pdf.getAllPages();
+  const int len=pages.size();
+  for (int iA=0;iA<len;iA++) {
+    // a dictionary inherited by several pages is just seen again,
+    // its entries are canonical by then
+    dedup.processResources(getResources(pages[iA]));
+  }
+  return dedup.replaced;
+}
+// }}}
@@ -0,0 +1,11 @@
+#ifndef QPDF_DEDUP_H_
+#define QPDF_DEDUP_H_
+
+#include <qpdf/QPDF.hh>
+
+// Let identical images, fonts and color spaces used by the pages
+// (also inside form xobjects) all reference a single object.
+// Returns the number of replaced references.
+int deduplicateResources(QPDF &pdf);
+
+#endif
@@ -0,0 +1,326 @@
+#include <config.h>
+#include "qpdf_downsample.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <qpdf/QPDF.hh>
+#include <qpdf/Pl_Buffer.hh>
+#ifdef HAVE_QPDF_PL_DCT_HH
+#include <qpdf/Pl_DCT.hh>
+#endif
+#include "qpdf_pdftopdf.h"
+#include "qpdf_tools.h"
+
+#ifdef HAVE_QPDF_PL_DCT_HH
+
+// NOTE: only images referenced via /XObject resources of the page (and of
+// form xobjects used there) are considered; inline images, patterns,
+// annotation appearances etc. are left alone.
+
+typedef std::pair<int,int> objid_t; // object number, generation
+
+struct ImageUse {
+  ImageUse() : dpi(0) {}
+
+  QPDFObjectHandle image;
+  double dpi; // lowest effective resolution of all placements, i.e. of the largest one
+};
+
+class ImageResolution_Callbacks : public QPDFObjectHandle::ParserCallbacks {
+public:
+  ImageResolution_Callbacks(QPDFObjectHandle resources,const Matrix &ctm,std::map<objid_t,ImageUse> &images,int depth=0);
+
+  virtual void handleObject(QPDFObjectHandle obj);
+  virtual void handleEOF();
+private:
+  void doXObject(const std::string &name);
+private:
+  QPDFObjectHandle resources;
+  std::vector<Matrix> gstack; // back() is current ctm
+  std::vector<QPDFObjectHandle> operands;
+  std::map<objid_t,ImageUse> &images;
+  int depth;
+};
+
+ImageResolution_Callbacks::ImageResolution_Callbacks(QPDFObjectHandle resources,const Matrix &ctm,std::map<objid_t,ImageUse> &images,int depth) // {{{
+  : resources(resources),
+    gstack(1,ctm),
+    images(images),
+    depth(depth)
+{
+}
+// }}}
+
+void ImageResolution_Callbacks::handleObject(QPDFObjectHandle obj) // {{{
+{
+  if (!obj.isOperator()) {
+    operands.push_back(obj);
+    return;
+  }
+
+  const std::string op=obj.getOperatorValue();
+  if (op=="q") {
+    gstack.push_back(gstack.back());
+  } else if (op=="Q") {
+    if (gstack.size()>1) {
+      gstack.pop_back();
+    }
+  } else if (op=="cm") {
+    bool valid=(operands.size()==6);
+    for (size_t iA=0;(valid)&&(iA<operands.size());iA++) {
+      valid=operands[iA].isNumber();
+    }
+    if (valid) {
+      gstack.back()*=Matrix(QPDFObjectHandle::newArray(operands));
+    }
+  } else if ((op=="Do")&&(operands.size()==1)&&(operands[0].isName())) {
+    doXObject(operands[0].getName());
+  }
+  operands.clear();
+}
+// }}}
+
+void ImageResolution_Callbacks::handleEOF() // {{{
+{
+}
+// }}}
+
+void ImageResolution_Callbacks::doXObject(const std::string &name) // {{{
+{
+  static const int max_depth=16; // guard against recursive forms
+
+  if ((!resources.isDictionary())||(!resources.hasKey("/XObject"))) {
+    return;
+  }
+  QPDFObjectHandle xobjs=resources.getKey("/XObject");
+  if ((!xobjs.isDictionary())||(!xobjs.hasKey(name))) {
+    return;
+  }
+  QPDFObjectHandle xobj=xobjs.getKey(name);
+  if (!xobj.isStream()) {
+    return;
+  }
+  QPDFObjectHandle dict=xobj.getDict();
+  QPDFObjectHandle subtype=dict.getKey("/Subtype");
+  if (!subtype.isName()) {
+    return;
+  }
+
+  if (subtype.getName()=="/Image") {
+    QPDFObjectHandle w=dict.getKey("/Width"),
+      h=dict.getKey("/Height");
+    if ((!w.isInteger())||(!h.isInteger())||(!xobj.isIndirect())) {
+      return;
+    }
+    // image space is the unit square
+    const double xsize=gstack.back().xscale()/72.0,
+      ysize=gstack.back().yscale()/72.0; // inch
+    if ((xsize<=0)||(ysize<=0)) {
+      return;
+    }
+    const double dpi=std::min(w.getIntValue()/xsize,h.getIntValue()/ysize);
+
+    ImageUse &use=images[objid_t(xobj.getObjectID(),xobj.getGeneration())];
+    use.image=xobj;
+    // an image drawn at several sizes must keep enough resolution for
+    // the largest one
+    if ((use.dpi==0)||(dpi<use.dpi)) {
+      use.dpi=dpi;
+    }
+  } else if ((subtype.getName()=="/Form")&&(depth<max_depth)) {
+    Matrix ctm=gstack.back();
+    if (dict.hasKey("/Matrix")) {
+      ctm*=Matrix(dict.getKey("/Matrix"));
+    }
+    QPDFObjectHandle subres=resources; // old-style forms inherit from the page
+    if (dict.getKey("/Resources").isDictionary()) {
+      subres=dict.getKey("/Resources");
+    }
+    ImageResolution_Callbacks sub(subres,ctm,images,depth+1);
+    QPDFObjectHandle::parseContentStream(xobj,&sub);
+  }
+}
+// }}}
+
+// returns number of color components, or 0 when averaging is not possible
+static int getComponents(QPDFObjectHandle cs) // {{{
+{
+  if (cs.isArray()&&(cs.getArrayNItems()>0)) {
+    QPDFObjectHandle family=cs.getArrayItem(0);
+    if (!family.isName()) {
+      return 0;
+    }
+    if ((family.getName()=="/ICCBased")&&(cs.getArrayNItems()==2)) {
+      QPDFObjectHandle icc=cs.getArrayItem(1);
+      if ((icc.isStream())&&(icc.getDict().getKey("/N").isInteger())) {
+        return icc.getDict().getKey("/N").getIntValue();
+      }
+      return 0;
+    }
+    cs=family; // e.g. [/CalRGB <<...>>]
+  }
+  if (!cs.isName()) {
+    return 0;
+  }
+  const std::string name=cs.getName();
+  if ((name=="/DeviceGray")||(name=="/CalGray")) {
+    return 1;
+  } else if ((name=="/DeviceRGB")||(name=="/CalRGB")) {
+    return 3;
+  } else if (name=="/DeviceCMYK") {
+    return 4;
+  }
+  // /Indexed, /Separation, /Lab, ...: not supported
+  return 0;
+}
+// }}}
+
+static bool isDCT(QPDFObjectHandle filter) // {{{
+{
+  if (filter.isArray()&&(filter.getArrayNItems()>0)) {
+    filter=filter.getArrayItem(filter.getArrayNItems()-1);
+  }
+  return (filter.isName())&&(filter.getName()=="/DCTDecode");
+}
+// }}}
+
+// box filter: average factor x factor source pixels into one
+static std::string boxFilter(const unsigned char *src,int width,int height,int comps,int factor,int &nwidth,int &nheight) // {{{
+{
+  nwidth=(width+factor-1)/factor;
+  nheight=(height+factor-1)/factor;
+
+  std::string ret(nwidth*nheight*comps,'\0');
+  std::vector<unsigned int> sum(nwidth*comps);
+  for (int oy=0;oy<nheight;oy++) {
+    std::fill(sum.begin(),sum.end(),0);
+    const int y0=oy*factor,
+      y1=std::min(y0+factor,height);
+    for (int y=y0;y<y1;y++) {
+      const unsigned char *line=src+(size_t)y*width*comps;
+      for (int x=0;x<width;x++) {
+        unsigned int *dst=&sum[(x/factor)*comps];
+        for (int c=0;c<comps;c++) {
+          dst[c]+=line[x*comps+c];
+        }
+      }
+    }
+    for (int ox=0;ox<nwidth;ox++) {
+      const int x0=ox*factor,
+        cnt=(std::min(x0+factor,width)-x0)*(y1-y0);
+      for (int c=0;c<comps;c++) {
+        ret[((size_t)oy*nwidth+ox)*comps+c]=(sum[ox*comps+c]+cnt/2)/cnt;
+      }
+    }
+  }
+  return ret;
+}
+// }}}
+
+static bool downsampleImage(QPDFObjectHandle image,int factor) // {{{
+{
+  QPDFObjectHandle dict=image.getDict();
+
+  if ((dict.getKey("/ImageMask").isBool())&&(dict.getKey("/ImageMask").getBoolValue())) {
+    return false;
+  }
+  // masks would need the same treatment; keep things simple
+  if ((dict.hasKey("/SMask"))||(dict.hasKey("/Mask"))) {
+    return false;
+  }
+  if ((!dict.getKey("/BitsPerComponent").isInteger())||
+      (dict.getKey("/BitsPerComponent").getIntValue()!=8)) {
+    return false;
+  }
+  const int comps=getComponents(dict.getKey("/ColorSpace"));
+  if (comps<=0) {
+    return false;
+  }
+  const int width=dict.getKey("/Width").getIntValue(),
+    height=dict.getKey("/Height").getIntValue();
+  if ((width<=0)||(height<=0)) {
+    return false;
+  }
+
+  PointerHolder<Buffer> data;
+  try {
+    data=image.getStreamData(qpdf_dl_all);
+  } catch (const std::exception &e) {
+    // e.g. /JPXDecode, /JBIG2Decode or broken data
+    return false;
+  }
+  if (data->getSize()<(size_t)width*height*comps) {
+    return false;
+  }
+
+  int nwidth,nheight;
+  std::string pixels=boxFilter(data->getBuffer(),width,height,comps,factor,nwidth,nheight);
+
+  // keep lossy compression for photos; CMYK JPEGs are often inverted, avoid them
+  if ((isDCT(dict.getKey("/Filter")))&&(comps!=4)) {
+    Pl_Buffer psink("psink");
+    Pl_DCT pdct("pdct",&psink,nwidth,nheight,comps,(comps==1)?JCS_GRAYSCALE:JCS_RGB);
+    pdct.write((unsigned char *)&pixels[0],pixels.size());
+    pdct.finish();
+    image.replaceStreamData(PointerHolder<Buffer>(psink.getBuffer()),
+                            QPDFObjectHandle::newName("/DCTDecode"),QPDFObjectHandle::newNull());
+  } else {
+    // QPDFWriter will flate-compress it
+    image.replaceStreamData(pixels,QPDFObjectHandle::newNull(),QPDFObjectHandle::newNull());
+  }
+  dict.replaceKey("/Width",QPDFObjectHandle::newInteger(nwidth));
+  dict.replaceKey("/Height",QPDFObjectHandle::newInteger(nheight));
+  dict.removeKey("/Interpolate");
+
+  return true;
+}
+// }}}
+
+int downsampleImages(const std::vector<QPDFObjectHandle> &pages,int dpi) // {{{
+{
+  if (dpi<=0) {
+    return 0;
+  }
+
+  std::map<objid_t,ImageUse> images;
+  const int len=pages.size();
+  for (int iA=0;iA<len;iA++) {
+    QPDFObjectHandle page=pages[iA];
+    Matrix ctm;
+    ctm.scale(getUserUnit(page));
+    try {
+      ImageResolution_Callbacks cb(getResources(page),ctm,images);
+      QPDFObjectHandle::parseContentStream(page.getKey("/Contents"),&cb);
+    } catch (const std::exception &e) {
+      fprintf(stderr,"DEBUG: pdftopdf: Could not scan page %d for images: %s\n",iA+1,e.what());
+    }
+  }
+
+  int ret=0;
+  for (std::map<objid_t,ImageUse>::iterator it=images.begin();it!=images.end();++it) {
+    const int factor=(int)(it->second.dpi/dpi);
+    if (factor<2) {
+      continue;
+    }
+    if (downsampleImage(it->second.image,factor)) {
+      fprintf(stderr,"DEBUG: pdftopdf: Downsampled image %d %d R from %.0f dpi by factor %d\n",
+              it->first.first,it->first.second,it->second.dpi,factor);
+      ret++;
+    }
+  }
+  return ret;
+}
+// }}}
+
+#else // no JPEG support in QPDF (< 7.0.0)
+
+int downsampleImages(const std::vector<QPDFObjectHandle> &pages,int dpi) // {{{
+{
+  fprintf(stderr,"DEBUG: pdftopdf: QPDF too old, not downsampling images\n");
+  return 0;
+}
+// }}}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef QPDF_DOWNSAMPLE_H_
+#define QPDF_DOWNSAMPLE_H_
+
+#include <qpdf/QPDFObjectHandle.hh>
+#include <vector>
+
+// Re-sample image XObjects whose effective resolution on the given pages
+// is at least twice the device resolution (dpi). The pages must be the
+// output pages, so that enlarged placements (fit-to-page, N-up of small
+// pages) are taken into account.
+// Returns the number of images replaced.
+int downsampleImages(const std::vector<QPDFObjectHandle> &pages,int dpi);
+
+#endif
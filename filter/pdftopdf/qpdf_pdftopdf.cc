@@ -193,6 +193,18 @@ Matrix &Matrix::operator*=(const Matrix &rhs) // {{{
 }
 // }}}
 
+double Matrix::xscale() const // {{{
+{
+  return sqrt(ctm[0]*ctm[0]+ctm[1]*ctm[1]);
+}
+// }}}
+
+double Matrix::yscale() const // {{{
+{
+  return sqrt(ctm[2]*ctm[2]+ctm[3]*ctm[3]);
+}
+// }}}
+
 QPDFObjectHandle Matrix::get() const // {{{
 {
   QPDFObjectHandle ret=QPDFObjectHandle::newArray();
@@ -32,6 +32,10 @@ class Matrix {
 
   Matrix &operator*=(const Matrix &rhs);
 
+  // length of the transformed unit vectors
+  double xscale() const;
+  double yscale() const;
+
   QPDFObjectHandle get() const;
   std::string get_string() const;
  private:
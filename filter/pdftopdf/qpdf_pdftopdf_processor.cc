@@ -7,7 +7,10 @@
 #include <qpdf/QUtil.hh>
 #include "qpdf_tools.h"
 #include "qpdf_xobject.h"
+#include "qpdf_downsample.h"
+#include "qpdf_dedup.h"
 #include "qpdf_pdftopdf.h"
+#include "pdftopdf_perf.h"
 
 // Use: content.append(debug_box(pe.sub,xpos,ypos));
 static std::string debug_box(const PageRect &box,float xshift,float yshift) // {{{
@@ -74,6 +77,13 @@ bool QPDF_PDFTOPDF_PageHandle::isExisting() const // {{{
 }
 // }}}
 
+// new page, nothing added (e.g. filler page for duplex)
+bool QPDF_PDFTOPDF_PageHandle::isBlank() const // {{{
+{
+  return (!isExisting())&&(xobjs.empty())&&(content=="q\n");
+}
+// }}}
+
 QPDFObjectHandle QPDF_PDFTOPDF_PageHandle::get() // {{{
 {
   QPDFObjectHandle ret=page;
@@ -358,6 +368,13 @@ void QPDF_PDFTOPDF_PageHandle::debug(const PageRect &rect,float xpos,float ypos)
 }
 // }}}
 
+QPDF_PDFTOPDF_Processor::QPDF_PDFTOPDF_Processor() // {{{
+  : hasCM(false),
+    objStreams(false)
+{
+}
+// }}}
+
 void QPDF_PDFTOPDF_Processor::closeFile() // {{{
 {
   pdf.reset();
@@ -381,6 +398,7 @@ void QPDF_PDFTOPDF_Processor::error(const char *fmt,...) // {{{
 
 bool QPDF_PDFTOPDF_Processor::loadFile(FILE *f,ArgOwnership take) // {{{
 {
+  PerfPhase perf("load");
   closeFile();
   if (!f) {
     throw std::invalid_argument("loadFile(NULL,...) not allowed");
@@ -421,6 +439,7 @@ bool QPDF_PDFTOPDF_Processor::loadFile(FILE *f,ArgOwnership take) // {{{
 
 bool QPDF_PDFTOPDF_Processor::loadFilename(const char *name) // {{{
 {
+  PerfPhase perf("load");
   closeFile();
   try {
     pdf.reset(new QPDF);
@@ -500,11 +519,44 @@ void QPDF_PDFTOPDF_Processor::add_page(std::shared_ptr<PDFTOPDF_PageHandle> page
   assert(pdf);
   auto qpage=dynamic_cast<QPDF_PDFTOPDF_PageHandle *>(page.get());
   if (qpage) {
-    pdf->addPage(qpage->get(),front);
+    const bool blank=qpage->isBlank();
+    QPDFObjectHandle page=qpage->get();
+    if (blank) {
+      // copies (multiply) share the content stream
+      QPDFObjectHandle contents=page.getKey("/Contents");
+      blank_contents.insert(std::make_pair(contents.getObjectID(),contents.getGeneration()));
+    }
+    pdf->addPage(page,front);
   }
 }
 // }}}
 
+int QPDF_PDFTOPDF_Processor::numPages() // {{{
+{
+  assert(pdf);
+  return pdf->getAllPages().size();
+}
+// }}}
+
+std::vector<int> QPDF_PDFTOPDF_Processor::blankPages() // {{{
+{
+  std::vector<int> ret;
+  if (blank_contents.empty()) {
+    return ret;
+  }
+  std::vector<QPDFObjectHandle> pages=pdf->getAllPages();
+  const int len=pages.size();
+  for (int iA=0;iA<len;iA++) {
+    QPDFObjectHandle contents=pages[iA].getKey("/Contents");
+    if ((contents.isIndirect())&&(!pages[iA].hasKey("/Annots"))&&
+        (blank_contents.count(std::make_pair(contents.getObjectID(),contents.getGeneration())))) {
+      ret.push_back(iA+1);
+    }
+  }
+  return ret;
+}
+// }}}
+
 #if 0
 // we remove stuff now probably defunct  TODO
 pdf->getRoot().removeKey("/PageMode");
@@ -515,6 +567,7 @@ pdf->getRoot().removeKey("/PageLabels");
 
 void QPDF_PDFTOPDF_Processor::multiply(int copies,bool collate) // {{{
 {
+  PerfPhase perf("multiply");
   assert(pdf);
   assert(copies>0);
 
@@ -540,6 +593,7 @@ void QPDF_PDFTOPDF_Processor::multiply(int copies,bool collate) // {{{
 // TODO? elsewhere?
 void QPDF_PDFTOPDF_Processor::autoRotateAll(bool dst_lscape,Rotation normal_landscape) // {{{
 {
+  PerfPhase perf("autorotate");
   assert(pdf);
 
   const int len=orig_pages.size();
@@ -571,6 +625,7 @@ void QPDF_PDFTOPDF_Processor::autoRotateAll(bool dst_lscape,Rotation normal_land
 // TODO
 void QPDF_PDFTOPDF_Processor::addCM(const char *defaulticc,const char *outputicc) // {{{
 {
+  PerfPhase perf("addcm");
   assert(pdf);
 
   if (hasOutputIntent(*pdf)) {
@@ -586,6 +641,26 @@ void QPDF_PDFTOPDF_Processor::addCM(const char *defaulticc,const char *outputicc
 }
 // }}}
 
+void QPDF_PDFTOPDF_Processor::downsampleImages(int dpi) // {{{
+{
+  PerfPhase perf("downsample");
+  assert(pdf);
+
+  const int num=::downsampleImages(pdf->getAllPages(),dpi);
+  fprintf(stderr,"DEBUG: pdftopdf: %d image(s) downsampled to %d dpi\n",num,dpi);
+}
+// }}}
+
+void QPDF_PDFTOPDF_Processor::deduplicateResources() // {{{
+{
+  PerfPhase perf("dedup");
+  assert(pdf);
+
+  const int num=::deduplicateResources(*pdf);
+  fprintf(stderr,"DEBUG: pdftopdf: %d duplicate resource reference(s) replaced\n",num);
+}
+// }}}
+
 void QPDF_PDFTOPDF_Processor::setComments(const std::vector<std::string> &comments) // {{{
 {
   extraheader.clear();
@@ -598,8 +673,35 @@ void QPDF_PDFTOPDF_Processor::setComments(const std::vector<std::string> &commen
 }
 // }}}
 
+void QPDF_PDFTOPDF_Processor::setObjectStreams(bool enable) // {{{
+{
+  objStreams=enable;
+}
+// }}}
+
+void QPDF_PDFTOPDF_Processor::setupWriter(QPDFWriter &out) // {{{
+{
+  if (objStreams) {
+    // pack the many small objects into compressed object streams,
+    // this also switches to a cross-reference stream
+    out.setObjectStreamMode(qpdf_o_generate);
+    // flate-compress streams which were stored uncompressed
+    out.setStreamDataMode(qpdf_s_compress);
+    out.setMinimumPDFVersion("1.5");
+  } else if (hasCM) {
+    out.setMinimumPDFVersion("1.4");
+  } else {
+    out.setMinimumPDFVersion("1.2");
+  }
+  if (!extraheader.empty()) {
+    out.setExtraHeaderText(extraheader);
+  }
+}
+// }}}
+
 void QPDF_PDFTOPDF_Processor::emitFile(FILE *f,ArgOwnership take) // {{{
 {
+  PerfPhase perf("emit");
   if (!pdf) {
     return;
   }
@@ -615,33 +717,20 @@ void QPDF_PDFTOPDF_Processor::emitFile(FILE *f,ArgOwnership take) // {{{
     error("emitFile with MustDuplicate is not supported");
     return;
   }
-  if (hasCM) {
-    out.setMinimumPDFVersion("1.4");
-  } else {
-    out.setMinimumPDFVersion("1.2");
-  }
-  if (!extraheader.empty()) {
-    out.setExtraHeaderText(extraheader);
-  }
+  setupWriter(out);
   out.write();
 }
 // }}}
 
 void QPDF_PDFTOPDF_Processor::emitFilename(const char *name) // {{{
 {
+  PerfPhase perf("emit");
   if (!pdf) {
     return;
   }
   // special case: name==NULL -> stdout
   QPDFWriter out(*pdf,name);
-  if (hasCM) {
-    out.setMinimumPDFVersion("1.4");
-  } else {
-    out.setMinimumPDFVersion("1.2");
-  }
-  if (!extraheader.empty()) {
-    out.setExtraHeaderText(extraheader);
-  }
+  setupWriter(out);
   out.write();
 }
 // }}}
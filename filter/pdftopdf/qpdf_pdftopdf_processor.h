@@ -3,6 +3,8 @@
 
 #include "pdftopdf_processor.h"
 #include <qpdf/QPDF.hh>
+#include <qpdf/QPDFWriter.hh>
+#include <set>
 
 class QPDF_PDFTOPDF_PageHandle : public PDFTOPDF_PageHandle {
  public:
@@ -16,6 +18,7 @@ class QPDF_PDFTOPDF_PageHandle : public PDFTOPDF_PageHandle {
   void debug(const PageRect &rect,float xpos,float ypos);
  private:
   bool isExisting() const;
+  bool isBlank() const;
   QPDFObjectHandle get(); // only once!
  private:
   friend class QPDF_PDFTOPDF_Processor;
@@ -34,6 +37,8 @@ class QPDF_PDFTOPDF_PageHandle : public PDFTOPDF_PageHandle {
 
 class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
  public:
+  QPDF_PDFTOPDF_Processor();
+
   virtual bool loadFile(FILE *f,ArgOwnership take=WillStayAlive);
   virtual bool loadFilename(const char *name);
 
@@ -51,8 +56,13 @@ class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
 
   virtual void autoRotateAll(bool dst_lscape,Rotation normal_landscape);
   virtual void addCM(const char *defaulticc,const char *outputicc);
+  virtual void downsampleImages(int dpi);
+  virtual void deduplicateResources();
+  virtual int numPages();
+  virtual std::vector<int> blankPages();
 
   virtual void setComments(const std::vector<std::string> &comments);
+  virtual void setObjectStreams(bool enable);
 
   virtual void emitFile(FILE *dst,ArgOwnership take=WillStayAlive);
   virtual void emitFilename(const char *name);
@@ -62,12 +72,15 @@ class QPDF_PDFTOPDF_Processor : public PDFTOPDF_Processor {
   void closeFile();
   void error(const char *fmt,...);
   void start();
+  void setupWriter(QPDFWriter &out);
  private:
   std::unique_ptr<QPDF> pdf;
   std::vector<QPDFObjectHandle> orig_pages;
+  std::set<std::pair<int,int> > blank_contents; // of new pages left empty
 
   bool hasCM;
   std::string extraheader;
+  bool objStreams;
 };
 
 #endif
@@ -42,6 +42,20 @@ QPDFObjectHandle getArtBox(QPDFObjectHandle page) // {{{
 }
 // }}}
 
+QPDFObjectHandle getResources(QPDFObjectHandle page) // {{{
+{
+  static const int max_depth=32; // guard against /Parent loops
+
+  for (int iA=0;(page.isDictionary())&&(iA<max_depth);iA++) {
+    if (page.hasKey("/Resources")) {
+      return page.getKey("/Resources");
+    }
+    page=page.getKey("/Parent");
+  }
+  return QPDFObjectHandle::newNull();
+}
+// }}}
+
 QPDFObjectHandle makePage(QPDF &pdf,const std::map<std::string,QPDFObjectHandle> &xobjs,QPDFObjectHandle mediabox,const std::string &content) // {{{
 {
   QPDFObjectHandle ret=QPDFObjectHandle::newDictionary();
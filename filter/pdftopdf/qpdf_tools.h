@@ -11,6 +11,9 @@ QPDFObjectHandle getBleedBox(QPDFObjectHandle page);
 QPDFObjectHandle getTrimBox(QPDFObjectHandle page);
 QPDFObjectHandle getArtBox(QPDFObjectHandle page);
 
+// /Resources of the page, or the one inherited from the page tree
+QPDFObjectHandle getResources(QPDFObjectHandle page);
+
 QPDFObjectHandle makePage(QPDF &pdf,const std::map<std::string,QPDFObjectHandle> &xobjs,QPDFObjectHandle mediabox,const std::string &content);
 
 QPDFObjectHandle makeBox(double x1,double y1,double x2,double y2);
@@ -36,6 +36,17 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <deque>
+#include <list>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifdef HAVE_CPP_POPPLER_VERSION_H
 #include "cpp/poppler-version.h"
 #endif
@@ -44,6 +55,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "Object.h"
 #include "Stream.h"
 #include "PDFDoc.h"
+#include "Decrypt.h"
 #include "SplashOutputDev.h"
 #include "GfxState.h"
 #include <cups/ppd.h>
@@ -91,6 +103,13 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #else
 #include <lcms2.h>
 #endif
+#include "icccache.h"
+
+#if defined(MULTITHREADED) && !defined(USE_LCMS1) && defined(HAVE_PTHREAD)
+/* poppler is thread safe and lcms2 transforms may be shared between
+   threads, so pages can be rendered in parallel */
+#define RENDER_THREADS 1
+#endif
 
 #define MAX_CHECK_COMMENT_LINES	20
 #define MAX_BYTES_PER_PIXEL 32
@@ -105,6 +124,26 @@ namespace {
     unsigned char *dst, unsigned int x, unsigned int y);
   typedef void (*WritePixelFunc)(unsigned char *dst,
     unsigned int plane, unsigned int pixeli, unsigned char *pixelBuf);
+  typedef unsigned char *(*ConvertCSpaceLineFunc)(unsigned char *src,
+    unsigned char *buf, unsigned int n);
+
+  /* a page with its page header and the geometry of its image */
+  struct RasterPage {
+    int pageNo;
+    int rotate; /* 0 or 90 (landscape) */
+    cups_page_header2_t header;
+    unsigned int bitmapoffset[2];
+    unsigned int bytesPerLine; /* number of bytes per line */
+                        /* Note: When CUPS_ORDER_BANDED,
+                           cupsBytesPerLine = bytesPerLine*cupsNumColors */
+    /* the converted lines are written to raster or, if it is NULL,
+       collected in data (when rendering on worker threads) */
+    cups_raster_t *raster;
+    unsigned char *data;
+    size_t size;
+    bool done; /* rendered by a worker thread */
+    std::string cacheKey; /* empty: not to be cached */
+  };
 
   int exitCode = 0;
   int pwgraster = 0;
@@ -112,7 +151,6 @@ namespace {
   bool deviceCollate = false;
   cups_page_header2_t header;
   ppd_file_t *ppd = 0;
-  unsigned int bitmapoffset[2];
   unsigned int popplerBitsPerPixel;
   unsigned int popplerNumColors;
   /* image swapping */
@@ -127,11 +165,11 @@ namespace {
   ConvertCSpaceFunc convertCSpace;
   ConvertBitsFunc convertBits;
   WritePixelFunc writePixel;
+  ConvertCSpaceLineFunc convertCSpaceLine;
   unsigned int nplanes;
   unsigned int nbands;
-  unsigned int bytesPerLine; /* number of bytes per line */
-                        /* Note: When CUPS_ORDER_BANDED,
-                           cupsBytesPerLine = bytesPerLine*cupsNumColors */
+  int numThreads = 1;
+  bool usePageCache = false;
   unsigned char revTable[256] = {
 0x00,0x80,0x40,0xc0,0x20,0xa0,0x60,0xe0,0x10,0x90,0x50,0xd0,0x30,0xb0,0x70,0xf0,
 0x08,0x88,0x48,0xc8,0x28,0xa8,0x68,0xe8,0x18,0x98,0x58,0xd8,0x38,0xb8,0x78,0xf8,
@@ -589,6 +627,28 @@ static void parseOpts(int argc, char **argv)
     exit(1);
 #endif /* HAVE_CUPS_1_7 */
   }
+
+  /* render pages on several threads ("auto": one per CPU) */
+  if ((t = cupsGetOption("pdftoraster-threads",num_options,options))
+      != NULL) {
+    if (strcasecmp(t,"auto") == 0) {
+      numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+      numThreads = atoi(t);
+    }
+    if (numThreads < 1) {
+      numThreads = 1;
+    } else if (numThreads > 64) {
+      numThreads = 64;
+    }
+  }
+
+  /* keep rendered pages for pages repeating in the job */
+  if ((t = cupsGetOption("pdftoraster-page-cache",num_options,options))
+      != NULL) {
+    usePageCache = (strcasecmp(t,"true") == 0 || strcasecmp(t,"on") == 0 ||
+		    strcasecmp(t,"yes") == 0);
+  }
 }
 
 static void parsePDFTOPDFComment(FILE *fp)
@@ -1325,6 +1385,192 @@ static unsigned char *convertLinePlaneSwap(unsigned char *src,
   return dst;
 }
 
+/*
+ * Fused line conversions for the common cases of the generic path above.
+ * They do the work of convertCSpace, convertBits and writePixel for a
+ * whole line, in chunks of CHUNK_PIXELS pixels, and give exactly the same
+ * output as the per-pixel functions.
+ */
+
+#define CHUNK_PIXELS 256
+
+/* color space conversion of n pixels, returns src or buf */
+static unsigned char *cspaceLineNone(unsigned char *src, unsigned char *buf,
+  unsigned int n)
+{
+  return src;
+}
+
+static unsigned char *cspaceLineCMYK(unsigned char *src, unsigned char *buf,
+  unsigned int n)
+{
+  cupsImageRGBToCMYK(src,buf,n);
+  return buf;
+}
+
+static unsigned char *cspaceLineProfile(unsigned char *src,
+  unsigned char *buf, unsigned int n)
+{
+  cmsDoTransform(colorTransform,src,buf,n);
+  return buf;
+}
+
+/* reverse the order of n pixels of bpp bytes each */
+static void reversePixels(unsigned char *p, unsigned int n, unsigned int bpp)
+{
+  unsigned char *q = p + (n - 1) * bpp;
+
+  for (;p < q;p += bpp, q -= bpp) {
+    for (unsigned int i = 0;i < bpp;i++) {
+      unsigned char d = p[i];
+      p[i] = q[i];
+      q[i] = d;
+    }
+  }
+}
+
+/* chunked, 8 or 16 bits per color, with color profile */
+static unsigned char *transformLine(unsigned char *src, unsigned char *dst,
+     unsigned int row, unsigned int plane, unsigned int pixels,
+     unsigned int size)
+{
+  cmsDoTransform(colorTransform,src,dst,pixels);
+  return dst;
+}
+
+static unsigned char *transformLineSwap(unsigned char *src,
+     unsigned char *dst, unsigned int row, unsigned int plane,
+     unsigned int pixels, unsigned int size)
+{
+  cmsDoTransform(colorTransform,src,dst,pixels);
+  reversePixels(dst,pixels,
+    header.cupsNumColors * header.cupsBitsPerColor / 8);
+  return dst;
+}
+
+/*
+ * Dither n CMYK pixels, starting at pixel x of the line, to 1 bit per
+ * color, as convert8to1() and writePixel1() do: 2 pixels per byte, C in
+ * the most significant bit of each nibble. x must be even.
+ */
+static void ditherCMYKto1(const unsigned char *cmyk, unsigned char *dst,
+  unsigned int x, unsigned int n, unsigned int row)
+{
+  const unsigned int *d = dither1[row & 0xf];
+  unsigned int i = 0;
+
+  dst += x / 2;
+#ifdef __SSE2__
+  /* 4 pixels (16 bytes) at once: the sign flip makes the signed byte
+     comparison an unsigned one, the bits of the comparison mask are
+     C,M,Y,K of pixel 0, C,M,Y,K of pixel 1, ... */
+  static const unsigned char nibble[16] = {
+    0x0,0x8,0x4,0xc,0x2,0xa,0x6,0xe,0x1,0x9,0x5,0xd,0x3,0xb,0x7,0xf
+  };
+  const __m128i sign = _mm_set1_epi8((char)0x80);
+  unsigned char thresholds[64];
+
+  for (unsigned int j = 0;j < 16;j++) {
+    memset(thresholds + j * 4,d[j],4);
+  }
+  for (;i + 4 <= n;i += 4) {
+    __m128i c = _mm_loadu_si128((const __m128i *)(cmyk + i * 4));
+    __m128i t = _mm_loadu_si128((const __m128i *)(thresholds +
+						  ((x + i) & 0xc) * 4));
+    unsigned int m = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(c,sign),
+					_mm_xor_si128(t,sign)));
+
+    *dst++ = (nibble[m & 0xf] << 4) | nibble[(m >> 4) & 0xf];
+    *dst++ = (nibble[(m >> 8) & 0xf] << 4) | nibble[m >> 12];
+  }
+#endif
+  for (;i < n;i++) {
+    const unsigned char *p = cmyk + i * 4;
+    unsigned int t = d[(x + i) & 0xf];
+    unsigned char c = ((p[0] > t) << 3) | ((p[1] > t) << 2) |
+      ((p[2] > t) << 1) | (p[3] > t);
+
+    if ((i & 1) == 0) {
+      *dst = c << 4;
+    } else {
+      *dst++ |= c;
+    }
+  }
+}
+
+/* chunked, CMYK, 1 bit per color */
+static unsigned char *rgbToCMYK1Line(unsigned char *src, unsigned char *dst,
+     unsigned int row, unsigned int plane, unsigned int pixels,
+     unsigned int size)
+{
+  unsigned char buf[CHUNK_PIXELS * 4];
+
+  for (unsigned int i = 0;i < pixels;i += CHUNK_PIXELS) {
+    unsigned int n = pixels - i < CHUNK_PIXELS ? pixels - i : CHUNK_PIXELS;
+
+    cupsImageRGBToCMYK(src + i * 3,buf,n);
+    ditherCMYKto1(buf,dst,i,n,row);
+  }
+  return dst;
+}
+
+static unsigned char *rgbToCMYK1LineSwap(unsigned char *src,
+     unsigned char *dst, unsigned int row, unsigned int plane,
+     unsigned int pixels, unsigned int size)
+{
+  unsigned char buf[CHUNK_PIXELS * 4];
+
+  for (unsigned int i = 0;i < pixels;i += CHUNK_PIXELS) {
+    unsigned int n = pixels - i < CHUNK_PIXELS ? pixels - i : CHUNK_PIXELS;
+
+    cupsImageRGBToCMYK(src + (pixels - i - n) * 3,buf,n);
+    reversePixels(buf,n,4);
+    ditherCMYKto1(buf,dst,i,n,row);
+  }
+  return dst;
+}
+
+/* planar or banded, 8 bits per color */
+static unsigned char *convertLinePlane8(unsigned char *src,
+     unsigned char *dst, unsigned int row, unsigned int plane,
+     unsigned int pixels, unsigned int size)
+{
+  unsigned char buf[CHUNK_PIXELS * MAX_BYTES_PER_PIXEL];
+  unsigned int nc = header.cupsNumColors;
+
+  for (unsigned int i = 0;i < pixels;i += CHUNK_PIXELS) {
+    unsigned int n = pixels - i < CHUNK_PIXELS ? pixels - i : CHUNK_PIXELS;
+    const unsigned char *bp = convertCSpaceLine(src + i * 3,buf,n) + plane;
+    unsigned char *dp = dst + i;
+
+    for (unsigned int j = 0;j < n;j++, bp += nc) {
+      dp[j] = *bp;
+    }
+  }
+  return dst;
+}
+
+static unsigned char *convertLinePlane8Swap(unsigned char *src,
+     unsigned char *dst, unsigned int row, unsigned int plane,
+     unsigned int pixels, unsigned int size)
+{
+  unsigned char buf[CHUNK_PIXELS * MAX_BYTES_PER_PIXEL];
+  unsigned int nc = header.cupsNumColors;
+
+  for (unsigned int i = 0;i < pixels;i += CHUNK_PIXELS) {
+    unsigned int n = pixels - i < CHUNK_PIXELS ? pixels - i : CHUNK_PIXELS;
+    const unsigned char *bp =
+      convertCSpaceLine(src + (pixels - i - n) * 3,buf,n) +
+      (n - 1) * nc + plane;
+    unsigned char *dp = dst + i;
+
+    for (unsigned int j = 0;j < n;j++, bp -= nc) {
+      dp[j] = *bp;
+    }
+  }
+  return dst;
+}
+
 /* handle special cases which are appear in gutenprint's PPDs. */
 static bool selectSpecialCase()
 {
@@ -1404,6 +1650,52 @@ static unsigned int getCMSColorSpaceType(cmsColorSpaceSignature cs)
     return PT_RGB;
 }
 
+/* replace the generic per-pixel chains by fused line functions */
+static void selectFusedConvertFunc()
+{
+  ConvertLineFunc odd = NULL;
+  ConvertLineFunc even = NULL;
+
+  /* the per-pixel path is the reference for the regression test */
+  if (getenv("PDFTORASTER_GENERIC_CONVERSION") != NULL) return;
+  /* all fused functions read RGB8 */
+  if (popplerNumColors != 3) return;
+  if (convertCSpace == convertCSpaceWithProfiles) {
+    convertCSpaceLine = cspaceLineProfile;
+  } else if (convertCSpace == RGB8toCMYK) {
+    convertCSpaceLine = cspaceLineCMYK;
+  } else if (convertCSpace == convertCSpaceNone) {
+    convertCSpaceLine = cspaceLineNone;
+  } else {
+    return;
+  }
+
+  if (convertLineOdd == convertLineChunked) {
+    if (convertCSpaceLine == cspaceLineProfile
+        && convertBits == convertBitsNoop
+        && (writePixel == writePixel8 || writePixel == writePixel16)) {
+      odd = transformLine;
+      even = transformLineSwap;
+    } else if (convertCSpaceLine == cspaceLineCMYK
+        && convertBits == convert8to1 && writePixel == writePixel1
+        && header.cupsNumColors == 4) {
+      odd = rgbToCMYK1Line;
+      even = rgbToCMYK1LineSwap;
+    }
+  } else if (convertLineOdd == convertLinePlane) {
+    if (convertBits == convertBitsNoop && writePixel == writePlanePixel8) {
+      odd = convertLinePlane8;
+      even = convertLinePlane8Swap;
+    }
+  }
+  if (odd == NULL) return;
+  if (convertLineEven == convertLineOdd) {
+    even = odd;
+  }
+  convertLineOdd = odd;
+  convertLineEven = even;
+}
+
 /* select convertLine function */
 static void selectConvertFunc(cups_raster_t *raster)
 {
@@ -1479,7 +1771,7 @@ static void selectConvertFunc(cups_raster_t *raster)
       popplerColorProfile = cmsCreate_sRGBProfile();
     }
     unsigned int dcst = getCMSColorSpaceType(cmsGetColorSpace(colorProfile));
-    if ((colorTransform = cmsCreateTransform(popplerColorProfile,
+    if ((colorTransform = iccCreateCachedTransform(popplerColorProfile,
             COLORSPACE_SH(PT_RGB) |CHANNELS_SH(3) | BYTES_SH(1),
             colorProfile,
             COLORSPACE_SH(dcst) |
@@ -1629,60 +1921,144 @@ static void selectConvertFunc(cups_raster_t *raster)
     }
     break;
   }
+  selectFusedConvertFunc();
 }
 
-static void writePageImage(cups_raster_t *raster, SplashBitmap *bitmap,
-  int pageNo)
+/*
+ * Write the lines [first,last) of the page image, in reverse order for
+ * back sides which need to be flipped. Row 0 of bitmap is the device row
+ * bitmapTop of the page (non-zero when rendering in bands).
+ */
+static void writePageImage(RasterPage *page, SplashBitmap *bitmap,
+  unsigned int first, unsigned int last, unsigned int bitmapTop)
 {
   ConvertLineFunc convertLine;
   unsigned char *lineBuf = NULL;
+  unsigned char *whiteLine = NULL;
   unsigned char *dp;
   unsigned int rowsize = bitmap->getRowSize();
+  unsigned int bytesPerLine = page->bytesPerLine;
+  bool reverse = page->header.Duplex && (page->pageNo & 1) == 0 &&
+    swap_image_y;
 
   if (allocLineBuf) lineBuf = new unsigned char [bytesPerLine];
-  if ((pageNo & 1) == 0) {
+  if ((page->pageNo & 1) == 0) {
     convertLine = convertLineEven;
   } else {
     convertLine = convertLineOdd;
   }
-  if (header.Duplex && (pageNo & 1) == 0 && swap_image_y) {
-    for (unsigned int plane = 0;plane < nplanes;plane++) {
-      unsigned char *bp = (unsigned char *)(bitmap->getDataPtr());
+  for (unsigned int plane = 0;plane < nplanes;plane++) {
+    for (unsigned int i = first;i < last;i++) {
+      unsigned int l = reverse ? last - 1 - (i - first) : i;
+      unsigned int row = page->bitmapoffset[1] + l - bitmapTop;
+      unsigned char *bp;
 
-      bp += rowsize * (bitmapoffset[1] + header.cupsHeight - 1) +
-        popplerBitsPerPixel * bitmapoffset[0] / 8;
-      for (unsigned int h = header.cupsHeight;h > 0;h--) {
-        for (unsigned int band = 0;band < nbands;band++) {
-          dp = convertLine(bp,lineBuf,h,plane+band,header.cupsWidth,
-                 bytesPerLine);
-          cupsRasterWritePixels(raster,dp,bytesPerLine);
+      if (row < (unsigned int)bitmap->getHeight()) {
+        bp = (unsigned char *)(bitmap->getDataPtr()) + rowsize * row +
+          popplerBitsPerPixel * page->bitmapoffset[0] / 8;
+      } else {
+        /* outside of the rendered area (rounding), paper color */
+        if (whiteLine == NULL) {
+          whiteLine = new unsigned char [rowsize];
         }
-        bp -= rowsize;
+        /* every time, some line functions convert in place */
+        memset(whiteLine,0xff,rowsize);
+        bp = whiteLine;
       }
-    }
-  } else {
-    for (unsigned int plane = 0;plane < nplanes;plane++) {
-      unsigned char *bp = (unsigned char *)(bitmap->getDataPtr());
-
-      bp += rowsize * bitmapoffset[1] + 
-        popplerBitsPerPixel * bitmapoffset[0] / 8;
-      for (unsigned int h = 0;h < header.cupsHeight;h++) {
-        for (unsigned int band = 0;band < nbands;band++) {
-          dp = convertLine(bp,lineBuf,h,plane+band,header.cupsWidth,
-                 bytesPerLine);
-          cupsRasterWritePixels(raster,dp,bytesPerLine);
+      for (unsigned int band = 0;band < nbands;band++) {
+        dp = convertLine(bp,lineBuf,reverse ? l + 1 : l,plane+band,
+               page->header.cupsWidth,bytesPerLine);
+        if (page->raster != NULL) {
+          cupsRasterWritePixels(page->raster,dp,bytesPerLine);
+        } else {
+          memcpy(page->data + page->size,dp,bytesPerLine);
+          page->size += bytesPerLine;
         }
-        bp += rowsize;
       }
     }
   }
+  if (whiteLine != NULL) delete[] whiteLine;
   if (allocLineBuf) delete[] lineBuf;
 }
 
-static void outPage(PDFDoc *doc, Catalog *catalog, int pageNo,
-  SplashOutputDev *out, cups_raster_t *raster)
+/*
+ * The memory budget of RIP_MAX_CACHE (set by cupsd, "128m" by default)
+ * in bytes, 0 if not set
+ */
+static long long getRipMaxCache()
+{
+  const char *cache_env;
+  char cache_units[255];
+  long long max_size;
+
+  if ((cache_env = getenv("RIP_MAX_CACHE")) == NULL)
+    return 0;
+  switch (sscanf(cache_env,"%lld%254s",&max_size,cache_units)) {
+  case 0:
+  case EOF:
+    return 0;
+  case 1:
+    /* number of 256x256 tiles with 4 bytes per pixel */
+    max_size *= 4 * 256 * 256;
+    break;
+  case 2:
+    if (tolower(cache_units[0] & 255) == 'g')
+      max_size *= 1024 * 1024 * 1024;
+    else if (tolower(cache_units[0] & 255) == 'm')
+      max_size *= 1024 * 1024;
+    else if (tolower(cache_units[0] & 255) == 'k')
+      max_size *= 1024;
+    else if (tolower(cache_units[0] & 255) == 't')
+      max_size *= 4 * 256 * 256;
+    break;
+  }
+  if (max_size <= 0)
+    return 0;
+  return max_size;
+}
+
+/*
+ * The part of the RIP_MAX_CACHE budget used by the page cache, set in main()
+ */
+static long long pageCacheBudget = 0;
+
+/*
+ * With worker threads: the part of the budget for the raster data of the
+ * queued pages, and the number of threads sharing the rest for their
+ * bands. Set by PageRenderer before the first page is queued.
+ */
+static long long pageDataBudget = 0;
+static int bandRenderers = 1;
+
+/*
+ * Number of device rows to render at once, so that the bitmap stays within
+ * the memory budget of RIP_MAX_CACHE (less the page cache's part and, with
+ * worker threads, less the queued pages and shared by all threads). 0 means
+ * no limit.
+ */
+static unsigned int getBandHeight(unsigned int width)
+{
+  long long max_size = getRipMaxCache();
+  unsigned int rowsize;
+
+  if (max_size == 0)
+    return 0;
+  max_size = (max_size - pageCacheBudget - pageDataBudget) / bandRenderers;
+
+  /* rows are padded to 4 bytes */
+  rowsize = ((width * popplerBitsPerPixel + 7) / 8 + 3) & ~3U;
+  if (max_size / rowsize < 16)
+    return 16; /* do not make the bands ridiculously small */
+  if (max_size / rowsize > 0x7fffffff)
+    return 0;
+  return max_size / rowsize;
+}
+
+/*
+ * Set up the page header for page pageNo, based on the job's header
+ */
+static void setupPage(Catalog *catalog, int pageNo, RasterPage *rpage)
 {
-  SplashBitmap *bitmap;
   Page *page = catalog->getPage(pageNo);
   PDFRectangle *mediaBox = page->getMediaBox();
   int rotate = page->getRotate();
@@ -1810,12 +2186,8 @@ static void outPage(PDFDoc *doc, Catalog *catalog, int pageNo,
     }
   }
 
-  doc->displayPage(out,pageNo,header.HWResolution[0],
-		   header.HWResolution[1],(landscape == 0 ? 0 : 90),
-		   gTrue,gTrue,gTrue);
-  bitmap = out->getBitmap();
-  bitmapoffset[0] = margins[0] / 72.0 * header.HWResolution[0];
-  bitmapoffset[1] = margins[3] / 72.0 * header.HWResolution[1];
+  rpage->bitmapoffset[0] = margins[0] / 72.0 * header.HWResolution[0];
+  rpage->bitmapoffset[1] = margins[3] / 72.0 * header.HWResolution[1];
 
   /* write page header */
   if (pwgraster == 0) {
@@ -1851,20 +2223,654 @@ static void outPage(PDFDoc *doc, Catalog *catalog, int pageNo,
       header.ImagingBoundingBox[i] = 0;
     }
 
-  bytesPerLine = header.cupsBytesPerLine = (header.cupsBitsPerPixel *
-    header.cupsWidth + 7) / 8;
+  rpage->bytesPerLine = header.cupsBytesPerLine =
+    (header.cupsBitsPerPixel * header.cupsWidth + 7) / 8;
   if (header.cupsColorOrder == CUPS_ORDER_BANDED) {
     header.cupsBytesPerLine *= header.cupsNumColors;
   }
-  if (!cupsRasterWriteHeader2(raster,&header)) {
+
+  rpage->pageNo = pageNo;
+  rpage->rotate = (landscape == 0 ? 0 : 90);
+  rpage->header = header;
+  rpage->raster = NULL;
+  rpage->data = NULL;
+  rpage->size = 0;
+  rpage->done = false;
+}
+
+/*
+ * True if the content stream has no drawing operators: white space and
+ * q/Q only, as in the filler pages which pdftopdf adds for duplex.
+ */
+static bool isBlankStream(Object *obj)
+{
+  bool blank = true;
+  int c;
+
+  if (!obj->isStream()) return false;
+  obj->streamReset();
+  while (blank && (c = obj->streamGetChar()) != EOF) {
+    blank = (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f'
+      || c == '\0' || c == 'q' || c == 'Q');
+  }
+  obj->streamClose();
+  return blank;
+}
+
+/* pages without content and annotations come out in paper color */
+static bool isBlankPage(PDFDoc *doc, int pageNo)
+{
+  Page *page = doc->getCatalog()->getPage(pageNo);
+  bool blank;
+
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 58
+  Object annots = page->getAnnotsObject();
+  Object contents;
+
+  blank = !annots.isArray() || annots.arrayGetLength() == 0;
+  if (blank) {
+    contents = page->getContents();
+    if (contents.isArray()) {
+      for (int i = 0;blank && i < contents.arrayGetLength();i++) {
+        Object elem = contents.arrayGet(i);
+
+        blank = isBlankStream(&elem);
+      }
+    } else if (!contents.isNull()) {
+      blank = isBlankStream(&contents);
+    }
+  }
+#else
+  Object annots, contents, elem;
+
+  page->getAnnots(&annots);
+  blank = !annots.isArray() || annots.arrayGetLength() == 0;
+  annots.free();
+  if (blank) {
+    page->getContents(&contents);
+    if (contents.isArray()) {
+      for (int i = 0;blank && i < contents.arrayGetLength();i++) {
+        contents.arrayGet(i,&elem);
+        blank = isBlankStream(&elem);
+        elem.free();
+      }
+    } else if (!contents.isNull()) {
+      blank = isBlankStream(&contents);
+    }
+    contents.free();
+  }
+#endif
+  return blank;
+}
+
+/*
+ * Write a page of paper color without rendering it. The converted lines
+ * differ only by the row's position in the 16x16 dither matrices, so at
+ * most 16 lines per plane need to be converted.
+ */
+static void writeBlankPage(RasterPage *page)
+{
+  ConvertLineFunc convertLine;
+  unsigned int width = page->header.cupsWidth;
+  unsigned int height = page->header.cupsHeight;
+  unsigned int bytesPerLine = page->bytesPerLine;
+  unsigned int rowsize = (popplerBitsPerPixel * width + 7) / 8;
+  bool reverse = page->header.Duplex && (page->pageNo & 1) == 0 &&
+    swap_image_y;
+  unsigned char *whiteLine = new unsigned char [rowsize];
+  unsigned char *lineBuf = NULL;
+  unsigned char *lines = new unsigned char [16 * nbands * bytesPerLine];
+  bool converted[16];
+
+  if (allocLineBuf) lineBuf = new unsigned char [bytesPerLine];
+  if ((page->pageNo & 1) == 0) {
+    convertLine = convertLineEven;
+  } else {
+    convertLine = convertLineOdd;
+  }
+  for (unsigned int plane = 0;plane < nplanes;plane++) {
+    memset(converted,0,sizeof(converted));
+    for (unsigned int i = 0;i < height;i++) {
+      /* the row writePageImage() passes */
+      unsigned int row = reverse ? height - i : i;
+      unsigned char *lp = lines + (row & 0xf) * nbands * bytesPerLine;
+
+      if (!converted[row & 0xf]) {
+        /* some line functions convert in place */
+        memset(whiteLine,0xff,rowsize);
+        for (unsigned int band = 0;band < nbands;band++) {
+          memcpy(lp + band * bytesPerLine,
+            convertLine(whiteLine,lineBuf,row,plane+band,width,bytesPerLine),
+            bytesPerLine);
+        }
+        converted[row & 0xf] = true;
+      }
+      if (page->raster != NULL) {
+        cupsRasterWritePixels(page->raster,lp,nbands * bytesPerLine);
+      } else {
+        memcpy(page->data + page->size,lp,nbands * bytesPerLine);
+        page->size += nbands * bytesPerLine;
+      }
+    }
+  }
+  if (allocLineBuf) delete[] lineBuf;
+  delete[] lines;
+  delete[] whiteLine;
+}
+
+/*
+ * Render the page and write its image, in bands if the whole page does
+ * not fit into the memory budget
+ */
+static void renderPage(PDFDoc *doc, SplashOutputDev *out, RasterPage *page)
+{
+  SplashBitmap *bitmap;
+  unsigned int width = page->header.cupsWidth;
+  unsigned int height = page->header.cupsHeight;
+  unsigned int *bitmapoffset = page->bitmapoffset;
+  unsigned int bandHeight;
+
+  if (isBlankPage(doc,page->pageNo)) {
+    fprintf(stderr, "DEBUG: Page %d is blank, not rendering it\n",
+	    page->pageNo);
+    writeBlankPage(page);
+    return;
+  }
+  bandHeight = getBandHeight(bitmapoffset[0] + width + 1);
+  if (nplanes > 1 || bandHeight == 0 || bandHeight >= height) {
+    doc->displayPage(out,page->pageNo,page->header.HWResolution[0],
+		     page->header.HWResolution[1],page->rotate,
+		     gTrue,gTrue,gTrue);
+    bitmap = out->getBitmap();
+    writePageImage(page,bitmap,0,height,0);
+  } else {
+    unsigned int nb = (height + bandHeight - 1) / bandHeight;
+    bool reverse = page->header.Duplex && (page->pageNo & 1) == 0 &&
+      swap_image_y;
+
+    fprintf(stderr, "DEBUG: Rendering page %d in %u bands of %u lines\n",
+	    page->pageNo, nb, bandHeight);
+    for (unsigned int b = 0;b < nb;b++) {
+      unsigned int first = (reverse ? nb - 1 - b : b) * bandHeight;
+      unsigned int last = first + bandHeight;
+
+      if (last > height) last = height;
+      /* one extra column and row against rounding in poppler */
+      doc->displayPageSlice(out,page->pageNo,page->header.HWResolution[0],
+			    page->header.HWResolution[1],page->rotate,
+			    gTrue,gTrue,gTrue,
+			    0,bitmapoffset[1] + first,
+			    bitmapoffset[0] + width + 1,
+			    last - first + 1);
+      bitmap = out->getBitmap();
+      writePageImage(page,bitmap,first,last,bitmapoffset[1] + first);
+    }
+  }
+}
+
+/*
+ * Converted raster data of recently rendered pages, so that pages which
+ * repeat in a job (cover sheets, forms, copies made by pdftopdf) are
+ * rendered only once. Only used by the main thread, and only with
+ * "pdftoraster-page-cache=true", as cacheable pages are rendered into a
+ * full-page buffer instead of in bands.
+ */
+class PageCache {
+public:
+  PageCache(size_t maxSize) : maxSize(maxSize), size(0), hits(0) {}
+  ~PageCache();
+  size_t getMaxSize() { return maxSize; }
+  int getHits() { return hits; }
+  const unsigned char *get(const std::string &key, size_t *len);
+  void reserve(size_t len);
+  void put(const std::string &key, unsigned char *data, size_t len);
+private:
+  struct Entry {
+    std::string key;
+    unsigned char *data;
+    size_t len;
+  };
+  std::list<Entry> entries; /* most recently used first */
+  size_t maxSize;
+  size_t size;
+  int hits;
+};
+
+PageCache::~PageCache()
+{
+  for (std::list<Entry>::iterator it = entries.begin();it != entries.end();
+       ++it) {
+    delete[] it->data;
+  }
+}
+
+/* the page data for key, NULL if it is not in the cache */
+const unsigned char *PageCache::get(const std::string &key, size_t *len)
+{
+  for (std::list<Entry>::iterator it = entries.begin();it != entries.end();
+       ++it) {
+    if (it->key == key) {
+      entries.splice(entries.begin(),entries,it);
+      *len = it->len;
+      hits++;
+      return it->data;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * drop the least recently used pages until len more bytes fit, called
+ * before the buffer for a page to be cached is allocated, so that it is
+ * within the budget, too
+ */
+void PageCache::reserve(size_t len)
+{
+  while (!entries.empty() && size + len > maxSize) {
+    size -= entries.back().len;
+    delete[] entries.back().data;
+    entries.pop_back();
+  }
+}
+
+/* add the page data (allocated with new[]), the cache takes it over */
+void PageCache::put(const std::string &key, unsigned char *data, size_t len)
+{
+  if (len > maxSize) {
+    delete[] data;
+    return;
+  }
+  for (std::list<Entry>::iterator it = entries.begin();it != entries.end();
+       ++it) {
+    if (it->key == key) {
+      /* rendered on two threads at the same time */
+      delete[] data;
+      return;
+    }
+  }
+  reserve(len);
+  Entry entry;
+  entry.key = key;
+  entry.data = data;
+  entry.len = len;
+  entries.push_front(entry);
+  size += len;
+}
+
+static PageCache *pageCache = NULL;
+
+/*
+ * append the data of the content stream(s), as stored in the file: the
+ * same stream gives the same bytes, and they need not be decompressed
+ */
+static void appendContents(Object *obj, std::string *data)
+{
+  if (obj->isArray()) {
+    for (int i = 0;i < obj->arrayGetLength();i++) {
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 58
+      Object elem = obj->arrayGet(i);
+
+      appendContents(&elem,data);
+#else
+      Object elem;
+
+      obj->arrayGet(i,&elem);
+      appendContents(&elem,data);
+      elem.free();
+#endif
+    }
+  } else if (obj->isStream()) {
+    Stream *str = obj->getStream()->getUndecodedStream();
+    int c;
+
+    str->reset();
+    while ((c = str->getChar()) != EOF) {
+      data->push_back(c);
+    }
+    str->close();
+  }
+}
+
+/*
+ * Key of the page image for the page cache: MD5 of the page header, the
+ * page boxes, the content, and the resources and annotations (as
+ * references, i.e. the same objects). Empty if the page cannot be cached.
+ */
+static std::string getPageKey(PDFDoc *doc, RasterPage *rpage)
+{
+  Catalog *catalog = doc->getCatalog();
+  Page *page = catalog->getPage(rpage->pageNo);
+  Ref *ref = catalog->getPageRef(rpage->pageNo);
+  int rotate = page->getRotate();
+  std::string data;
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *fp;
+  unsigned char digest[16];
+  char hex[33];
+
+  if (ref == NULL || (fp = open_memstream(&buf,&len)) == NULL) {
+    return "";
+  }
+  data.append((const char *)&rpage->header,sizeof(rpage->header));
+  data.append((const char *)rpage->bitmapoffset,sizeof(rpage->bitmapoffset));
+  data.append((const char *)&rpage->rotate,sizeof(rpage->rotate));
+  /* back sides are converted differently */
+  data.push_back((rpage->pageNo & 1) ? 'o' : 'e');
+  data.append((const char *)page->getMediaBox(),sizeof(PDFRectangle));
+  data.append((const char *)page->getCropBox(),sizeof(PDFRectangle));
+  data.append((const char *)&rotate,sizeof(rotate));
+
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 58
+  Object pageObj = doc->getXRef()->fetch(ref->num,ref->gen);
+  Object obj;
+
+  if (pageObj.isDict()) {
+    obj = pageObj.dictLookupNF("Resources").copy();
+    if (obj.isNull()) {
+      /* inherited */
+      obj = pageObj.dictLookupNF("Parent").copy();
+    }
+    obj.print(fp);
+    fputc('\n',fp);
+    obj = pageObj.dictLookupNF("Annots").copy();
+    obj.print(fp);
+  }
+  fclose(fp);
+  data.append(buf,len);
+  obj = page->getContents();
+  appendContents(&obj,&data);
+#else
+  Object pageObj, obj;
+
+  doc->getXRef()->fetch(ref->num,ref->gen,&pageObj);
+  if (pageObj.isDict()) {
+    pageObj.dictLookupNF(const_cast<char *>("Resources"),&obj);
+    if (obj.isNull()) {
+      /* inherited */
+      obj.free();
+      pageObj.dictLookupNF(const_cast<char *>("Parent"),&obj);
+    }
+    obj.print(fp);
+    obj.free();
+    fputc('\n',fp);
+    pageObj.dictLookupNF(const_cast<char *>("Annots"),&obj);
+    obj.print(fp);
+    obj.free();
+  }
+  pageObj.free();
+  fclose(fp);
+  data.append(buf,len);
+  page->getContents(&obj);
+  appendContents(&obj,&data);
+  obj.free();
+#endif
+  free(buf);
+
+  md5((unsigned char *)data.data(),data.size(),digest);
+  for (int i = 0;i < 16;i++) {
+    snprintf(hex + 2 * i,3,"%02x",digest[i]);
+  }
+  return hex;
+}
+
+/* size of the raster data of the page */
+static size_t pageDataSize(RasterPage *page)
+{
+  return (size_t)page->bytesPerLine * nplanes * nbands *
+    page->header.cupsHeight;
+}
+
+/* look up the page in the page cache, sets page->cacheKey */
+static const unsigned char *getCachedPage(PDFDoc *doc, RasterPage *page,
+  size_t *len)
+{
+  const unsigned char *data;
+
+  if (pageCache == NULL || pageDataSize(page) > pageCache->getMaxSize()) {
+    return NULL;
+  }
+  page->cacheKey = getPageKey(doc,page);
+  if (page->cacheKey.empty()) {
+    return NULL;
+  }
+  if ((data = pageCache->get(page->cacheKey,len)) != NULL) {
+    fprintf(stderr, "DEBUG: Page %d is the same as an earlier page, "
+	    "not rendering it\n", page->pageNo);
+  }
+  return data;
+}
+
+static void outPage(PDFDoc *doc, Catalog *catalog, int pageNo,
+  SplashOutputDev *out, cups_raster_t *raster)
+{
+  RasterPage page;
+  const unsigned char *data;
+  size_t len;
+
+  setupPage(catalog,pageNo,&page);
+  if (!cupsRasterWriteHeader2(raster,&page.header)) {
       pdfError(-1,const_cast<char *>("Can't write page %d header"),pageNo);
       exit(1);
   }
+  if ((data = getCachedPage(doc,&page,&len)) != NULL) {
+    cupsRasterWritePixels(raster,const_cast<unsigned char *>(data),len);
+  } else if (!page.cacheKey.empty()) {
+    pageCache->reserve(pageDataSize(&page));
+    page.data = new unsigned char [pageDataSize(&page)];
+    renderPage(doc,out,&page);
+    cupsRasterWritePixels(raster,page.data,page.size);
+    pageCache->put(page.cacheKey,page.data,page.size);
+  } else {
+    page.raster = raster;
+    renderPage(doc,out,&page);
+  }
+}
 
-  /* write page image */
-  writePageImage(raster,bitmap,pageNo);
+static SplashOutputDev *newOutputDev(PDFDoc *doc, SplashColorMode cmode,
+  int rowpad, SplashColorPtr paperColor)
+{
+  SplashOutputDev *out;
+
+  out = new SplashOutputDev(cmode,rowpad/* row padding */,
+    gFalse,paperColor,gTrue
+#if POPPLER_VERSION_MAJOR == 0 && POPPLER_VERSION_MINOR <= 30
+    ,gFalse
+#endif
+    );
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 19
+  out->startDoc(doc);
+#else
+  out->startDoc(doc->getXRef());
+#endif
+  return out;
+}
+
+#ifdef RENDER_THREADS
+/*
+ * Render pages on worker threads. poppler's PDFDoc cannot be shared
+ * between threads, so every worker opens the document by itself.
+ * The pages are written to the raster stream in order; at most
+ * maxPages pages are queued, being rendered or waiting to be written.
+ * The RIP_MAX_CACHE budget (less the page cache's part) is split: half
+ * of it for the raster data of these pages, the other half for the bands
+ * of all threads. With large pages fewer threads are busy then.
+ */
+class PageRenderer {
+public:
+  PageRenderer(GooString *fileName, int nthreads, SplashColorMode cmode,
+    int rowpad, SplashColorPtr paperColor);
+  ~PageRenderer();
+  int getNumThreads() { return workers.size(); }
+  void outPages(PDFDoc *doc, int npages, cups_raster_t *raster);
+private:
+  struct Worker {
+    PageRenderer *renderer;
+    PDFDoc *doc;
+    SplashOutputDev *out;
+    pthread_t thread;
+  };
+  static void *run(void *arg);
+
+  std::deque<Worker *> workers;
+  unsigned int maxPages;
+  pthread_mutex_t mutex;
+  pthread_cond_t queueCond; /* page queued or quit */
+  pthread_cond_t doneCond; /* page rendered */
+  std::deque<RasterPage *> queue; /* pages to be rendered */
+  bool quit;
+};
+
+PageRenderer::PageRenderer(GooString *fileName, int nthreads,
+  SplashColorMode cmode, int rowpad, SplashColorPtr paperColor)
+  : quit(false)
+{
+  pthread_mutex_init(&mutex,NULL);
+  pthread_cond_init(&queueCond,NULL);
+  pthread_cond_init(&doneCond,NULL);
+  for (int i = 0;i < nthreads;i++) {
+    Worker *w = new Worker;
+
+    w->renderer = this;
+    w->doc = new PDFDoc(fileName->copy());
+    if (!w->doc->isOk()) {
+      delete w->doc;
+      delete w;
+      break;
+    }
+    w->out = newOutputDev(w->doc,cmode,rowpad,paperColor);
+    if (pthread_create(&w->thread,NULL,run,w) != 0) {
+      delete w->out;
+      delete w->doc;
+      delete w;
+      break;
+    }
+    workers.push_back(w);
+  }
+  maxPages = 2 * workers.size();
+  if (getRipMaxCache() > 0 && workers.size() > 0) {
+    pageDataBudget = (getRipMaxCache() - pageCacheBudget) / 2;
+    bandRenderers = workers.size();
+  }
+}
+
+PageRenderer::~PageRenderer()
+{
+  pthread_mutex_lock(&mutex);
+  quit = true;
+  pthread_cond_broadcast(&queueCond);
+  pthread_mutex_unlock(&mutex);
+  for (unsigned int i = 0;i < workers.size();i++) {
+    pthread_join(workers[i]->thread,NULL);
+    delete workers[i]->out;
+    delete workers[i]->doc;
+    delete workers[i];
+  }
+  pageDataBudget = 0;
+  bandRenderers = 1;
+  pthread_cond_destroy(&doneCond);
+  pthread_cond_destroy(&queueCond);
+  pthread_mutex_destroy(&mutex);
 }
 
+void *PageRenderer::run(void *arg)
+{
+  Worker *w = (Worker *)arg;
+  PageRenderer *r = w->renderer;
+
+  pthread_mutex_lock(&r->mutex);
+  for (;;) {
+    while (r->queue.empty() && !r->quit) {
+      pthread_cond_wait(&r->queueCond,&r->mutex);
+    }
+    if (r->queue.empty()) break;
+    RasterPage *page = r->queue.front();
+    r->queue.pop_front();
+    pthread_mutex_unlock(&r->mutex);
+
+    renderPage(w->doc,w->out,page);
+
+    pthread_mutex_lock(&r->mutex);
+    page->done = true;
+    pthread_cond_broadcast(&r->doneCond);
+  }
+  pthread_mutex_unlock(&r->mutex);
+  return NULL;
+}
+
+void PageRenderer::outPages(PDFDoc *doc, int npages,
+  cups_raster_t *raster)
+{
+  Catalog *catalog = doc->getCatalog();
+  std::deque<RasterPage *> pending; /* in page order */
+  RasterPage *next = NULL; /* set up, waiting for memory */
+  size_t pendingSize = 0; /* raster data of the pending pages */
+  long long budget = pageDataBudget;
+  bool limited = false;
+  int pageNo = 1;
+
+  while (pageNo <= npages || next != NULL || !pending.empty()) {
+    if (next == NULL && pageNo <= npages) {
+      /* page headers are set up in order, as the job's header carries
+         values over from page to page */
+      next = new RasterPage;
+      setupPage(catalog,pageNo++,next);
+    }
+    if (next != NULL && pending.size() < maxPages && budget > 0 &&
+	!pending.empty() &&
+	pendingSize + pageDataSize(next) > (unsigned long long)budget) {
+      if (!limited && pending.size() < workers.size()) {
+	fprintf(stderr, "DEBUG: Rendering only %d pages at once within "
+		"RIP_MAX_CACHE\n", (int)pending.size());
+	limited = true;
+      }
+    } else if (next != NULL && pending.size() < maxPages) {
+      RasterPage *page = next;
+      const unsigned char *data;
+      size_t len;
+
+      next = NULL;
+      page->data = new unsigned char [pageDataSize(page)];
+      pendingSize += pageDataSize(page);
+      pending.push_back(page);
+      if ((data = getCachedPage(doc,page,&len)) != NULL) {
+	memcpy(page->data,data,len);
+	page->size = len;
+	page->done = true;
+	page->cacheKey.clear();
+	continue;
+      }
+      pthread_mutex_lock(&mutex);
+      queue.push_back(page);
+      pthread_cond_signal(&queueCond);
+      pthread_mutex_unlock(&mutex);
+      continue;
+    }
+
+    RasterPage *page = pending.front();
+    pending.pop_front();
+    pendingSize -= pageDataSize(page);
+    pthread_mutex_lock(&mutex);
+    while (!page->done) {
+      pthread_cond_wait(&doneCond,&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    if (!cupsRasterWriteHeader2(raster,&page->header)) {
+      pdfError(-1,const_cast<char *>("Can't write page %d header"),
+	page->pageNo);
+      exit(1);
+    }
+    cupsRasterWritePixels(raster,page->data,page->size);
+    if (!page->cacheKey.empty()) {
+      pageCache->put(page->cacheKey,page->data,page->size);
+    } else {
+      delete[] page->data;
+    }
+    delete page;
+  }
+}
+#endif
+
 static void setPopplerColorProfile()
 {
   if (header.cupsBitsPerColor != 8 && header.cupsBitsPerColor != 16) {
@@ -1963,6 +2969,8 @@ int main(int argc, char *argv[]) {
   enum SplashColorMode cmode;
   int rowpad;
   Catalog *catalog;
+  bool tmpFile = false;
+  long long cache_size;
 
 #if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 19
   setErrorCallback(::myErrorFun,NULL);
@@ -1996,8 +3004,8 @@ int main(int argc, char *argv[]) {
     }
     close(fd);
     doc = new PDFDoc(new GooString(name));
-    /* remove name */
-    unlink(name);
+    /* removed as soon as all worker threads have opened it, too */
+    tmpFile = true;
   } else {
     GooString *fileName = new GooString(argv[6]);
     /* argc == 7 filenmae is specified */
@@ -2121,17 +3129,7 @@ int main(int argc, char *argv[]) {
     setPopplerColorProfile();
   }
 
-  out = new SplashOutputDev(cmode,rowpad/* row padding */,
-    gFalse,paperColor,gTrue
-#if POPPLER_VERSION_MAJOR == 0 && POPPLER_VERSION_MINOR <= 30
-    ,gFalse
-#endif
-    );
-#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 19
-  out->startDoc(doc);
-#else
-  out->startDoc(doc->getXRef());
-#endif
+  out = newOutputDev(doc,cmode,rowpad,paperColor);
 
   if ((raster = cupsRasterOpen(1, pwgraster ? CUPS_RASTER_WRITE_PWG :
 			       CUPS_RASTER_WRITE)) == 0) {
@@ -2139,13 +3137,55 @@ int main(int argc, char *argv[]) {
 	exit(1);
   }
   selectConvertFunc(raster);
+  if (usePageCache) {
+    /* pages repeating in the job are rendered only once; the cache gets
+       half of the memory budget, the bands the other half */
+    if ((cache_size = getRipMaxCache()) == 0) {
+      cache_size = 128 * 1024 * 1024;
+    }
+    pageCacheBudget = cache_size / 2;
+    pageCache = new PageCache(pageCacheBudget);
+  }
+#ifdef RENDER_THREADS
+  if (numThreads > 1 && npages > 1) {
+    PageRenderer renderer(doc->getFileName(),
+      numThreads < npages ? numThreads : npages,cmode,rowpad,paperColor);
+
+    if (tmpFile) {
+      unlink(doc->getFileName()->getCString());
+      tmpFile = false;
+    }
+    if (renderer.getNumThreads() > 0) {
+      fprintf(stderr, "DEBUG: Rendering pages with %d threads\n",
+	      renderer.getNumThreads());
+      renderer.outPages(doc,npages,raster);
+      npages = 0;
+    }
+  }
+#else
+  if (numThreads > 1) {
+    fprintf(stderr, "DEBUG: Rendering on several threads is not supported\n");
+  }
+#endif
+  if (tmpFile) {
+    unlink(doc->getFileName()->getCString());
+    tmpFile = false;
+  }
   for (i = 1;i <= npages;i++) {
     outPage(doc,catalog,i,out,raster);
   }
   cupsRasterClose(raster);
+  if (pageCache != NULL) {
+    fprintf(stderr, "DEBUG: %d pages taken from the page cache\n",
+	    pageCache->getHits());
+    delete pageCache;
+  }
 
   delete out;
 err1:
+  if (tmpFile) {
+    unlink(doc->getFileName()->getCString());
+  }
   delete doc;
   if (ppd != NULL) {
     ppdClose(ppd);
@@ -15,6 +15,7 @@
 #include <string.h>
 #include "pdfutils.h"
 #include "fontembed/embed.h"
+#include "fontcache.h"
 
 void pdfOut_printf(pdfOut *pdf,const char *fmt,...) // {{{
 {
@@ -29,6 +30,15 @@ void pdfOut_printf(pdfOut *pdf,const char *fmt,...) // {{{
 }
 // }}}
 
+void pdfOut_write(pdfOut *pdf,const char *buf,int len) // {{{
+{
+  assert(pdf);
+  assert(buf);
+  fwrite(buf,1,len,stdout);
+  pdf->filepos+=len;
+}
+// }}}
+
 void pdfOut_putString(pdfOut *pdf,const char *str,int len) // {{{ - >len==-1: strlen()
 {
   assert(pdf);
@@ -339,7 +349,7 @@ int pdfOut_write_font(pdfOut *pdf,EMB_PARAMS *emb) // {{{
   pdfOut_printf(pdf,">>\n"
                     "stream\n");
   long streamsize=-pdf->filepos;
-  const int outlen=emb_embed(emb,pdfOut_outfn,pdf);
+  const int outlen=fontcache_embed(emb,pdfOut_outfn,pdf);
   streamsize+=pdf->filepos;
   pdfOut_printf(pdf,"\nendstream\n"
                     "endobj\n");
@@ -44,6 +44,9 @@ void pdfOut_finish_pdf(pdfOut *pdf);
 void pdfOut_printf(pdfOut *pdf,const char *fmt,...)
   __attribute__((format(printf, 2, 3)));
 
+/* write out >len bytes of >buf unchanged, e.g. stream data */
+void pdfOut_write(pdfOut *pdf,const char *buf,int len);
+
 /* write out an escaped pdf string: e.g.  (Text \(Test\)\n)
  * >len==-1: use strlen(str) 
  */
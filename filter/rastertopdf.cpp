@@ -31,6 +31,9 @@
 #include <string.h>
 #include <limits>
 #include <signal.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <cups/cups.h>
 #include <cups/raster.h>
 #include <cupsfilters/colormanager.h>
@@ -39,12 +42,17 @@
 #include <arpa/inet.h>   // ntohl
 
 #include <vector>
+#include <map>
+#include <deque>
+#include <set>
 #include <qpdf/QPDF.hh>
 #include <qpdf/QPDFWriter.hh>
 #include <qpdf/QUtil.hh>
 
 #include <qpdf/Pl_Flate.hh>
 #include <qpdf/Pl_Buffer.hh>
+
+#include "ccittg4.h"
 #ifdef QPDF_HAVE_PCLM
 #include <qpdf/Pl_RunLength.hh>
 #include <qpdf/Pl_DCT.hh>
@@ -104,13 +112,11 @@ typedef enum {
   RLE_DECODE
 } CompressionMethod;
 
-// Color conversion function
+// Line conversion function: converts one line of raster data (pixels
+// pixels, bytes bytes) in a single pass, src may be modified. Returns
+// either src or dst.
 typedef unsigned char *(*convertFunction)(unsigned char *src,
-  unsigned char *dst, unsigned int pixels);
-
-// Bit conversion function
-typedef unsigned char *(*bitFunction)(unsigned char *src,
-  unsigned char *dst, unsigned int pixels);
+  unsigned char *dst, unsigned int pixels, unsigned int bytes);
 
 // PDF color conversion function
 typedef void (*pdfConvertFunction)(struct pdf_info * info);
@@ -118,8 +124,8 @@ typedef void (*pdfConvertFunction)(struct pdf_info * info);
 cmsHPROFILE         colorProfile = NULL;     // ICC Profile to be applied to PDF
 int                 cm_disabled = 0;         // Flag rasied if color management is disabled 
 cm_calibration_t    cm_calibrate;            // Status of CUPS color management ("on" or "off")
-convertFunction     conversion_function;     // Raster color conversion function
-bitFunction         bit_function;            // Raster bit function
+convertFunction     conversion_function;     // Raster line conversion function
+int                 bilevel_ccitt = 1;       // Compress 1-bit pages with CCITT G4
 
 
 #ifdef USE_LCMS1
@@ -138,65 +144,117 @@ static void lcmsErrorHandler(cmsContext contextId, cmsUInt32Number ErrorCode,
 
 
 
-// Bit conversion functions
+// Line conversion functions
+//
+// The byte-wise operations work on 64-bit words so that the compiler can
+// turn them into vector instructions.
 
-unsigned char *invertBits(unsigned char *src, unsigned char *dst, unsigned int pixels)
-{ 
+unsigned char *invertBits(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
+{
     unsigned int i;
+    uint64_t w;
 
     // Invert black to grayscale...
-    for (i = pixels, dst = src; i > 0; i --, dst ++)
-      *dst = ~*dst;
+    for (i = 0; i + 8 <= bytes; i += 8)
+    {
+      memcpy(&w, src + i, 8);
+      w = ~w;
+      memcpy(src + i, &w, 8);
+    }
+    for (; i < bytes; i ++)
+      src[i] = ~src[i];
 
-    return dst;
-}	
+    return src;
+}
 
-unsigned char *noBitConversion(unsigned char *src, unsigned char *dst, unsigned int pixels)
+#if !ARCH_IS_BIG_ENDIAN
+// Swap byte pairs for endianess (cupsRasterReadPixels() switches from
+// Big Endian back to the system's Endian), optionally also invert
+template <bool invert>
+unsigned char *swapBytes16(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
+    const uint64_t mask = 0x00ff00ff00ff00ffULL;
+    unsigned int i;
+    uint64_t w;
+
+    for (i = 0; i + 8 <= bytes; i += 8)
+    {
+      memcpy(&w, src + i, 8);
+      w = ((w & mask) << 8) | ((w >> 8) & mask);
+      if (invert)
+        w = ~w;
+      memcpy(src + i, &w, 8);
+    }
+    for (; i + 2 <= bytes; i += 2)
+    {
+      unsigned char swap = src[i];
+      src[i] = invert ? ~src[i + 1] : src[i + 1];
+      src[i + 1] = invert ? ~swap : swap;
+    }
+
     return src;
 }
+#endif /* !ARCH_IS_BIG_ENDIAN */
 
-// Color conversion functions
-
-unsigned char *rgbToCmyk(unsigned char *src, unsigned char *dst, unsigned int pixels)
+unsigned char *noColorConversion(unsigned char *src,
+  unsigned char *dst, unsigned int pixels, unsigned int bytes)
 {
-    cupsImageRGBToCMYK(src,dst,pixels);
-    return dst;
+    return src;
 }
-unsigned char *whiteToCmyk(unsigned char *src, unsigned char *dst, unsigned int pixels)
+
+unsigned char *rgbToCmyk(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
-    cupsImageWhiteToCMYK(src,dst,pixels);
+    cupsImageRGBToCMYK(src,dst,pixels);
     return dst;
 }
 
-unsigned char *cmykToRgb(unsigned char *src, unsigned char *dst, unsigned int pixels)
+unsigned char *cmykToRgb(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
     cupsImageCMYKToRGB(src,dst,pixels);
     return dst;
 }
 
-unsigned char *whiteToRgb(unsigned char *src, unsigned char *dst, unsigned int pixels)
+unsigned char *rgbToWhite(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
-    cupsImageWhiteToRGB(src,dst,pixels);
+    cupsImageRGBToWhite(src,dst,pixels);
     return dst;
 }
 
-unsigned char *rgbToWhite(unsigned char *src, unsigned char *dst, unsigned int pixels)
+unsigned char *cmykToWhite(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
-    cupsImageRGBToWhite(src,dst,pixels);
+    cupsImageCMYKToWhite(src,dst,pixels);
     return dst;
 }
 
-unsigned char *cmykToWhite(unsigned char *src, unsigned char *dst, unsigned int pixels)
+// Black (inverted white) input: invertBits() followed by
+// cupsImageWhiteToRGB() (without color profile, as used here)
+unsigned char *blackToRgb(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
-    cupsImageCMYKToWhite(src,dst,pixels);
+    unsigned char *out = dst;
+    for (unsigned int i = 0; i < pixels; i ++, out += 3)
+      out[0] = out[1] = out[2] = ~src[i];
     return dst;
 }
 
-unsigned char *noColorConversion(unsigned char *src,
-  unsigned char *dst, unsigned int pixels)
+// Black (inverted white) input: invertBits() followed by
+// cupsImageWhiteToCMYK() (without color profile), the inversions cancel
+unsigned char *blackToCmyk(unsigned char *src, unsigned char *dst,
+  unsigned int pixels, unsigned int bytes)
 {
-    return src;
+    uint32_t *out = (uint32_t *)dst;
+    for (unsigned int i = 0; i < pixels; i ++)
+    {
+      const unsigned char cmyk[4] = { 0, 0, 0, src[i] };
+      memcpy(out + i, cmyk, 4);
+    }
+    return dst;
 }
 
 /**
@@ -269,6 +327,388 @@ void die(const char * str)
 }
 
 
+//------------- PCLm strip compression ---------------
+
+#ifdef QPDF_HAVE_PCLM
+// Bit mask of compression methods, bit (1 << method)
+typedef unsigned CompressionMethods;
+
+/**
+ * 'pclmCompressionMethods()' - return the compression methods to be used
+ *                              as bit mask. JPEG is lossy and blurs text,
+ *                              so it is only included if the printer lists
+ *                              it first (or only) in its preferred methods.
+ * O - bit mask of compression methods
+ * I - std::vector of compression methods supported by the printer
+ */
+CompressionMethods
+pclmCompressionMethods(const std::vector<CompressionMethod> &compression_methods)
+{
+    CompressionMethods ret = 0;
+    for (std::vector<CompressionMethod>::const_iterator it = compression_methods.begin();
+         it != compression_methods.end(); ++it)
+      if (*it != DCT_DECODE || it == compression_methods.begin())
+        ret |= 1 << *it;
+    return ret;
+}
+
+/**
+ * 'pclmPickCompression()' - return the first of the given compression methods
+ *                           which is supported.
+ * O - compression method
+ * I - bit mask of supported compression methods
+ * I - compression methods in order of preference
+ */
+CompressionMethod
+pclmPickCompression(CompressionMethods supported, CompressionMethod first,
+                    CompressionMethod second, CompressionMethod third)
+{
+    if (supported & (1 << first))
+      return first;
+    if (supported & (1 << second))
+      return second;
+    return third;
+}
+
+/**
+ * 'pclmBlankStrip()' - check whether the strip is all white (all bytes 0xff,
+ *                      for DeviceGray and DeviceRGB alike).
+ * O - true if the strip is blank
+ * I - raw strip data
+ * I - size of raw strip data
+ */
+bool
+pclmBlankStrip(const unsigned char *data, size_t size)
+{
+    return size == 0 ||
+           (data[0] == 0xff && memcmp(data, data + 1, size - 1) == 0);
+}
+
+/**
+ * 'pclmChooseCompression()' - choose the compression method for one strip by
+ *                             counting the distinct colors in a sample of its
+ *                             pixels. Few colors (text, line art) compress well
+ *                             losslessly, many colors mean a photo.
+ * O - compression method
+ * I - raw strip data
+ * I - size of raw strip data
+ * I - number of color components (1 or 3)
+ * I - bit mask of compression methods supported by the printer
+ */
+CompressionMethod
+pclmChooseCompression(const unsigned char *data, size_t size,
+                      unsigned components, CompressionMethods supported)
+{
+    const unsigned max_samples = 1024;  // pixels looked at
+    // more colors: photographic content; anti-aliased text and line art
+    // stay well below, even in color
+    const unsigned max_colors = 192;
+    unsigned table[256];                // open addressing hash of colors
+    unsigned colors = 0;
+
+    size_t pixels = size / components;
+    size_t step = pixels / max_samples;
+    if (step < 1)
+      step = 1;
+    // odd step, to not always hit the same column
+    step |= 1;
+
+    memset(table, 0xff, sizeof(table));
+    for (size_t i = 0; i < pixels && colors <= max_colors; i += step)
+    {
+      const unsigned char *p = data + i * components;
+      unsigned color = components == 3 ? (p[0] << 16) | (p[1] << 8) | p[2] : p[0];
+      unsigned h = (color * 2654435761u) >> 24;
+      while (table[h] != 0xffffffff && table[h] != color)
+        h = (h + 1) & 255;
+      if (table[h] == 0xffffffff)
+      {
+        table[h] = color;
+        colors ++;
+      }
+    }
+
+    if (colors > max_colors)
+      return pclmPickCompression(supported, DCT_DECODE, FLATE_DECODE, RLE_DECODE);
+    return pclmPickCompression(supported, FLATE_DECODE, RLE_DECODE, DCT_DECODE);
+}
+
+/**
+ * 'compressPclmStrip()' - compress the raw data of one PCLm strip. Does not
+ *                         touch any QPDF object, so that it can be called from
+ *                         the worker threads.
+ * O - Buffer with the compressed data (to be freed by the caller),
+ *     NULL if the color space is not supported
+ * I - raw strip data
+ * I - size of raw strip data
+ * I - compression method
+ * I - strip width
+ * I - strip height
+ * I - color space
+ */
+Buffer *
+compressPclmStrip(const unsigned char *data, size_t size,
+                  CompressionMethod compression, unsigned width,
+                  unsigned height, cups_cspace_t cs)
+{
+    J_COLOR_SPACE color_space;
+    unsigned components;
+    switch(cs) {
+      case CUPS_CSPACE_K:
+      case CUPS_CSPACE_SW:
+        color_space = JCS_GRAYSCALE;
+        components = 1;
+        break;
+      case CUPS_CSPACE_RGB:
+      case CUPS_CSPACE_SRGB:
+      case CUPS_CSPACE_ADOBERGB:
+        color_space = JCS_RGB;
+        components = 3;
+        break;
+      default:
+        return NULL;
+    }
+
+    Pl_Buffer psink("psink");
+    if (compression == FLATE_DECODE)
+    {
+      Pl_Flate pflate("pflate", &psink, Pl_Flate::a_deflate);
+      pflate.write((unsigned char *)data, size);
+      pflate.finish();
+    }
+    else if (compression == RLE_DECODE)
+    {
+      Pl_RunLength prle("prle", &psink, Pl_RunLength::a_encode);
+      prle.write((unsigned char *)data, size);
+      prle.finish();
+    }
+    else if (compression == DCT_DECODE)
+    {
+      Pl_DCT pdct("pdct", &psink, width, height, components, color_space);
+      pdct.write((unsigned char *)data, size);
+      pdct.finish();
+    }
+    return psink.getBuffer();
+}
+
+// Compressed data of one strip
+struct PclmStrip
+{
+    PclmStrip() : data(NULL), compression(FLATE_DECODE), blank(false) {}
+
+    Buffer *data;                 // NULL for blank strips or on error
+    CompressionMethod compression;
+    bool blank;                   // all white, use the shared white strip
+};
+
+// Compresses the strips of the current PCLm page on worker threads, so that
+// reading the raster data of the next strips overlaps with compressing the
+// previous ones. Without pthreads the strips are compressed as they come.
+class PclmStripCompressor
+{
+public:
+    PclmStripCompressor();
+    ~PclmStripCompressor();
+
+    // forget the results of the previous page
+    void start_page(unsigned num_strips);
+    // queue strip i for compression, data must stay valid until wait()
+    void add(unsigned i, const unsigned char *data, size_t size,
+             CompressionMethods methods, unsigned width,
+             unsigned height, cups_cspace_t cs);
+    // wait until all queued strips are compressed
+    void wait();
+    // result for strip i, the caller takes ownership of the data
+    PclmStrip take(unsigned i);
+
+private:
+    struct Job
+    {
+      unsigned strip;
+      const unsigned char *data;
+      size_t size;
+      CompressionMethods methods;
+      unsigned width, height;
+      cups_cspace_t cs;
+    };
+
+    static PclmStrip compress(const Job &job);
+
+#ifdef HAVE_PTHREAD
+    static void *worker(void *arg);
+    void run();
+
+    std::vector<pthread_t> threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_cond;    // new job or quit
+    pthread_cond_t done_cond;   // job finished
+    std::deque<Job> jobs;
+    unsigned busy;              // jobs being worked on
+    bool quit;
+#endif
+    std::vector<bool> submitted;
+    std::vector<PclmStrip> results;
+};
+
+#ifdef HAVE_PTHREAD
+PclmStripCompressor::PclmStripCompressor()
+  : busy(0), quit(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&job_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+}
+#else
+PclmStripCompressor::PclmStripCompressor()
+{
+}
+#endif
+
+PclmStripCompressor::~PclmStripCompressor()
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&mutex);
+    quit = true;
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < threads.size(); i ++)
+      pthread_join(threads[i], NULL);
+#endif
+
+    for (size_t i = 0; i < results.size(); i ++)
+      delete results[i].data;
+#ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&done_cond);
+    pthread_cond_destroy(&job_cond);
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void PclmStripCompressor::start_page(unsigned num_strips)
+{
+    wait();
+    for (size_t i = 0; i < results.size(); i ++)
+      delete results[i].data;
+    results.assign(num_strips, PclmStrip());
+    submitted.assign(num_strips, false);
+
+#ifdef HAVE_PTHREAD
+    // Start the workers with the first page
+    if (threads.empty())
+    {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      if (n < 1)
+        n = 1;
+      else if (n > 8)
+        n = 8;
+      for (long i = 0; i < n; i ++)
+      {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, this) != 0)
+          break;
+        threads.push_back(thread);
+      }
+      dprintf("Compressing PCLm strips with %d threads\n", (int)threads.size());
+    }
+#endif
+}
+
+void PclmStripCompressor::add(unsigned i, const unsigned char *data, size_t size,
+                              CompressionMethods methods, unsigned width,
+                              unsigned height, cups_cspace_t cs)
+{
+    if (i >= submitted.size() || submitted[i])
+      return;
+    submitted[i] = true;
+
+    Job job = { i, data, size, methods, width, height, cs };
+#ifdef HAVE_PTHREAD
+    if (!threads.empty())
+    {
+      pthread_mutex_lock(&mutex);
+      jobs.push_back(job);
+      pthread_cond_signal(&job_cond);
+      pthread_mutex_unlock(&mutex);
+      return;
+    }
+#endif
+    // No threads available, do it right here
+    results[i] = compress(job);
+}
+
+void PclmStripCompressor::wait()
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&mutex);
+    while (!jobs.empty() || busy > 0)
+      pthread_cond_wait(&done_cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+PclmStrip PclmStripCompressor::take(unsigned i)
+{
+    PclmStrip ret = results[i];
+    results[i].data = NULL;
+    return ret;
+}
+
+PclmStrip PclmStripCompressor::compress(const Job &job)
+{
+    PclmStrip ret;
+    if (pclmBlankStrip(job.data, job.size))
+    {
+      ret.blank = true;
+      return ret;
+    }
+    ret.compression = pclmChooseCompression(job.data, job.size,
+                                            job.cs == CUPS_CSPACE_K ||
+                                            job.cs == CUPS_CSPACE_SW ? 1 : 3,
+                                            job.methods);
+    try {
+      ret.data = compressPclmStrip(job.data, job.size, ret.compression,
+                                   job.width, job.height, job.cs);
+    } catch (...) {
+      ret.data = NULL; // reported as missing strip by finish_page()
+    }
+    return ret;
+}
+
+#ifdef HAVE_PTHREAD
+void *PclmStripCompressor::worker(void *arg)
+{
+    ((PclmStripCompressor *)arg)->run();
+    return NULL;
+}
+
+void PclmStripCompressor::run()
+{
+    pthread_mutex_lock(&mutex);
+    for (;;)
+    {
+      while (jobs.empty() && !quit)
+        pthread_cond_wait(&job_cond, &mutex);
+      if (jobs.empty())
+        break;
+
+      Job job = jobs.front();
+      jobs.pop_front();
+      busy ++;
+      pthread_mutex_unlock(&mutex);
+
+      PclmStrip result = compress(job);
+
+      pthread_mutex_lock(&mutex);
+      results[job.strip] = result;
+      busy --;
+      pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+#endif
+#endif
+
+
 //------------- PDF ---------------
 
 struct pdf_info
@@ -290,7 +730,9 @@ struct pdf_info
         render_intent(""),
         color_space(CUPS_CSPACE_K),
         page_width(0),page_height(0),
-        outformat(OUTPUT_FORMAT_PDF)
+        outformat(OUTPUT_FORMAT_PDF),
+        stream_output(false),
+        stream_offset(0)
     {
     }
 
@@ -316,6 +758,21 @@ struct pdf_info
     PointerHolder<Buffer> page_data;
     double page_width,page_height;
     OutFormatType outformat;
+
+    // Streaming mode: every finished page is written to stdout right away,
+    // only the page tree and the xref table are written at the end
+    bool stream_output;
+    long stream_offset;                      // bytes written so far
+    std::vector<long> stream_xref;           // offsets, object n at [n-1]
+    std::vector<unsigned> stream_pages;      // object numbers of the pages
+    std::map<std::pair<int,int>,unsigned> stream_objnum; // QPDF obj -> ours
+    std::deque<QPDFObjectHandle> stream_queue; // referenced, not yet written
+    std::string stream_version;              // PDF version in the header
+    std::string stream_max_version;          // needed by all pages so far
+
+#ifdef QPDF_HAVE_PCLM
+    PclmStripCompressor pclm_compressor;
+#endif
 };
 
 int create_pdf_file(struct pdf_info * info, const OutFormatType & outformat)
@@ -374,50 +831,56 @@ void modify_pdf_color(struct pdf_info * info, int bpp, int bpc, convertFunction
 
 void convertPdf_NoConversion(struct pdf_info * info)
 {
+#if !ARCH_IS_BIG_ENDIAN
+    if (info->bpc == 16)
+    {
+      conversion_function = swapBytes16<false>;
+      return;
+    }
+#endif /* !ARCH_IS_BIG_ENDIAN */
     conversion_function = noColorConversion;
-    bit_function = noBitConversion;
 }
 
 void convertPdf_Cmyk8ToWhite8(struct pdf_info * info)
 {
     modify_pdf_color(info, 8, 8, cmykToWhite);
-    bit_function = noBitConversion;
 }
 
 void convertPdf_Rgb8ToWhite8(struct pdf_info * info)
 {
     modify_pdf_color(info, 8, 8, rgbToWhite);
-    bit_function = noBitConversion;
 }
 
 void convertPdf_Cmyk8ToRgb8(struct pdf_info * info)
 {
     modify_pdf_color(info, 24, 8, cmykToRgb);
-    bit_function = noBitConversion;
 }
 
 void convertPdf_White8ToRgb8(struct pdf_info * info)
 {
-    modify_pdf_color(info, 24, 8, whiteToRgb);
-    bit_function = invertBits;
+    modify_pdf_color(info, 24, 8, blackToRgb);
 }
 
 void convertPdf_Rgb8ToCmyk8(struct pdf_info * info)
 {
     modify_pdf_color(info, 32, 8, rgbToCmyk);
-    bit_function = noBitConversion;
 }
 
 void convertPdf_White8ToCmyk8(struct pdf_info * info)
 {
-    modify_pdf_color(info, 32, 8, whiteToCmyk);
-    bit_function = invertBits;
+    modify_pdf_color(info, 32, 8, blackToCmyk);
 }
 
 void convertPdf_InvertColors(struct pdf_info * info)
 {
-    conversion_function = noColorConversion;
-    bit_function = invertBits;
+#if !ARCH_IS_BIG_ENDIAN
+    if (info->bpc == 16)
+    {
+      conversion_function = swapBytes16<true>;
+      return;
+    }
+#endif /* !ARCH_IS_BIG_ENDIAN */
+    conversion_function = invertBits;
 }
 
 
@@ -599,13 +1062,25 @@ QPDFObjectHandle getCalGrayArray(double wp[3], double gamma[1], double bp[3])
 }
 
 #ifdef QPDF_HAVE_PCLM
+std::string pclmFilterName(CompressionMethod compression)
+{
+    if (compression == FLATE_DECODE)
+      return "/FlateDecode";
+    else if (compression == RLE_DECODE)
+      return "/RunLengthDecode";
+    return "/DCTDecode";
+}
+
 /**
  * 'makePclmStrips()' - return an std::vector of QPDFObjectHandle, each containing the
  *                      stream data of the various strips which make up a PCLm page.
  * O - std::vector of QPDFObjectHandle
  * I - QPDF object
  * I - number of strips per page
- * I - std::vector of PointerHolder<Buffer> containing data for each strip
+ * I - std::vector of PclmStrip containing compressed data for each strip
+ * I - std::map of already created white strips, shared by all blank strips
+ *     of the same size on the page
+ * I - bit mask of compression methods supported by the printer
  * I - strip width
  * I - strip height
  * I - color space
@@ -613,13 +1088,12 @@ QPDFObjectHandle getCalGrayArray(double wp[3], double gamma[1], double bp[3])
  */
 std::vector<QPDFObjectHandle>
 makePclmStrips(QPDF &pdf, unsigned num_strips,
-               std::vector< PointerHolder<Buffer> > &strip_data,
-               std::vector<CompressionMethod> &compression_methods,
+               std::vector<PclmStrip> &strip_data,
+               std::map<std::string,QPDFObjectHandle> &white_strips,
+               CompressionMethods compression_methods,
                unsigned width, std::vector<unsigned>& strip_height, cups_cspace_t cs, unsigned bpc)
 {
     std::vector<QPDFObjectHandle> ret(num_strips);
-    for (size_t i = 0; i < num_strips; i ++)
-      ret[i] = QPDFObjectHandle::newStream(&pdf);
 
     // Strip stream dictionary
     std::map<std::string,QPDFObjectHandle> dict;
@@ -629,21 +1103,18 @@ makePclmStrips(QPDF &pdf, unsigned num_strips,
     dict["/Width"]=QPDFObjectHandle::newInteger(width);
     dict["/BitsPerComponent"]=QPDFObjectHandle::newInteger(bpc);
 
-    J_COLOR_SPACE color_space;
     unsigned components;
     /* Write "/ColorSpace" dictionary based on raster input */
     switch(cs) {
       case CUPS_CSPACE_K:
       case CUPS_CSPACE_SW:
         dict["/ColorSpace"]=QPDFObjectHandle::newName("/DeviceGray");
-        color_space = JCS_GRAYSCALE;
         components = 1;
         break;
       case CUPS_CSPACE_RGB:
       case CUPS_CSPACE_SRGB:
       case CUPS_CSPACE_ADOBERGB:
         dict["/ColorSpace"]=QPDFObjectHandle::newName("/DeviceRGB");
-        color_space = JCS_RGB;
         components = 3;
         break;
       default:
@@ -651,60 +1122,52 @@ makePclmStrips(QPDF &pdf, unsigned num_strips,
         return std::vector<QPDFObjectHandle>(num_strips, QPDFObjectHandle());
     }
 
-    // We deliver already compressed content (instead of letting QPDFWriter do it)
-    // to avoid using excessive memory. For that we first get preferred compression
-    // method to pre-compress content for strip streams.
-
-    // Use the compression method with highest priority of the available methods
-    // __________________
-    // Priority | Method
-    // ------------------
-    // 0        | DCT
-    // 1        | FLATE
-    // 2        | RLE
-    // ------------------
-    CompressionMethod compression = compression_methods.front();
-    for (std::vector<CompressionMethod>::iterator it = compression_methods.begin();
-         it != compression_methods.end(); ++it)
-      compression = compression > *it ? compression : *it;
-
     // write compressed stream data
     for (size_t i = 0; i < num_strips; i ++)
     {
       dict["/Height"]=QPDFObjectHandle::newInteger(strip_height[i]);
-      ret[i].replaceDict(QPDFObjectHandle::newDictionary(dict));
-      Pl_Buffer psink("psink");
-      if (compression == FLATE_DECODE)
+      if (strip_data[i].blank)
       {
-        Pl_Flate pflate("pflate", &psink, Pl_Flate::a_deflate);
-        pflate.write(strip_data[i]->getBuffer(), strip_data[i]->getSize());
-        pflate.finish();
-        ret[i].replaceStreamData(PointerHolder<Buffer>(psink.getBuffer()),
-                              QPDFObjectHandle::newName("/FlateDecode"),QPDFObjectHandle::newNull());
-      }
-      else if (compression == RLE_DECODE)
-      {
-        Pl_RunLength prle("prle", &psink, Pl_RunLength::a_encode);
-        prle.write(strip_data[i]->getBuffer(),strip_data[i]->getSize());
-        prle.finish();
-        ret[i].replaceStreamData(PointerHolder<Buffer>(psink.getBuffer()),
-                              QPDFObjectHandle::newName("/RunLengthDecode"),QPDFObjectHandle::newNull());
-      }
-      else if (compression == DCT_DECODE)
-      {
-        Pl_DCT pdct("pdct", &psink, width, strip_height[i], components, color_space);
-        pdct.write(strip_data[i]->getBuffer(),strip_data[i]->getSize());
-        pdct.finish();
-        ret[i].replaceStreamData(PointerHolder<Buffer>(psink.getBuffer()),
-                              QPDFObjectHandle::newName("/DCTDecode"),QPDFObjectHandle::newNull());
+        std::string key = QUtil::int_to_string(width) + "x" +
+                          QUtil::int_to_string(strip_height[i]) + "/" +
+                          dict["/ColorSpace"].getName();
+        std::map<std::string,QPDFObjectHandle>::iterator it = white_strips.find(key);
+        if (it != white_strips.end())
+        {
+          ret[i] = it->second;
+          continue;
+        }
+        CompressionMethod compression =
+          pclmPickCompression(compression_methods, FLATE_DECODE, RLE_DECODE, DCT_DECODE);
+        std::string white(width * strip_height[i] * components, '\xff');
+        Buffer *data = compressPclmStrip((unsigned char *)white.data(), white.size(),
+                                         compression, width, strip_height[i], cs);
+        if (!data)
+          return std::vector<QPDFObjectHandle>(num_strips, QPDFObjectHandle());
+        ret[i] = QPDFObjectHandle::newStream(&pdf);
+        ret[i].replaceDict(QPDFObjectHandle::newDictionary(dict));
+        ret[i].replaceStreamData(PointerHolder<Buffer>(data),
+                                 QPDFObjectHandle::newName(pclmFilterName(compression)),
+                                 QPDFObjectHandle::newNull());
+        white_strips[key] = ret[i];
+        continue;
       }
+      if (!strip_data[i].data)
+        return std::vector<QPDFObjectHandle>(num_strips, QPDFObjectHandle());
+      ret[i] = QPDFObjectHandle::newStream(&pdf);
+      ret[i].replaceDict(QPDFObjectHandle::newDictionary(dict));
+      ret[i].replaceStreamData(PointerHolder<Buffer>(strip_data[i].data),
+                               QPDFObjectHandle::newName(pclmFilterName(strip_data[i].compression)),
+                               QPDFObjectHandle::newNull());
+      strip_data[i].data = NULL; // owned by the stream now
     }
     return ret;
 }
 #endif
 
 QPDFObjectHandle makeImage(QPDF &pdf, PointerHolder<Buffer> page_data, unsigned width, 
-                           unsigned height, std::string render_intent, cups_cspace_t cs, unsigned bpc)
+                           unsigned height, std::string render_intent, cups_cspace_t cs, unsigned bpc,
+                           unsigned bpp, unsigned bpl)
 {
     QPDFObjectHandle ret = QPDFObjectHandle::newStream(&pdf);
 
@@ -835,6 +1298,23 @@ QPDFObjectHandle makeImage(QPDF &pdf, PointerHolder<Buffer> page_data, unsigned
 
     ret.replaceDict(QPDFObjectHandle::newDictionary(dict));
 
+    // Bilevel (1 bit, 1 component) pages compress much better with the
+    // fax coder than with Flate
+    if (bilevel_ccitt && bpp == 1 && bpc == 1 &&
+        (cs == CUPS_CSPACE_K || cs == CUPS_CSPACE_SW) &&
+        bpl >= (width + 7) / 8)
+    {
+      std::map<std::string,QPDFObjectHandle> parms;
+      parms["/K"]=QPDFObjectHandle::newInteger(-1);
+      parms["/Columns"]=QPDFObjectHandle::newInteger(width);
+      parms["/Rows"]=QPDFObjectHandle::newInteger(height);
+      ret.replaceStreamData(ccittG4Encode(page_data->getBuffer(), width, height,
+                                          bpl),
+                            QPDFObjectHandle::newName("/CCITTFaxDecode"),
+                            QPDFObjectHandle::newDictionary(parms));
+      return ret;
+    }
+
 #ifdef PRE_COMPRESS
     // we deliver already compressed content (instead of letting QPDFWriter do it), to avoid using excessive memory
     Pl_Buffer psink("psink");
@@ -852,6 +1332,286 @@ QPDFObjectHandle makeImage(QPDF &pdf, PointerHolder<Buffer> page_data, unsigned
     return ret;
 }
 
+//------------- PDF version ---------------
+
+/**
+ * 'imagePDFVersion()' - return the lowest PDF version which has all the
+ *                       features the image XObject uses.
+ * O - PDF version, like "1.3"
+ * I - image XObject
+ */
+std::string imagePDFVersion(QPDFObjectHandle image)
+{
+    QPDFObjectHandle dict = image.getDict();
+
+    QPDFObjectHandle bpc = dict.getKey("/BitsPerComponent");
+    if (bpc.isInteger() && bpc.getIntValue() == 16)
+      return "1.5";
+
+    QPDFObjectHandle cs = dict.getKey("/ColorSpace");
+    std::string family;
+    if (cs.isName())
+      family = cs.getName();
+    else if (cs.isArray() && cs.getArrayNItems() > 0 &&
+             cs.getArrayItem(0).isName())
+      family = cs.getArrayItem(0).getName();
+    if (family == "/ICCBased")
+      return "1.3";
+
+    QPDFObjectHandle filter = dict.getKey("/Filter");
+    if (filter.isName() && filter.getName() == "/FlateDecode")
+      return "1.2";
+
+    // CCITTFaxDecode, DCTDecode and RunLengthDecode are there since 1.0
+    if (family == "/CalRGB" || family == "/CalGray" || dict.hasKey("/Intent"))
+      return "1.1";
+    return "1.0";
+}
+
+/**
+ * 'pagePDFVersion()' - return the lowest PDF version which has all the
+ *                      features the images of the page use.
+ * O - PDF version, like "1.3"
+ * I - page object
+ */
+std::string pagePDFVersion(QPDFObjectHandle page)
+{
+    std::string ret = "1.0";
+    QPDFObjectHandle xobjects = page.getKey("/Resources").getKey("/XObject");
+    if (!xobjects.isDictionary())
+      return ret;
+
+    std::set<std::string> keys = xobjects.getKeys();
+    for (std::set<std::string>::iterator it = keys.begin();
+         it != keys.end(); ++it)
+    {
+      QPDFObjectHandle obj = xobjects.getKey(*it);
+      if (!obj.isStream())
+        continue;
+      std::string version = imagePDFVersion(obj);
+      if (version > ret)
+        ret = version;
+    }
+    return ret;
+}
+
+//------------- Streaming PDF output ---------------
+
+// Write (part of) the output file, keeping track of the offset for the xref
+void stream_write(struct pdf_info * info, const std::string &str)
+{
+    if (fwrite(str.data(), 1, str.size(), stdout) != str.size())
+        die("Unable to write PDF output");
+    info->stream_offset += str.size();
+}
+
+unsigned stream_new_object(struct pdf_info * info)
+{
+    info->stream_xref.push_back(-1);
+    return info->stream_xref.size();
+}
+
+// Unparse an object, indirect objects get our own object numbers and
+// are queued for being written by stream_flush_queue()
+std::string stream_unparse(struct pdf_info * info, QPDFObjectHandle obj,
+                           bool top = false)
+{
+    if (!top && obj.isIndirect())
+    {
+      std::pair<int,int> id(obj.getObjectID(), obj.getGeneration());
+      std::map<std::pair<int,int>,unsigned>::iterator it =
+        info->stream_objnum.find(id);
+      unsigned num;
+      if (it != info->stream_objnum.end())
+        num = it->second;
+      else
+      {
+        num = stream_new_object(info);
+        info->stream_objnum[id] = num;
+        info->stream_queue.push_back(obj);
+      }
+      return QUtil::int_to_string(num) + " 0 R";
+    }
+
+    std::string ret;
+    if (obj.isArray())
+    {
+      ret = "[";
+      for (int i = 0; i < obj.getArrayNItems(); i ++)
+        ret += " " + stream_unparse(info, obj.getArrayItem(i));
+      ret += " ]";
+    }
+    else if (obj.isDictionary())
+    {
+      std::set<std::string> keys = obj.getKeys();
+      ret = "<<";
+      for (std::set<std::string>::iterator it = keys.begin();
+           it != keys.end(); ++it)
+      {
+        if (obj.isStream() && *it == "/Length")
+          continue;
+        ret += " " + *it + " " + stream_unparse(info, obj.getKey(*it));
+      }
+      ret += " >>";
+    }
+    else
+      ret = obj.unparse();
+    return ret;
+}
+
+void stream_write_object(struct pdf_info * info, unsigned num,
+                         QPDFObjectHandle obj)
+{
+    info->stream_xref[num - 1] = info->stream_offset;
+    std::string str = QUtil::int_to_string(num) + " 0 obj\n";
+    if (obj.isStream())
+    {
+      // the data is already compressed (PRE_COMPRESS), write it as it is
+      PointerHolder<Buffer> data = obj.getRawStreamData();
+      std::string dict = stream_unparse(info, obj.getDict(), true);
+      // append /Length to the dictionary
+      str += dict.substr(0, dict.size() - 2) + "/Length " +
+             QUtil::int_to_string(data->getSize()) + " >>\nstream\n";
+      stream_write(info, str);
+      stream_write(info, std::string((char *)data->getBuffer(),
+                                     data->getSize()));
+      stream_write(info, "\nendstream\nendobj\n");
+      // we do not need the data any more
+      obj.replaceStreamData("", QPDFObjectHandle::newNull(),
+                            QPDFObjectHandle::newNull());
+    }
+    else
+      stream_write(info, str + stream_unparse(info, obj, true) +
+                   "\nendobj\n");
+}
+
+// Write the queued objects up to and including "until", all of them if
+// it is not in the queue (any more)
+void stream_flush_queue(struct pdf_info * info,
+                        QPDFObjectHandle until = QPDFObjectHandle())
+{
+    std::pair<int,int> until_id(0, 0);
+    if (until.isInitialized() && until.isIndirect())
+      for (size_t i = 0; i < info->stream_queue.size(); i ++)
+        if (info->stream_queue[i].getObjectID() == until.getObjectID() &&
+            info->stream_queue[i].getGeneration() == until.getGeneration())
+        {
+          until_id = std::pair<int,int>(until.getObjectID(),
+                                        until.getGeneration());
+          break;
+        }
+
+    while (!info->stream_queue.empty())
+    {
+      QPDFObjectHandle obj = info->stream_queue.front();
+      info->stream_queue.pop_front();
+      std::pair<int,int> id(obj.getObjectID(), obj.getGeneration());
+      stream_write_object(info, info->stream_objnum[id], obj);
+      if (id == until_id)
+        break;
+    }
+}
+
+// QPDFWriter follows every strip reference of a PCLm page with an image
+// transform stream, also the repeated references to a shared white strip
+void stream_write_pclm_strips(struct pdf_info * info)
+{
+    const std::string transform = "q /image Do Q\n";
+    QPDFObjectHandle strips =
+      info->page.getKey("/Resources").getKey("/XObject");
+    std::set<std::string> keys = strips.getKeys();
+    for (std::set<std::string>::iterator it = keys.begin();
+         it != keys.end(); ++it)
+    {
+      stream_flush_queue(info, strips.getKey(*it));
+      unsigned num = stream_new_object(info);
+      info->stream_xref[num - 1] = info->stream_offset;
+      stream_write(info, QUtil::int_to_string(num) + " 0 obj\n<< /Length " +
+                   QUtil::int_to_string(transform.size()) + " >>\nstream\n" +
+                   transform + "\nendstream\nendobj\n");
+    }
+}
+
+// Header; objects 1 and 2 are reserved for the catalog and the page tree,
+// which are written at the end
+void stream_start(struct pdf_info * info, const std::string &version)
+{
+    info->stream_version = version;
+    info->stream_max_version = version;
+    stream_write(info, "%PDF-" + version + "\n");
+    if (info->outformat == OUTPUT_FORMAT_PCLM)
+      stream_write(info, "%PCLm 1.0\n");
+    else
+      stream_write(info, "%\xbf\xf7\xa2\xfe\n");
+
+    stream_new_object(info); // catalog
+    stream_new_object(info); // page tree
+}
+
+// Write the current page and everything it references in the order page,
+// content stream, images (for PCLm each strip reference followed by an
+// image transform stream), like QPDFWriter does for PCLm. The header gets
+// the PDF version the first page needs.
+void stream_write_page(struct pdf_info * info)
+{
+    std::string version = pagePDFVersion(info->page);
+    if (info->stream_xref.empty())
+      stream_start(info, version);
+    else if (version > info->stream_max_version)
+      info->stream_max_version = version;
+
+    unsigned num = stream_new_object(info);
+    info->stream_pages.push_back(num);
+    std::string dict = stream_unparse(info, info->page, true);
+    info->stream_xref[num - 1] = info->stream_offset;
+    stream_write(info, QUtil::int_to_string(num) + " 0 obj\n<< /Parent 2 0 R" +
+                 dict.substr(2) + "\nendobj\n");
+    if (info->outformat == OUTPUT_FORMAT_PCLM)
+      stream_write_pclm_strips(info);
+    stream_flush_queue(info);
+    fflush(stdout);
+}
+
+// Catalog, page tree, xref table, and trailer
+void stream_finish(struct pdf_info * info)
+{
+    if (info->stream_xref.empty())
+      stream_start(info, "1.0");
+
+    // later pages need a higher version than the one in the header
+    std::string version;
+    if (info->stream_max_version > info->stream_version)
+      version = " /Version /" + info->stream_max_version;
+    info->stream_xref[0] = info->stream_offset;
+    stream_write(info, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R" + version +
+                 " >>\nendobj\n");
+
+    std::string kids;
+    for (size_t i = 0; i < info->stream_pages.size(); i ++)
+      kids += " " + QUtil::int_to_string(info->stream_pages[i]) + " 0 R";
+    info->stream_xref[1] = info->stream_offset;
+    stream_write(info, "2 0 obj\n<< /Type /Pages /Kids [" + kids + " ] /Count " +
+                 QUtil::int_to_string(info->stream_pages.size()) +
+                 " >>\nendobj\n");
+
+    long xref_offset = info->stream_offset;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "xref\n0 %u\n0000000000 65535 f \n",
+             (unsigned)info->stream_xref.size() + 1);
+    stream_write(info, buf);
+    for (size_t i = 0; i < info->stream_xref.size(); i ++)
+    {
+      snprintf(buf, sizeof(buf), "%010ld 00000 n \n", info->stream_xref[i]);
+      stream_write(info, buf);
+    }
+    snprintf(buf, sizeof(buf), "trailer\n<< /Size %u /Root 1 0 R >>\n",
+             (unsigned)info->stream_xref.size() + 1);
+    stream_write(info, buf);
+    snprintf(buf, sizeof(buf), "startxref\n%ld\n%%%%EOF\n", xref_offset);
+    stream_write(info, buf);
+    fflush(stdout);
+}
+
 void finish_page(struct pdf_info * info)
 {
     if (info->outformat == OUTPUT_FORMAT_PDF)
@@ -860,7 +1620,7 @@ void finish_page(struct pdf_info * info)
       if(!info->page_data.getPointer())
           return;
 
-      QPDFObjectHandle image = makeImage(info->pdf, info->page_data, info->width, info->height, info->render_intent, info->color_space, info->bpc);
+      QPDFObjectHandle image = makeImage(info->pdf, info->page_data, info->width, info->height, info->render_intent, info->color_space, info->bpc, info->bpp, info->line_bytes);
       if(!image.isInitialized()) die("Unable to load image data");
 
       // add it
@@ -869,7 +1629,9 @@ void finish_page(struct pdf_info * info)
 #ifdef QPDF_HAVE_PCLM
     else if (info->outformat == OUTPUT_FORMAT_PCLM)
     {
-      // Finish previous PCLm page
+      // Finish previous PCLm page; the workers must be done with the
+      // strip data before we return, also on error
+      info->pclm_compressor.wait();
       if (info->pclm_num_strips == 0)
         return;
 
@@ -877,7 +1639,24 @@ void finish_page(struct pdf_info * info)
         if(!info->pclm_strip_data[i].getPointer())
           return;
 
-      std::vector<QPDFObjectHandle> strips = makePclmStrips(info->pdf, info->pclm_num_strips, info->pclm_strip_data, info->pclm_compression_method_preferred, info->width, info->pclm_strip_height, info->color_space, info->bpc);
+      // compress the strips which did not get complete (short raster data)
+      // and collect the results of the worker threads
+      CompressionMethods methods = pclmCompressionMethods(info->pclm_compression_method_preferred);
+      for (size_t i = 0; i < info->pclm_num_strips; i ++)
+        info->pclm_compressor.add(i, info->pclm_strip_data[i]->getBuffer(),
+                                  info->pclm_strip_data[i]->getSize(), methods,
+                                  info->width, info->pclm_strip_height[i], info->color_space);
+      info->pclm_compressor.wait();
+      std::vector<PclmStrip> compressed(info->pclm_num_strips);
+      for (size_t i = 0; i < info->pclm_num_strips; i ++)
+        compressed[i] = info->pclm_compressor.take(i);
+
+      // blank strips are only shared within the page, so that printers
+      // can process the pages one by one as they are streamed
+      std::map<std::string,QPDFObjectHandle> white_strips; // by size and color space
+      std::vector<QPDFObjectHandle> strips = makePclmStrips(info->pdf, info->pclm_num_strips, compressed, white_strips, methods, info->width, info->pclm_strip_height, info->color_space, info->bpc);
+      for (size_t i = 0; i < info->pclm_num_strips; i ++)
+        delete compressed[i].data; // not taken over on error
       for (size_t i = 0; i < info->pclm_num_strips; i ++)
         if(!strips[i].isInitialized()) die("Unable to load strip data");
 
@@ -936,6 +1715,9 @@ void finish_page(struct pdf_info * info)
 #ifdef QPDF_HAVE_PCLM
     info->pclm_strip_data.clear();
 #endif
+
+    if (info->stream_output)
+      stream_write_page(info);
 }
 
 
@@ -1107,6 +1889,9 @@ int add_pdf_page(struct pdf_info * info, int pagen, unsigned width,
           // reserve space for PCLm strips
           for (size_t i = 0; i < info->pclm_num_strips; i ++)
             info->pclm_strip_data[i] = PointerHolder<Buffer>(new Buffer(info->line_bytes*info->pclm_strip_height[i]));
+#ifdef QPDF_HAVE_PCLM
+          info->pclm_compressor.start_page(info->pclm_num_strips);
+#endif
         }
 
         QPDFObjectHandle page = QPDFObjectHandle::parse(
@@ -1137,7 +1922,8 @@ int add_pdf_page(struct pdf_info * info, int pagen, unsigned width,
         }
     
         info->page = info->pdf.makeIndirectObject(page); // we want to keep a reference
-        info->pdf.addPage(info->page, false);
+        if (!info->stream_output) // otherwise we write it ourselves
+          info->pdf.addPage(info->page, false);
     } catch (std::bad_alloc &ex) {
         die("Unable to allocate page data");
     } catch (...) {
@@ -1152,8 +1938,18 @@ int close_pdf_file(struct pdf_info * info)
     try {
         finish_page(info); // any active
 
+        if (info->stream_output) {
+          stream_finish(info);
+          return 0;
+        }
+
         QPDFWriter output(info->pdf,NULL);
-//        output.setMinimumPDFVersion("1.4");
+        std::string version = "1.0";
+        std::vector<QPDFObjectHandle> pages = info->pdf.getAllPages();
+        for (size_t i = 0; i < pages.size(); i ++)
+          if (pagePDFVersion(pages[i]) > version)
+            version = pagePDFVersion(pages[i]);
+        output.setMinimumPDFVersion(version);
 #ifdef QPDF_HAVE_PCLM
         if (info->outformat == OUTPUT_FORMAT_PCLM)
           output.setPCLm(true);
@@ -1187,6 +1983,16 @@ void pdf_set_line(struct pdf_info * info, unsigned line_n, unsigned char *line)
         unsigned line_strip = line_n - strip_num*info->pclm_strip_height_preferred;
         memcpy(((info->pclm_strip_data[strip_num])->getBuffer() + (line_strip*info->line_bytes)),
                line, info->line_bytes);
+#ifdef QPDF_HAVE_PCLM
+        // last line of the strip, compress it while the next ones are read
+        if (line_strip + 1 == info->pclm_strip_height[strip_num])
+          info->pclm_compressor.add(strip_num,
+                                    info->pclm_strip_data[strip_num]->getBuffer(),
+                                    info->pclm_strip_data[strip_num]->getSize(),
+                                    pclmCompressionMethods(info->pclm_compression_method_preferred),
+                                    info->width, info->pclm_strip_height[strip_num],
+                                    info->color_space);
+#endif
         break;
     }
 }
@@ -1195,9 +2001,8 @@ int convert_raster(cups_raster_t *ras, unsigned width, unsigned height,
 		   int bpp, int bpl, struct pdf_info * info)
 {
     // We should be at raster start
-    int i;
     unsigned cur_line = 0;
-    unsigned char *PixelBuffer, *ptr = NULL, *buff;
+    unsigned char *PixelBuffer, *buff;
 
     PixelBuffer = (unsigned char *)malloc(bpl);
     buff = (unsigned char *)malloc(info->line_bytes);
@@ -1207,26 +2012,8 @@ int convert_raster(cups_raster_t *ras, unsigned width, unsigned height,
         // Read raster data...
         cupsRasterReadPixels(ras, PixelBuffer, bpl);
 
-#if !ARCH_IS_BIG_ENDIAN
-
-	if (info->bpc == 16)
-	{
-	  // Swap byte pairs for endianess (cupsRasterReadPixels() switches
-	  // from Big Endian back to the system's Endian)
-	  for (i = bpl, ptr = PixelBuffer; i > 0; i -= 2, ptr += 2)
-	  {
-	    unsigned char swap = *ptr;
-	    *ptr = *(ptr + 1);
-	    *(ptr + 1) = swap;
-	  }
-	}
-#endif /* !ARCH_IS_BIG_ENDIAN */
-
-        // perform bit operations if necessary
-        bit_function(PixelBuffer, ptr,  bpl);
-
-        // write lines and color convert when necessary
- 	pdf_set_line(info, cur_line, conversion_function(PixelBuffer, buff, width));
+        // byte swapping, bit operations and color conversion in one pass
+ 	pdf_set_line(info, cur_line, conversion_function(PixelBuffer, buff, width, bpl));
 	++cur_line;
     }
     while(cur_line < height);
@@ -1404,6 +2191,22 @@ int main(int argc, char **argv)
     if (create_pdf_file(&pdf, outformat) != 0)
       die("Unable to create PDF file");
 
+    // Write the pages as soon as they are complete, so that only one page
+    // is held in memory
+    const char *val;
+    if ((val = cupsGetOption("rastertopdf-streaming", num_options, options)) != NULL &&
+        (!strcasecmp(val, "true") || !strcasecmp(val, "on") ||
+         !strcasecmp(val, "yes")))
+    {
+      fputs("DEBUG: Streaming output mode.\n", stderr);
+      pdf.stream_output = true;
+    }
+
+    // Compression of 1-bit pages: "ccitt" (default) or "flate"
+    if ((val = cupsGetOption("rastertopdf-bilevel-compression", num_options, options)) != NULL &&
+        !strcasecmp(val, "flate"))
+      bilevel_ccitt = 0;
+
     /* Get PCLm attributes from PPD */
     if (ppd && outformat == OUTPUT_FORMAT_PCLM)
     {
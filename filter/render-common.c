@@ -0,0 +1,168 @@
+/*
+ *   Page lists and parallel renderer processes, shared by gstoraster and
+ *   mupdftoraster.
+ *
+ *   This file is licensed as noted in "COPYING"
+ *   which should have been included with this file.
+ *
+ */
+
+#include "render-common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int *
+parse_page_list(const char *p, int *num)
+{
+  char *end;
+  int *pages = NULL;
+  int *tmp;
+  int last = 0;
+  int page;
+
+  *num = 0;
+  for (;;) {
+    page = strtol(p, &end, 10);
+    if (end == p)
+      break;
+    if (page > last) {
+      if ((tmp = realloc(pages, (*num + 1) * sizeof(int))) == NULL) {
+	free(pages);
+	*num = 0;
+	return NULL;
+      }
+      pages = tmp;
+      pages[(*num) ++] = last = page;
+    }
+    for (p = end; *p == ',' || *p == ' ' || *p == '\t'; p ++);
+  }
+  return pages;
+}
+
+int
+non_blank_page_list(int first_page, int last_page, const int *blank_pages,
+		    int num_blank_pages, char *buf, size_t bufsize)
+{
+  int first = first_page;
+  int last;
+  int i;
+  int n = 0;
+  size_t len = 0;
+
+  buf[0] = '\0';
+  for (i = 0; i <= num_blank_pages && first <= last_page; i ++) {
+    if (i < num_blank_pages && blank_pages[i] < first_page)
+      continue;
+    last = (i < num_blank_pages && blank_pages[i] <= last_page ?
+	    blank_pages[i] - 1 : last_page);
+    if (last >= first) {
+      if (last > first)
+	len += snprintf(buf + len, bufsize - len, "%s%d-%d", len ? "," : "",
+			first, last);
+      else
+	len += snprintf(buf + len, bufsize - len, "%s%d", len ? "," : "",
+			first);
+      if (len >= bufsize)
+	return (-1);
+      n += last - first + 1;
+    }
+    first = last + 2;
+  }
+  return (n);
+}
+
+int
+duplex_blank_pages(int *blank_pages, int num_blank_pages, int num_pages)
+{
+  int last_content = num_pages;
+  int prev = 0;
+  int page;
+  int i, j;
+  int n = 0;
+
+  /* the trailing blank pages */
+  for (j = num_blank_pages - 1;
+       num_pages > 0 && j >= 0 && blank_pages[j] == last_content; j --)
+    last_content --;
+
+  for (i = 0; i < num_blank_pages; prev = page, i ++) {
+    page = blank_pages[i];
+    if ((num_pages > 0 && page > last_content) ||
+	(page % 2 == 1 ? (i + 1 < num_blank_pages &&
+			  blank_pages[i + 1] == page + 1) :
+	 prev == page - 1))
+      blank_pages[n ++] = page;
+  }
+  return (n);
+}
+
+int
+num_render_processes(const char *value, int num_pages, long long page_size)
+{
+  long long per_process;
+  long long mem = 0;
+  long cpus;
+  int n;
+
+  if (value == NULL)
+    return 1;
+  if (!strcasecmp(value, "auto")) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = (cpus > 0 ? cpus : 1);
+  } else
+    n = atoi(value);
+  if (n > 64)
+    n = 64;
+  if (n > num_pages / MIN_PAGES_PER_PROCESS)
+    n = num_pages / MIN_PAGES_PER_PROCESS;
+#ifdef _SC_AVPHYS_PAGES
+  mem = (long long)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#endif /* _SC_AVPHYS_PAGES */
+  per_process = page_size + MEMORY_PER_PROCESS;
+  if (mem > 0 && n > mem / per_process)
+    n = mem / per_process;
+  if (n < 1)
+    n = 1;
+  return n;
+}
+
+void
+render_part_pages(int k, int num_parts, int num_pages, int duplex,
+		  int *first_page, int *last_page)
+{
+  int num_sheets;
+
+  if (duplex) {
+    num_sheets = (num_pages + 1) / 2;
+    *first_page = 2 * (k * num_sheets / num_parts) + 1;
+    *last_page = 2 * ((k + 1) * num_sheets / num_parts);
+    if (*last_page > num_pages)
+      *last_page = num_pages;
+  } else {
+    *first_page = k * num_pages / num_parts + 1;
+    *last_page = (k + 1) * num_pages / num_parts;
+  }
+}
+
+int
+wait_status(int pid, const char *name)
+{
+  int wstatus;
+
+  while (waitpid(pid, &wstatus, 0) == -1)
+    if (errno != EINTR) {
+      perror(name);
+      return 65536;
+    }
+  if (WIFEXITED(wstatus))
+    return WEXITSTATUS(wstatus);
+  else if (WIFSIGNALED(wstatus))
+    return 256 * WTERMSIG(wstatus);
+  return 65536;
+}
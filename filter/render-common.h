@@ -0,0 +1,67 @@
+/*
+ *   Page lists and parallel renderer processes, shared by gstoraster and
+ *   mupdftoraster.
+ *
+ *   This file is licensed as noted in "COPYING"
+ *   which should have been included with this file.
+ *
+ */
+#ifndef _RENDER_COMMON_H
+#define _RENDER_COMMON_H
+
+#include <stddef.h>
+
+/* Parse an ascending, comma separated list of page numbers, pages not
+ * above the previous one are skipped.
+ * returns a malloc()ed array of *num pages, NULL if there are none or if
+ * memory runs out
+ */
+int *parse_page_list(const char *p, int *num);
+
+/* Ranges of the pages from first_page to last_page which are not blank,
+ * as "1-3,5,7-9" like Ghostscript's PageList and Mutool take them.
+ * returns the number of these pages, -1 if buf is too small
+ */
+int non_blank_page_list(int first_page, int last_page,
+			const int *blank_pages, int num_blank_pages,
+			char *buf, size_t bufsize);
+
+/* Keep only the blank pages which can be left out in a duplex job
+ * without moving any other page to the other side of the sheet: pages
+ * whose sheet is blank on both sides and the pages after the last one
+ * with content. The renderer counts the pages it outputs to tell front
+ * from back sides, so a single blank page in the middle of the job
+ * (like the filler between two collated copies) has to be rendered.
+ * blank_pages is changed in place.
+ * returns the new number of blank pages
+ */
+int duplex_blank_pages(int *blank_pages, int num_blank_pages,
+		       int num_pages);
+
+/* Number of renderer processes to render the pages in parallel, value
+ * is the N of the "...-processes=N" option or "auto" for one per CPU.
+ * It is limited so that every process gets at least
+ * MIN_PAGES_PER_PROCESS pages and that they all fit into the free memory
+ * with a page bitmap of page_size bytes and MEMORY_PER_PROCESS each.
+ */
+#define MIN_PAGES_PER_PROCESS	4
+#define MEMORY_PER_PROCESS	(64 * 1024 * 1024)
+
+int num_render_processes(const char *value, int num_pages,
+			 long long page_size);
+
+/* First and last page of part k of the num_parts parts of the pages
+ * rendered in parallel. Every renderer process takes its first page for a
+ * front side, so in a duplex job each part starts on an odd page.
+ */
+void render_part_pages(int k, int num_parts, int num_pages, int duplex,
+		       int *first_page, int *last_page);
+
+/* Wait for the child process pid to exit, name is used in the error
+ * message if waiting fails.
+ * returns its exit status, 256 * signal number if it was killed by a
+ * signal, 65536 on error
+ */
+int wait_status(int pid, const char *name);
+
+#endif
@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+# Check that foomatic-rip, when it feeds several PostScript documents of a
+# job into the same Ghostscript renderer, does not carry over the state of
+# one document into the next one. The first document changes the page
+# size with setpagedevice, the second one must still come out in the
+# default page size, like when it is printed alone.
+#
+# Usage: test-foomatic-rip-reuse.sh [foomatic-rip]
+#
+
+FOOMATICRIP=${1:-./foomatic-rip}
+TMPDIR=${TMPDIR:-/tmp}
+
+if test ! -x "$FOOMATICRIP"; then
+    echo "SKIP: $FOOMATICRIP not found"
+    exit 77
+fi
+if ! gs --version > /dev/null 2>&1; then
+    echo "SKIP: gs not found"
+    exit 77
+fi
+
+WORK=`mktemp -d "$TMPDIR/test-foomatic-rip-reuse.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+# A minimal Foomatic PPD, Ghostscript writes a PGM image of each page
+cat > "$WORK/test.ppd" <<'EOF'
+*PPD-Adobe: "4.3"
+*FormatVersion: "4.3"
+*FileVersion: "1.0"
+*LanguageVersion: English
+*LanguageEncoding: ISOLatin1
+*PCFileName: "TEST.PPD"
+*Manufacturer: "Test"
+*Product: "(Test)"
+*ModelName: "foomatic-rip test"
+*ShortNickName: "foomatic-rip test"
+*NickName: "foomatic-rip test"
+*PSVersion: "(3010.000) 0"
+*LanguageLevel: "3"
+*ColorDevice: False
+*DefaultColorSpace: Gray
+*FoomaticIDs: test test
+*FoomaticRIPCommandLine: "gs -q -dBATCH -dPARANOIDSAFER -dNOPAUSE -sDEVICE=pgmraw -r10 -sOutputFile=- -"
+EOF
+
+cat > "$WORK/doc1.ps" <<'EOF'
+%!PS-Adobe-3.0
+%%Pages: 1
+%%EndComments
+%%Page: 1 1
+<< /PageSize [144 144] >> setpagedevice
+/foomatictestdef true def
+showpage
+%%EOF
+EOF
+
+cat > "$WORK/doc2.ps" <<'EOF'
+%!PS-Adobe-3.0
+%%Pages: 1
+%%EndComments
+%%Page: 1 1
+userdict /foomatictestdef known { (lea) print (ked\n) print } if
+showpage
+%%EOF
+EOF
+
+# Page sizes "width height" of the PGM images in file $1
+page_sizes()
+{
+    LC_ALL=C grep -a -E '^[0-9]+ [0-9]+$' "$1"
+}
+
+"$FOOMATICRIP" -v --ppd "$WORK/test.ppd" "$WORK/doc2.ps" \
+    > "$WORK/alone.pgm" 2> "$WORK/alone.log" ||
+    { echo "FAIL: foomatic-rip failed"; cat "$WORK/alone.log"; exit 1; }
+"$FOOMATICRIP" -v --ppd "$WORK/test.ppd" "$WORK/doc1.ps" "$WORK/doc2.ps" \
+    > "$WORK/job.pgm" 2> "$WORK/job.log" ||
+    { echo "FAIL: foomatic-rip failed"; cat "$WORK/job.log"; exit 1; }
+
+if ! grep -q "Using the renderer of the previous document" "$WORK/job.log"
+then
+    echo "FAIL: the renderer was not used for the second document"
+    exit 1
+fi
+expected="20 20
+`page_sizes "$WORK/alone.pgm"`"
+if test "`page_sizes "$WORK/job.pgm"`" != "$expected"; then
+    echo "FAIL: page sizes differ, expected:"
+    echo "$expected"
+    echo "got:"
+    page_sizes "$WORK/job.pgm"
+    exit 1
+fi
+if grep -q leaked "$WORK/job.log"; then
+    echo "FAIL: definition of the first document seen in the second one"
+    exit 1
+fi
+echo "PASS: page device and userdict are reset between the documents"
+exit 0
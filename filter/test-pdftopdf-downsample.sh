@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Check that pdftopdf downsamples an image drawn at two sizes only as far
+# as its largest placement allows. The 600x600 pixel image of the input
+# is drawn 1 inch (600 dpi) and 4 inches (150 dpi) wide, so for a 72 dpi
+# printer it must be reduced by a factor of 2, not of 8.
+#
+# Usage: test-pdftopdf-downsample.sh [pdftopdf [input.pdf]]
+#
+
+PDFTOPDF=${1:-./pdftopdf}
+INPUT=${2:-${srcdir:-.}/filter/test-pdftopdf-downsample.pdf}
+TMPDIR=${TMPDIR:-/tmp}
+
+if test ! -x "$PDFTOPDF"; then
+    echo "SKIP: $PDFTOPDF not found"
+    exit 77
+fi
+
+WORK=`mktemp -d "$TMPDIR/test-pdftopdf-downsample.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+unset PPD
+FINAL_CONTENT_TYPE=application/pdf "$PDFTOPDF" 1 test test 1 \
+    "pdf-downsample-images=true printer-resolution=72dpi" "$INPUT" \
+    > "$WORK/out.pdf" 2> "$WORK/out.log" ||
+    { echo "FAIL: pdftopdf failed"; cat "$WORK/out.log"; exit 1; }
+
+if grep -q "QPDF too old" "$WORK/out.log"; then
+    echo "SKIP: QPDF without JPEG support, no downsampling"
+    exit 77
+fi
+if ! grep -q "Downsampled image .* by factor 2$" "$WORK/out.log"; then
+    echo "FAIL: image not downsampled for its largest placement"
+    grep "Downsampled" "$WORK/out.log"
+    exit 1
+fi
+if ! grep -a -q "/Width 300" "$WORK/out.pdf"; then
+    echo "FAIL: no 300 pixels wide image in the output"
+    exit 1
+fi
+echo "PASS: downsampled from 600 to 300 pixels"
+exit 0
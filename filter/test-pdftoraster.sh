@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# Check that the fused line conversion functions of pdftoraster produce
+# exactly the same raster data as the generic per-pixel conversion, and
+# that pages taken from the page cache are the same as rendered ones.
+#
+# Usage: test-pdftoraster.sh [pdftoraster [input.pdf]]
+#
+
+PDFTORASTER=${1:-./pdftoraster}
+INPUT=${2:-${srcdir:-.}/filter/test-pdftoraster.pdf}
+# pages 3 and 4 are the same as pages 1 and 2
+REPEAT=${srcdir:-.}/filter/test-pdftoraster-repeat.pdf
+TMPDIR=${TMPDIR:-/tmp}
+WORK=`mktemp -d "$TMPDIR/test-pdftoraster.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+if test ! -x "$PDFTORASTER"; then
+    echo "SKIP: $PDFTORASTER not found"
+    exit 77
+fi
+
+# A minimal PPD offering the color spaces and orders we have fused
+# functions for; backsides are rotated so that both line directions get
+# exercised with Duplex.
+cat > "$WORK/test.ppd" <<'EOF'
+*PPD-Adobe: "4.3"
+*FormatVersion: "4.3"
+*FileVersion: "1.0"
+*LanguageVersion: English
+*LanguageEncoding: ISOLatin1
+*PCFileName: "TEST.PPD"
+*Manufacturer: "Test"
+*Product: "(Test)"
+*ModelName: "pdftoraster test"
+*ShortNickName: "pdftoraster test"
+*NickName: "pdftoraster test"
+*PSVersion: "(3010.000) 0"
+*LanguageLevel: "3"
+*ColorDevice: True
+*DefaultColorSpace: RGB
+*cupsVersion: 1.4
+*cupsFilter: "application/vnd.cups-raster 0 -"
+*cupsBackSide: Rotated
+*OpenUI *PageSize/Media Size: PickOne
+*DefaultPageSize: Letter
+*PageSize Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageSize
+*OpenUI *PageRegion/Media Size: PickOne
+*DefaultPageRegion: Letter
+*PageRegion Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageRegion
+*DefaultImageableArea: Letter
+*ImageableArea Letter: "0 0 612 792"
+*DefaultPaperDimension: Letter
+*PaperDimension Letter: "612 792"
+*OpenUI *Resolution/Resolution: PickOne
+*DefaultResolution: 75dpi
+*Resolution 75dpi/75 DPI: "<</HWResolution[75 75]>>setpagedevice"
+*CloseUI: *Resolution
+*OpenUI *Duplex/2-Sided Printing: PickOne
+*DefaultDuplex: None
+*Duplex None/Off: "<</Duplex false>>setpagedevice"
+*Duplex DuplexNoTumble/Long Edge: "<</Duplex true/Tumble false>>setpagedevice"
+*CloseUI: *Duplex
+*OpenUI *ColorModel/Color Mode: PickOne
+*DefaultColorModel: RGB
+*ColorModel RGB/RGB: "<</cupsColorOrder 0/cupsColorSpace 1/cupsBitsPerColor 8>>setpagedevice"
+*ColorModel RGBPlanar/RGB Planar: "<</cupsColorOrder 2/cupsColorSpace 1/cupsBitsPerColor 8>>setpagedevice"
+*ColorModel CMYKPlanar/CMYK Planar: "<</cupsColorOrder 2/cupsColorSpace 6/cupsBitsPerColor 8>>setpagedevice"
+*ColorModel CMYK1/CMYK 1 Bit: "<</cupsColorOrder 0/cupsColorSpace 6/cupsBitsPerColor 1>>setpagedevice"
+*CloseUI: *ColorModel
+EOF
+
+status=0
+
+# run_test name PPD options [RIP_MAX_CACHE]
+run_test()
+{
+    name=$1
+    ppd=$2
+    options=$3
+    cache=$4
+
+    PPD=$ppd RIP_MAX_CACHE=$cache "$PDFTORASTER" 1 test test 1 "$options" "$INPUT" \
+	> "$WORK/$name-fused.ras" 2> "$WORK/$name-fused.log"
+    s1=$?
+    PPD=$ppd RIP_MAX_CACHE=$cache PDFTORASTER_GENERIC_CONVERSION=1 \
+	"$PDFTORASTER" 1 test test 1 "$options" "$INPUT" \
+	> "$WORK/$name-generic.ras" 2> "$WORK/$name-generic.log"
+    s2=$?
+    if test $s1 != 0 -o $s2 != 0; then
+	echo "FAIL: $name: pdftoraster exited with $s1/$s2"
+	cat "$WORK/$name-fused.log"
+	status=1
+    elif test ! -s "$WORK/$name-fused.ras"; then
+	echo "FAIL: $name: no output"
+	status=1
+    elif cmp "$WORK/$name-fused.ras" "$WORK/$name-generic.ras"; then
+	echo "PASS: $name"
+    else
+	echo "FAIL: $name: raster data differs"
+	status=1
+    fi
+}
+
+# without PPD: IPP attributes select the color space
+run_test adobergb8 "" "color-space=AdobeRgb_8 printer-resolution=75dpi"
+run_test cmyk1 "" "color-space=Cmyk_1 printer-resolution=75dpi"
+
+for model in RGB RGBPlanar CMYKPlanar CMYK1; do
+    run_test "ppd-$model" "$WORK/test.ppd" "ColorModel=$model"
+    run_test "ppd-$model-duplex" "$WORK/test.ppd" \
+	"ColorModel=$model Duplex=DuplexNoTumble"
+    # small cache forces banded rendering
+    run_test "ppd-$model-banded" "$WORK/test.ppd" \
+	"ColorModel=$model Duplex=DuplexNoTumble" 64k
+done
+
+# run_cache_test name PPD options [RIP_MAX_CACHE]
+run_cache_test()
+{
+    name=$1
+    ppd=$2
+    options=$3
+    cache=$4
+
+    PPD=$ppd RIP_MAX_CACHE=$cache "$PDFTORASTER" 1 test test 1 "$options" \
+	"$REPEAT" > "$WORK/$name-rendered.ras" 2> "$WORK/$name-rendered.log"
+    s1=$?
+    PPD=$ppd RIP_MAX_CACHE=$cache "$PDFTORASTER" 1 test test 1 \
+	"$options pdftoraster-page-cache=true" "$REPEAT" \
+	> "$WORK/$name-cached.ras" 2> "$WORK/$name-cached.log"
+    s2=$?
+    if test $s1 != 0 -o $s2 != 0; then
+	echo "FAIL: $name: pdftoraster exited with $s1/$s2"
+	cat "$WORK/$name-cached.log"
+	status=1
+    elif ! grep -q "DEBUG: 2 pages taken from the page cache" \
+	"$WORK/$name-cached.log"; then
+	echo "FAIL: $name: pages not taken from the page cache"
+	status=1
+    elif cmp "$WORK/$name-rendered.ras" "$WORK/$name-cached.ras"; then
+	echo "PASS: $name"
+    else
+	echo "FAIL: $name: raster data differs"
+	status=1
+    fi
+}
+
+run_cache_test cache-rgb "$WORK/test.ppd" "ColorModel=RGB"
+run_cache_test cache-cmyk1-duplex "$WORK/test.ppd" \
+    "ColorModel=CMYK1 Duplex=DuplexNoTumble"
+# the page cache gets half of the budget, the page bitmap does not fit
+# into the other half and is rendered in bands
+run_cache_test cache-banded "$WORK/test.ppd" "ColorModel=CMYK1" 1m
+
+exit $status
@@ -0,0 +1,141 @@
+#!/bin/sh
+#
+# Check that rastertopdf writes PDF and PCLm files which qpdf accepts
+# without errors or warnings, with and without streaming output.
+# The raster input is made with pdftoraster.
+#
+# Usage: test-rastertopdf.sh [rastertopdf [pdftoraster [input.pdf]]]
+#
+
+RASTERTOPDF=${1:-./rastertopdf}
+PDFTORASTER=${2:-./pdftoraster}
+INPUT=${3:-${srcdir:-.}/filter/test-pdftoraster.pdf}
+TMPDIR=${TMPDIR:-/tmp}
+
+for prog in "$RASTERTOPDF" "$PDFTORASTER"; do
+    if test ! -x "$prog"; then
+	echo "SKIP: $prog not found"
+	exit 77
+    fi
+done
+if ! qpdf --version > /dev/null 2>&1; then
+    echo "SKIP: qpdf not found"
+    exit 77
+fi
+
+WORK=`mktemp -d "$TMPDIR/test-rastertopdf.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+# A minimal PPD for the raster input, also giving the PCLm attributes
+cat > "$WORK/test.ppd" <<'EOF'
+*PPD-Adobe: "4.3"
+*FormatVersion: "4.3"
+*FileVersion: "1.0"
+*LanguageVersion: English
+*LanguageEncoding: ISOLatin1
+*PCFileName: "TEST.PPD"
+*Manufacturer: "Test"
+*Product: "(Test)"
+*ModelName: "rastertopdf test"
+*ShortNickName: "rastertopdf test"
+*NickName: "rastertopdf test"
+*PSVersion: "(3010.000) 0"
+*LanguageLevel: "3"
+*ColorDevice: True
+*DefaultColorSpace: RGB
+*cupsVersion: 1.4
+*cupsFilter: "application/vnd.cups-raster 0 -"
+*cupsPclmStripHeightPreferred: 16
+*cupsPclmStripHeightSupported: 16
+*cupsPclmRasterBackSide: Normal
+*cupsPclmSourceResolutionDefault: 75dpi
+*cupsPclmSourceResolutionSupported: 75dpi
+*cupsPclmCompressionMethodPreferred: flate,rle,jpeg
+*OpenUI *PageSize/Media Size: PickOne
+*DefaultPageSize: Letter
+*PageSize Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageSize
+*OpenUI *PageRegion/Media Size: PickOne
+*DefaultPageRegion: Letter
+*PageRegion Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageRegion
+*DefaultImageableArea: Letter
+*ImageableArea Letter: "0 0 612 792"
+*DefaultPaperDimension: Letter
+*PaperDimension Letter: "612 792"
+*OpenUI *Resolution/Resolution: PickOne
+*DefaultResolution: 75dpi
+*Resolution 75dpi/75 DPI: "<</HWResolution[75 75]>>setpagedevice"
+*CloseUI: *Resolution
+*OpenUI *ColorModel/Color Mode: PickOne
+*DefaultColorModel: RGB
+*ColorModel RGB/RGB: "<</cupsColorOrder 0/cupsColorSpace 19/cupsBitsPerColor 8>>setpagedevice"
+*ColorModel Gray/Gray: "<</cupsColorOrder 0/cupsColorSpace 18/cupsBitsPerColor 8>>setpagedevice"
+*ColorModel Mono/Black and White: "<</cupsColorOrder 0/cupsColorSpace 3/cupsBitsPerColor 1>>setpagedevice"
+*CloseUI: *ColorModel
+EOF
+
+status=0
+
+# run_test name OUTFORMAT ColorModel [options]
+run_test()
+{
+    name=$1
+    outformat=$2
+    model=$3
+    options=$4
+
+    PPD="$WORK/test.ppd" "$PDFTORASTER" 1 test test 1 "ColorModel=$model" \
+	"$INPUT" > "$WORK/$name.ras" 2> "$WORK/$name-raster.log" ||
+	{ echo "FAIL: $name: pdftoraster failed"; status=1; return; }
+    PPD="$WORK/test.ppd" OUTFORMAT=$outformat "$RASTERTOPDF" 1 test test 1 \
+	"ColorModel=$model $options" "$WORK/$name.ras" \
+	> "$WORK/$name.out" 2> "$WORK/$name.log"
+    if test $? != 0; then
+	echo "FAIL: $name: rastertopdf failed"
+	cat "$WORK/$name.log"
+	status=1
+    elif grep -q "output format will be PCLM" "$WORK/$name.log" &&
+	! head -n 2 "$WORK/$name.out" | grep -q "^%PCLm"; then
+	echo "FAIL: $name: no PCLm header"
+	status=1
+    elif qpdf --check "$WORK/$name.out" > "$WORK/$name-check.log" 2>&1; then
+	echo "PASS: $name (`head -c 8 "$WORK/$name.out"`)"
+    else
+	echo "FAIL: $name: qpdf --check"
+	cat "$WORK/$name-check.log"
+	status=1
+    fi
+}
+
+for stream in false true; do
+    run_test "pdf-rgb-stream-$stream" pdf RGB "rastertopdf-streaming=$stream"
+    run_test "pdf-mono-stream-$stream" pdf Mono "rastertopdf-streaming=$stream"
+    run_test "pclm-rgb-stream-$stream" pclm RGB "rastertopdf-streaming=$stream"
+    run_test "pclm-gray-stream-$stream" pclm Gray "rastertopdf-streaming=$stream"
+done
+
+# The streaming writer must write as many objects as QPDFWriter, among
+# them an image transform stream for every strip reference of a page,
+# also for the repeated references to a shared white strip
+# objects_written file
+objects_written()
+{
+    grep -a -c '^[0-9]* 0 obj$' "$1"
+}
+
+for model in rgb gray; do
+    qpdfwriter="$WORK/pclm-$model-stream-false.out"
+    streaming="$WORK/pclm-$model-stream-true.out"
+    test -f "$qpdfwriter" && test -f "$streaming" || continue
+    if test "`objects_written "$qpdfwriter"`" = \
+	"`objects_written "$streaming"`"; then
+	echo "PASS: pclm-$model: streaming writes as many objects"
+    else
+	echo "FAIL: pclm-$model: QPDFWriter: `objects_written "$qpdfwriter"`" \
+	    "objects, streaming: `objects_written "$streaming"`"
+	status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,161 @@
+#!/bin/sh
+#
+# Check that gstoraster and mupdftoraster give the same raster output
+# for a duplex job whether or not they leave out the blank pages which
+# pdftopdf marked. The job is 2 collated copies of 3 pages, so there is
+# a blank filler page in the middle (page 4) and one at the end (page 8).
+#
+# Also check that rendering a duplex job of 10 pages with 2 processes
+# gives the same output as with one, the even split would let the second
+# process start with a back side (page 6).
+#
+# Usage: test-render-duplex.sh [pdftopdf [input.pdf]]
+#
+
+PDFTOPDF=${1:-./pdftopdf}
+INPUT=${2:-${srcdir:-.}/filter/test-pdftoraster-repeat.pdf}
+TMPDIR=${TMPDIR:-/tmp}
+
+if test ! -x "$PDFTOPDF"; then
+    echo "SKIP: $PDFTOPDF not found"
+    exit 77
+fi
+
+WORK=`mktemp -d "$TMPDIR/test-render-duplex.XXXXXX"` || exit 1
+trap 'rm -rf "$WORK"' 0 1 2 15
+
+# A minimal duplex PPD, the back sides are flipped by the renderer
+cat > "$WORK/test.ppd" <<'EOF'
+*PPD-Adobe: "4.3"
+*FormatVersion: "4.3"
+*FileVersion: "1.0"
+*LanguageVersion: English
+*LanguageEncoding: ISOLatin1
+*PCFileName: "TEST.PPD"
+*Manufacturer: "Test"
+*Product: "(Test)"
+*ModelName: "duplex test"
+*ShortNickName: "duplex test"
+*NickName: "duplex test"
+*PSVersion: "(3010.000) 0"
+*LanguageLevel: "3"
+*ColorDevice: False
+*DefaultColorSpace: Gray
+*cupsVersion: 1.4
+*cupsManualCopies: True
+*cupsBackSide: Flipped
+*cupsFilter: "application/vnd.cups-raster 0 -"
+*OpenUI *PageSize/Media Size: PickOne
+*DefaultPageSize: Letter
+*PageSize Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageSize
+*OpenUI *PageRegion/Media Size: PickOne
+*DefaultPageRegion: Letter
+*PageRegion Letter/US Letter: "<</PageSize[612 792]/ImagingBBox null>>setpagedevice"
+*CloseUI: *PageRegion
+*DefaultImageableArea: Letter
+*ImageableArea Letter: "18 36 594 756"
+*DefaultPaperDimension: Letter
+*PaperDimension Letter: "612 792"
+*OpenUI *Duplex/2-Sided Printing: PickOne
+*DefaultDuplex: DuplexNoTumble
+*Duplex None/Off: "<</Duplex false>>setpagedevice"
+*Duplex DuplexNoTumble/Long Edge: "<</Duplex true/Tumble false>>setpagedevice"
+*CloseUI: *Duplex
+*OpenUI *Resolution/Resolution: PickOne
+*DefaultResolution: 75dpi
+*Resolution 75dpi/75 DPI: "<</HWResolution[75 75]>>setpagedevice"
+*CloseUI: *Resolution
+*OpenUI *ColorModel/Color Mode: PickOne
+*DefaultColorModel: Gray
+*ColorModel Gray/Gray: "<</cupsColorOrder 0/cupsColorSpace 18/cupsBitsPerColor 8>>setpagedevice"
+*CloseUI: *ColorModel
+EOF
+
+PPD="$WORK/test.ppd" "$PDFTOPDF" 1 test test 2 \
+    "Collate=True Duplex=DuplexNoTumble page-ranges=1-3" "$INPUT" \
+    > "$WORK/job.pdf" 2> "$WORK/pdftopdf.log" ||
+    { echo "FAIL: pdftopdf failed"; cat "$WORK/pdftopdf.log"; exit 1; }
+if ! grep -a -q "^%%PDFTOPDFBlankPages : 4,8" "$WORK/job.pdf"; then
+    echo "FAIL: pdftopdf did not mark pages 4 and 8 as blank"
+    exit 1
+fi
+# The same job without the blank page list, everything gets rendered.
+# The comment keeps its length, the xref offsets stay valid.
+LC_ALL=C sed 's/^%%PDFTOPDFBlankPages/%%PDFTOPDFIgnorePages/' \
+    "$WORK/job.pdf" > "$WORK/all.pdf"
+
+# 10 pages without blank ones
+PPD="$WORK/test.ppd" "$PDFTOPDF" 1 test test 5 \
+    "Collate=True Duplex=None page-ranges=1-2" "$INPUT" \
+    > "$WORK/ten.pdf" 2> "$WORK/pdftopdf-ten.log" ||
+    { echo "FAIL: pdftopdf failed"; cat "$WORK/pdftopdf-ten.log"; exit 1; }
+
+status=0
+skipped=0
+
+# run_test filter options
+run_test()
+{
+    filter=$1
+    options=$2
+
+    if test ! -x "./$filter"; then
+	echo "SKIP: $filter not built"
+	skipped=`expr $skipped + 1`
+	return
+    fi
+    for job in job all; do
+	PPD="$WORK/test.ppd" "./$filter" 1 test test 1 \
+	    "Duplex=DuplexNoTumble $options" "$WORK/$job.pdf" \
+	    > "$WORK/$filter-$job.ras" 2> "$WORK/$filter-$job.log" ||
+	    { echo "FAIL: $filter failed"; cat "$WORK/$filter-$job.log";
+	      status=1; return; }
+    done
+    if ! grep -q "Not rendering 1 blank pages" "$WORK/$filter-job.log"; then
+	echo "FAIL: $filter did not leave out only the last blank page"
+	status=1
+    elif cmp -s "$WORK/$filter-job.ras" "$WORK/$filter-all.ras"; then
+	echo "PASS: $filter"
+    else
+	echo "FAIL: $filter: leaving out blank pages changes the output"
+	status=1
+    fi
+}
+
+# run_parallel_test filter
+run_parallel_test()
+{
+    filter=$1
+
+    if test ! -x "./$filter"; then
+	return
+    fi
+    for processes in 1 2; do
+	PPD="$WORK/test.ppd" "./$filter" 1 test test 1 \
+	    "Duplex=DuplexNoTumble $filter-processes=$processes" \
+	    "$WORK/ten.pdf" > "$WORK/$filter-ten-$processes.ras" \
+	    2> "$WORK/$filter-ten-$processes.log" ||
+	    { echo "FAIL: $filter failed";
+	      cat "$WORK/$filter-ten-$processes.log"; status=1; return; }
+    done
+    if ! grep -q "Rendering 10 pages with 2" "$WORK/$filter-ten-2.log"; then
+	echo "FAIL: $filter did not render with 2 processes"
+	status=1
+    elif cmp -s "$WORK/$filter-ten-1.ras" "$WORK/$filter-ten-2.ras"; then
+	echo "PASS: $filter, 2 processes"
+    else
+	echo "FAIL: $filter: rendering in parallel changes the output"
+	status=1
+    fi
+}
+
+run_test gstoraster
+run_test mupdftoraster
+run_parallel_test gstoraster
+run_parallel_test mupdftoraster
+
+if test $status = 0 && test $skipped = 2; then
+    exit 77
+fi
+exit $status
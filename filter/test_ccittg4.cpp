@@ -0,0 +1,202 @@
+/**
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @brief Round trip test of the CCITT Group 4 encoder, decoding with libtiff
+ * @file test_ccittg4.cpp
+ */
+
+#include <config.h>
+#include "ccittg4.h"
+#include <stdio.h>
+
+#ifndef HAVE_LIBTIFF
+
+int main()
+{
+    fprintf(stderr, "SKIP: no libtiff to decode with\n");
+    return 77;
+}
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <tiff.h>
+#include <tiffio.h>
+
+enum pattern { ALL_WHITE, ALL_BLACK, RANDOM_BITS, RANDOM_RUNS };
+
+static const char *pattern_names[] = {
+    "all white", "all black", "random bits", "random runs"
+};
+
+// Fill an image, set bits are white; the padding bits at the end of
+// each line get random values as the encoder must ignore them
+static void fill(std::vector<unsigned char> &image, unsigned width,
+                 unsigned height, unsigned bpl, pattern p)
+{
+    for (unsigned i = 0; i < image.size(); i ++)
+        image[i] = rand() & 0xff;
+
+    for (unsigned y = 0; y < height; y ++)
+    {
+        unsigned char *line = &image[y * bpl];
+        int color = rand() & 1;
+        unsigned run = 0;
+
+        for (unsigned x = 0; x < width; x ++)
+        {
+            int bit;
+
+            switch (p)
+            {
+                case ALL_WHITE:
+                    bit = 1;
+                    break;
+                case ALL_BLACK:
+                    bit = 0;
+                    break;
+                case RANDOM_BITS:
+                    bit = rand() & 1;
+                    break;
+                default:
+                    // runs up to beyond the longest make-up code
+                    if (run == 0)
+                    {
+                        color = !color;
+                        run = 1 + rand() % ((rand() & 3) ? 70 : 3000);
+                    }
+                    run --;
+                    bit = color;
+                    break;
+            }
+            if (bit)
+                line[x / 8] |= 0x80 >> (x % 8);
+            else
+                line[x / 8] &= ~(0x80 >> (x % 8));
+        }
+    }
+}
+
+// Decode the G4 data with libtiff, set bits are black afterwards
+static bool decode(const std::string &g4, unsigned width, unsigned height,
+                   std::vector<unsigned char> &out)
+{
+    char filename[] = "/tmp/test_ccittg4.XXXXXX";
+    int fd = mkstemp(filename);
+    TIFF *tif;
+    bool ok = false;
+
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return false;
+    }
+    close(fd);
+
+    if ((tif = TIFFOpen(filename, "w")) != NULL)
+    {
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 1);
+        TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, height);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_CCITTFAX4);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISWHITE);
+        TIFFSetField(tif, TIFFTAG_FILLORDER, FILLORDER_MSB2LSB);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        ok = TIFFWriteRawStrip(tif, 0, (void *)g4.data(), g4.size()) >= 0;
+        TIFFClose(tif);
+    }
+
+    if (ok && (tif = TIFFOpen(filename, "r")) != NULL)
+    {
+        out.resize(TIFFStripSize(tif));
+        ok = TIFFReadEncodedStrip(tif, 0, &out[0], out.size()) ==
+            (tmsize_t)out.size();
+        TIFFClose(tif);
+    }
+    else
+        ok = false;
+
+    unlink(filename);
+    return ok;
+}
+
+int main()
+{
+    static const unsigned widths[] = { 1, 7, 13, 100, 1727, 2481, 5103 };
+    static const unsigned height = 37;
+    int failures = 0;
+
+    srand(1);
+    // libtiff warnings about the missing resolution are just noise here
+    TIFFSetWarningHandler(NULL);
+
+    for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); w ++)
+    {
+        for (int p = ALL_WHITE; p <= RANDOM_RUNS; p ++)
+        {
+            unsigned width = widths[w];
+            unsigned bpl = (width + 7) / 8;
+            // with a spare byte at the end of each line
+            std::vector<unsigned char> image((bpl + 1) * height), decoded;
+
+            fill(image, width, height, bpl + 1, (pattern)p);
+
+            std::string g4 = ccittG4Encode(&image[0], width, height, bpl + 1);
+
+            if (!decode(g4, width, height, decoded) ||
+                decoded.size() != bpl * height)
+            {
+                printf("FAIL: %s, width %u: libtiff cannot decode\n",
+                       pattern_names[p], width);
+                failures ++;
+                continue;
+            }
+
+            unsigned y, x = 0;
+
+            for (y = 0; y < height; y ++)
+            {
+                for (x = 0; x < width; x ++)
+                {
+                    int white = (image[y * (bpl + 1) + x / 8] >> (7 - x % 8)) & 1;
+                    int black = (decoded[y * bpl + x / 8] >> (7 - x % 8)) & 1;
+
+                    if (white == black)
+                        break;
+                }
+                if (x < width)
+                    break;
+            }
+
+            if (y < height)
+            {
+                printf("FAIL: %s, width %u: line %u differs at pixel %u\n",
+                       pattern_names[p], width, y, x);
+                failures ++;
+            }
+            else
+                printf("PASS: %s, width %u (%u bytes)\n", pattern_names[p],
+                       width, (unsigned)g4.size());
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+#endif
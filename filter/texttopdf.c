@@ -18,6 +18,8 @@
  *   WriteProlog()   - Write the PDF file prolog with options.
  *   write_line()    - Write a row of text.
  *   write_string()  - Write a string of text.
+ *   content_printf() - Add formatted text to the page content.
+ *   content_hex()   - Add a number in hex to the page content.
  */
 
 /*
@@ -26,10 +28,12 @@
 
 #include "textcommon.h"
 #include "pdfutils.h"
+#include "fontcache.h"
 #include "fontembed/embed.h"
 #include <assert.h>
 #include "fontembed/sfnt.h"
-#include <fontconfig/fontconfig.h>
+#include <stdarg.h>
+#include <zlib.h>
 
 /*
  * Globals...
@@ -45,47 +49,12 @@ EMB_PARAMS *font_load(const char *font)
 {
   OTF_FILE *otf;
 
-  FcPattern *pattern;
-  FcFontSet *candidates;
-  FcChar8   *fontname = NULL;
-  FcResult   result;
-  int i;
+  char *fontname = NULL;
 
   if ( (font[0]=='/')||(font[0]=='.') ) {
-    candidates = NULL;
-    fontname=(FcChar8 *)strdup(font);
+    fontname=strdup(font);
   } else {
-    FcInit ();
-    pattern = FcNameParse ((const FcChar8 *)font);
-    FcPatternAddInteger (pattern, FC_SPACING, FC_MONO); // guide fc, in case substitution becomes necessary
-    FcConfigSubstitute (0, pattern, FcMatchPattern);
-    FcDefaultSubstitute (pattern);
-
-    /* Receive a sorted list of fonts matching our pattern */
-    candidates = FcFontSort (0, pattern, FcFalse, 0, &result);
-    FcPatternDestroy (pattern);
-
-    if (candidates) {
-      /* In the list of fonts returned by FcFontSort()
-	 find the first one that is both in TrueType format and monospaced */
-      for (i = 0; i < candidates->nfont; i++) {
-	FcChar8 *fontformat=NULL; // TODO? or just try?
-	int spacing=0; // sane default, as FC_MONO == 100
-	FcPatternGetString  (candidates->fonts[i], FC_FONTFORMAT, 0, &fontformat);
-	FcPatternGetInteger (candidates->fonts[i], FC_SPACING,    0, &spacing);
-
-	if ( (fontformat)&&(spacing == FC_MONO) ) {
-	  if (strcmp((const char *)fontformat, "TrueType") == 0) {
-	    fontname = FcPatternFormat (candidates->fonts[i], (const FcChar8 *)"%{file|cescape}/%{index}");
-	    break;
-	  } else if (strcmp((const char *)fontformat, "CFF") == 0) {
-	    fontname = FcPatternFormat (candidates->fonts[i], (const FcChar8 *)"%{file|cescape}"); // TTC only possible with non-cff glyphs!
-	    break;
-	  }
-	}
-      }
-      FcFontSetDestroy (candidates);
-    }
+    fontname=fontcache_resolve(font);
   }
 
   if (!fontname) {
@@ -94,7 +63,7 @@ EMB_PARAMS *font_load(const char *font)
     return NULL;
   }
 
-  otf = otf_load((const char *)fontname);
+  otf = otf_load(fontname);
   free(fontname);
   if (!otf) {
     return NULL;
@@ -146,6 +115,20 @@ static void	write_string(int col, int row, int len, lchar_t *s);
 static lchar_t *make_wide(const char *buf);
 static void     write_font_str(float x,float y,int fontid, lchar_t *str, int len);
 static void     write_pretty_header();
+static void     content_printf(const char *fmt,...)
+  __attribute__((format(printf, 1, 2)));
+static void     content_hex(unsigned int val,int digits);
+
+
+/*
+ * The content stream of a page is collected in a buffer, so that it can be
+ * compressed and written with its length known.
+ */
+
+static char	*Content = NULL;	/* Content of the current page */
+static size_t	ContentLen = 0,		/* Bytes used */
+		ContentAlloc = 0;	/* Bytes allocated */
+static char	*FontSetup[256][4];	/* Tz/Tf operators of each font */
 
 
 /*
@@ -222,14 +205,8 @@ WritePage(void)
 {
   int	line;			/* Current line */
 
-  int content=pdfOut_add_xref(pdf);
-  pdfOut_printf(pdf,"%d 0 obj\n"
-                    "<</Length %d 0 R\n"
-                    ">>\n"
-                    "stream\n"
-                    "q\n"
-                    ,content,content+1);
-  long size=-(pdf->filepos-2);
+  ContentLen=0;
+  content_printf("q\n");
 
   NumPages ++;
   if (PrettyPrint)
@@ -238,17 +215,32 @@ WritePage(void)
   for (line = 0; line < SizeLines; line ++)
     write_line(line, Page[line]);
 
-  size+=pdf->filepos+2;
-  pdfOut_printf(pdf,"Q\n"
-                    "endstream\n"
+  content_printf("Q\n");
+
+  uLongf complen=compressBound(ContentLen);
+  Bytef *comp=malloc(complen);
+
+  int content=pdfOut_add_xref(pdf);
+  if ( (comp)&&(compress2(comp,&complen,(const Bytef *)Content,ContentLen,
+                          Z_DEFAULT_COMPRESSION)==Z_OK) ) {
+    pdfOut_printf(pdf,"%d 0 obj\n"
+                      "<</Length %lu\n"
+                      "  /Filter /FlateDecode\n"
+                      ">>\n"
+                      "stream\n"
+                      ,content,(unsigned long)complen);
+    pdfOut_write(pdf,(const char *)comp,complen);
+  } else { // write it uncompressed
+    pdfOut_printf(pdf,"%d 0 obj\n"
+                      "<</Length %lu\n"
+                      ">>\n"
+                      "stream\n"
+                      ,content,(unsigned long)ContentLen);
+    pdfOut_write(pdf,Content,ContentLen);
+  }
+  free(comp);
+  pdfOut_printf(pdf,"\nendstream\n"
                     "endobj\n");
-  
-  int len_obj=pdfOut_add_xref(pdf);
-  assert(len_obj==content+1);
-  pdfOut_printf(pdf,"%d 0 obj\n"
-                    "%ld\n"
-                    "endobj\n",
-                    len_obj,size);
 
   int obj=pdfOut_add_xref(pdf);
   pdfOut_printf(pdf,"%d 0 obj\n"
@@ -1043,7 +1035,7 @@ write_string(int     col,	/* I - Start column */
     y -= 36.0 / (float)LinesPerInch;
 
   if (attr & ATTR_UNDERLINE)
-    pdfOut_printf(pdf,"q 0.5 w 0 g %.3f %.3f m %.3f %.3f l S Q ",
+    content_printf("q 0.5 w 0 g %.3f %.3f m %.3f %.3f l S Q ",
                       x, y - 6.8 / LinesPerInch,
                       x + (float)len * 72.0 / (float)CharsPerInch,
                       y - 6.8 / LinesPerInch);
@@ -1052,22 +1044,22 @@ write_string(int     col,	/* I - Start column */
   {
     if (ColorDevice) {
       if (attr & ATTR_RED)
-        pdfOut_printf(pdf,"0.5 0 0 rg\n");
+        content_printf("0.5 0 0 rg\n");
       else if (attr & ATTR_GREEN)
-        pdfOut_printf(pdf,"0 0.5 0 rg\n");
+        content_printf("0 0.5 0 rg\n");
       else if (attr & ATTR_BLUE)
-        pdfOut_printf(pdf,"0 0 0.5 rg\n");
+        content_printf("0 0 0.5 rg\n");
       else
-        pdfOut_printf(pdf,"0 g\n");
+        content_printf("0 g\n");
     } else {
       if ( (attr & ATTR_RED)||(attr & ATTR_GREEN)||(attr & ATTR_BLUE) )
-        pdfOut_printf(pdf,"0.2 g\n");
+        content_printf("0.2 g\n");
       else
-        pdfOut_printf(pdf,"0 g\n");
+        content_printf("0 g\n");
     }
   }
   else
-    pdfOut_printf(pdf,"0 g\n");
+    content_printf("0 g\n");
   
   write_font_str(x,y,attr & ATTR_FONT,s,len);
 }
@@ -1083,17 +1075,17 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
   if (len==-1) {
     for (len=0;str[len].ch;len++);
   }
-  pdfOut_printf(pdf,"BT\n");
+  content_printf("BT\n");
 
   if (x == (int)x)
-    pdfOut_printf(pdf,"  %.0f ", x);
+    content_printf("  %.0f ", x);
   else
-    pdfOut_printf(pdf,"  %.3f ", x);
+    content_printf("  %.3f ", x);
 
   if (y == (int)y)
-    pdfOut_printf(pdf,"%.0f Td\n", y);
+    content_printf("%.0f Td\n", y);
   else
-    pdfOut_printf(pdf,"%.3f Td\n", y);
+    content_printf("%.3f Td\n", y);
 
   int lastfont,font;
 
@@ -1111,17 +1103,21 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
     EMB_PARAMS *emb=Fonts[lastfont][fontid];
     OTF_FILE *otf=emb->font->sfnt;
 
-    if (otf) { // TODO?
-      pdfOut_printf(pdf,"  %.3f Tz\n",
-                        FontScaleX*600.0/(otf_get_width(otf,4)*1000.0/otf->unitsPerEm)*100.0/FontScaleY); // TODO? 
-      // gid==4 is usually '!', the char after space. We just need "the" width for the monospaced font. gid==0 is bad, and space might also be bad.
-    } else {
-      pdfOut_printf(pdf,"  %.3f Tz\n",
-                        FontScaleX*100.0/FontScaleY); // TODO?
+    if (!FontSetup[lastfont][fontid]) {
+      float tz;
+      char tmp[100];
+      if (otf) { // TODO?
+        tz=FontScaleX*600.0/(otf_get_width(otf,4)*1000.0/otf->unitsPerEm)*100.0/FontScaleY; // TODO?
+        // gid==4 is usually '!', the char after space. We just need "the" width for the monospaced font. gid==0 is bad, and space might also be bad.
+      } else {
+        tz=FontScaleX*100.0/FontScaleY; // TODO?
+      }
+      snprintf(tmp,sizeof(tmp),"  %.3f Tz\n"
+                               "  /%s%02x %.3f Tf <",
+                               tz,names[fontid],lastfont,FontScaleY);
+      FontSetup[lastfont][fontid]=strdup(tmp);
     }
-
-    pdfOut_printf(pdf,"  /%s%02x %.3f Tf <",
-                      names[fontid],lastfont,FontScaleY);
+    content_printf("%s",FontSetup[lastfont][fontid]);
 
     while (len > 0)
     {
@@ -1137,18 +1133,18 @@ static void write_font_str(float x,float y,int fontid, lchar_t *str, int len)
       }
       if (otf) { // TODO 
         const unsigned short gid=emb_get(emb,ch);
-        pdfOut_printf(pdf,"%04x", gid);
+        content_hex(gid,4);
       } else { // std 14 font with 7-bit us-ascii uses single byte encoding, TODO
-        pdfOut_printf(pdf,"%02x",ch);
+        content_hex(ch,2);
       }
 
       len --;
       str ++;
     }
 
-    pdfOut_printf(pdf,"> Tj\n");
+    content_printf("> Tj\n");
   }
-  pdfOut_printf(pdf,"ET\n");
+  content_printf("ET\n");
 }
 // }}}
 
@@ -1164,7 +1160,7 @@ static float stringwidth_x(lchar_t *str)
 static void write_pretty_header() // {{{
 {
   float x,y;
-  pdfOut_printf(pdf,"q\n"
+  content_printf("q\n"
                     "0.9 g\n");
 
   if (Duplex && (NumPages & 1) == 0) {
@@ -1175,10 +1171,10 @@ static void write_pretty_header() // {{{
     y = PageTop + 72.0f / LinesPerInch;
   }
 
-  pdfOut_printf(pdf,"1 0 0 1 %.3f %.3f cm\n",x,y); // translate
-  pdfOut_printf(pdf,"0 0 %.3f %.3f re f\n",
+  content_printf("1 0 0 1 %.3f %.3f cm\n",x,y); // translate
+  content_printf("0 0 %.3f %.3f re f\n",
                     PageRight - PageLeft, 144.0f / LinesPerInch);
-  pdfOut_printf(pdf,"0 g 0 G\n");
+  content_printf("0 g 0 G\n");
 
   if (Duplex && (NumPages & 1) == 0) {
       x = PageRight - PageLeft - 36.0f / LinesPerInch - stringwidth_x(Title);
@@ -1206,7 +1202,56 @@ static void write_pretty_header() // {{{
   write_font_str(x,y,ATTR_BOLD,pagestr,-1);
   free(pagestr);
 
-  pdfOut_printf(pdf,"Q\n");
+  content_printf("Q\n");
+}
+// }}}
+
+/*
+ * 'content_printf()' - Add formatted text to the page content.
+ */
+
+static void
+content_printf(const char *fmt,...) // {{{
+{
+  va_list	ap;
+  int		len;
+
+  for (;;) {
+    va_start(ap,fmt);
+    len=vsnprintf(Content+ContentLen,ContentAlloc-ContentLen,fmt,ap);
+    va_end(ap);
+    assert(len>=0);
+    if (ContentLen+len<ContentAlloc) { // incl. '\0'
+      break;
+    }
+    ContentAlloc=(ContentAlloc+len)*2+4096;
+    Content=realloc(Content,ContentAlloc);
+    assert(Content);
+  }
+  ContentLen+=len;
 }
 // }}}
 
+/*
+ * 'content_hex()' - Add a number in hex to the page content.
+ */
+
+static void
+content_hex(unsigned int val,	/* I - Value */
+            int digits)		/* I - Number of hex digits */
+{
+  static const char hexdigits[]="0123456789abcdef";
+  char *p;
+
+  if (ContentLen+digits>=ContentAlloc) {
+    ContentAlloc=ContentAlloc*2+4096;
+    Content=realloc(Content,ContentAlloc);
+    assert(Content);
+  }
+  p=Content+ContentLen+digits;
+  ContentLen+=digits;
+  while (digits--) {
+    *--p=hexdigits[val&15];
+    val>>=4;
+  }
+}
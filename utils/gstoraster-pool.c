@@ -0,0 +1,914 @@
+/***
+  This file is part of cups-filters.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This file is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with cups-filters; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+  USA.
+***/
+
+/*
+ * gstoraster-pool keeps Ghostscript processes started and initialized
+ * (init files, fonts, ICC profiles, output device), waiting for their
+ * input on stdin, so that gstoraster does not have to wait for the start
+ * of Ghostscript. A Ghostscript process can only be used for a job with
+ * exactly the same command line, and only once, so for each command line
+ * asked for by gstoraster, one process is started ahead for the next job.
+ * It runs with the environment, nice value and resource limits of the job
+ * which asked for it, and is only handed over to jobs with the same ones.
+ * See gstoraster-pool.h for the protocol.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "gstoraster-pool.h"
+
+typedef struct gs_instance_s {
+  struct gs_instance_s *next;
+  gs_pool_request_t req;		/* Request it was started for */
+  char		*data;			/* Command line without argv[0] and
+					   environment, as in the request */
+  pid_t		pid;
+  int		in_fd,			/* Ghostscript's stdin, -1 when handed
+					   over to the client */
+		out_fd,			/* Ghostscript's stdout, ditto */
+		err_fd;			/* Ghostscript's stderr, -1 on EOF */
+  int		client_fd,		/* Connection to the client, -1 while
+					   waiting for a job */
+		client_err_fd;		/* Client's stderr */
+  int		exited,			/* Ghostscript has finished */
+		status;			/* Exit status from waitpid() */
+  int		killed;
+  time_t	started;
+} gs_instance_t;
+
+/* Connection of a client whose request is not complete yet */
+typedef struct gs_client_s {
+  struct gs_client_s *next;
+  int		fd,
+		err_fd;			/* Client's stderr, -1 until received */
+  gs_pool_request_t req;
+  char		*data;			/* Command line and environment */
+  size_t	got;			/* Bytes received of request and data */
+  time_t	connected;
+} gs_client_t;
+
+static const int	limit_resources[GS_POOL_NUM_LIMITS] = GS_POOL_LIMITS;
+static gs_instance_t	*instances = NULL;
+static gs_client_t	*clients = NULL;
+static int		debug = 0;
+static int		max_idle = 2;
+static int		idle_timeout = 300;
+static const char	*gs_path = CUPS_GHOSTSCRIPT;
+static int		sigchld_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t terminating = 0;
+
+static void
+log_printf(int is_debug, const char *format, ...)
+{
+  va_list ap;
+
+  if (is_debug && !debug)
+    return;
+  fprintf(stderr, "gstoraster-pool: ");
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+}
+
+static void
+sigchld_handler(int sig)
+{
+  int saved_errno = errno;
+
+  (void)sig;
+  if (write(sigchld_pipe[1], "C", 1) < 0) {
+    /* Pipe full, there is a wakeup pending anyway */
+  }
+  errno = saved_errno;
+}
+
+static void
+sigterm_handler(int sig)
+{
+  (void)sig;
+  terminating = 1;
+}
+
+static void
+set_cloexec(int fd)
+{
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/* Ghostscript started and waiting for a job */
+static int
+is_idle(gs_instance_t *inst)
+{
+  return (inst->in_fd >= 0 && !inst->exited && !inst->killed);
+}
+
+static int
+num_idle(void)
+{
+  gs_instance_t *inst;
+  int n = 0;
+
+  for (inst = instances; inst; inst = inst->next)
+    if (is_idle(inst))
+      n ++;
+  return (n);
+}
+
+static size_t
+data_len(const gs_pool_request_t *req)
+{
+  return ((size_t)req->length + req->env_length);
+}
+
+/* Same command line, environment, nice value and resource limits */
+static int
+same_job_setup(const gs_pool_request_t *a, const char *a_data,
+	       const gs_pool_request_t *b, const char *b_data)
+{
+  int i;
+
+  if (a->length != b->length || a->env_length != b->env_length ||
+      a->nice != b->nice)
+    return (0);
+  for (i = 0; i < GS_POOL_NUM_LIMITS; i ++)
+    if (a->limits[i].rlim_cur != b->limits[i].rlim_cur ||
+	a->limits[i].rlim_max != b->limits[i].rlim_max)
+      return (0);
+  return (!memcmp(a_data, b_data, data_len(a)));
+}
+
+static gs_instance_t *
+find_idle(const gs_pool_request_t *req, const char *data)
+{
+  gs_instance_t *inst;
+
+  for (inst = instances; inst; inst = inst->next)
+    if (is_idle(inst) && same_job_setup(&inst->req, inst->data, req, data))
+      return (inst);
+  return (NULL);
+}
+
+/*
+ * We can only start Ghostscript with the nice value and resource limits
+ * of the job if they are not below our own ones
+ */
+static int
+can_apply_limits(const gs_pool_request_t *req)
+{
+  struct rlimit rl;
+  int i;
+
+  errno = 0;
+  if (req->nice < getpriority(PRIO_PROCESS, 0) && errno == 0)
+    return (0);
+  for (i = 0; i < GS_POOL_NUM_LIMITS; i ++)
+    if (getrlimit(limit_resources[i], &rl) ||
+	req->limits[i].rlim_max > rl.rlim_max ||
+	req->limits[i].rlim_cur > req->limits[i].rlim_max)
+      return (0);
+  return (1);
+}
+
+static void
+remove_instance(gs_instance_t *inst)
+{
+  gs_instance_t **p;
+
+  for (p = &instances; *p; p = &(*p)->next)
+    if (*p == inst) {
+      *p = inst->next;
+      break;
+    }
+  if (inst->in_fd >= 0)
+    close(inst->in_fd);
+  if (inst->out_fd >= 0)
+    close(inst->out_fd);
+  if (inst->err_fd >= 0)
+    close(inst->err_fd);
+  if (inst->client_fd >= 0)
+    close(inst->client_fd);
+  if (inst->client_err_fd >= 0)
+    close(inst->client_err_fd);
+  free(inst->data);
+  free(inst);
+}
+
+static void
+kill_instance(gs_instance_t *inst)
+{
+  if (!inst->exited && !inst->killed) {
+    kill(inst->pid, SIGTERM);
+    inst->killed = 1;
+  }
+}
+
+/*
+ * Split NUL-terminated strings into a NULL-terminated array, with room for
+ * "first" more entries at the beginning
+ */
+static char **
+split_strings(const char *data, size_t len, int first)
+{
+  char **array;
+  const char *p;
+  int n;
+
+  for (n = first, p = data; p < data + len; p += strlen(p) + 1)
+    n ++;
+  if ((array = calloc(n + 1, sizeof(char *))) == NULL)
+    return (NULL);
+  for (n = first, p = data; p < data + len; p += strlen(p) + 1)
+    array[n ++] = (char *)p;
+  return (array);
+}
+
+/*
+ * Start a Ghostscript process with the command line, environment, nice
+ * value and resource limits of the request, it initializes and then waits
+ * for the job on stdin.
+ */
+static gs_instance_t *
+start_instance(const gs_pool_request_t *req, const char *data)
+{
+  gs_instance_t *inst;
+  int in[2], out[2], err[2];
+  char **argv, **envp;
+  int i;
+
+  if ((argv = split_strings(data, req->length, 1)) == NULL)
+    return (NULL);
+  argv[0] = (char *)gs_path;
+  if ((envp = split_strings(data + req->length, req->env_length, 0)) ==
+      NULL) {
+    free(argv);
+    return (NULL);
+  }
+
+  if (pipe(in)) {
+    free(argv);
+    free(envp);
+    return (NULL);
+  }
+  if (pipe(out)) {
+    close(in[0]); close(in[1]);
+    free(argv);
+    free(envp);
+    return (NULL);
+  }
+  if (pipe(err)) {
+    close(in[0]); close(in[1]);
+    close(out[0]); close(out[1]);
+    free(argv);
+    free(envp);
+    return (NULL);
+  }
+  set_cloexec(in[1]);
+  set_cloexec(out[0]);
+  set_cloexec(err[0]);
+
+  if ((inst = calloc(1, sizeof(gs_instance_t))) == NULL ||
+      (inst->data = malloc(data_len(req))) == NULL ||
+      (inst->pid = fork()) < 0) {
+    log_printf(0, "Unable to start Ghostscript: %s\n", strerror(errno));
+    if (inst)
+      free(inst->data);
+    free(inst);
+    close(in[0]); close(in[1]);
+    close(out[0]); close(out[1]);
+    close(err[0]); close(err[1]);
+    free(argv);
+    free(envp);
+    return (NULL);
+  }
+
+  if (inst->pid == 0) {
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    dup2(err[1], 2);
+    close(in[0]);
+    close(out[1]);
+    close(err[1]);
+    if (setpriority(PRIO_PROCESS, 0, req->nice)) {
+      fprintf(stderr, "ERROR: Unable to set nice value %d: %s\n", req->nice,
+	      strerror(errno));
+      _exit(1);
+    }
+    for (i = 0; i < GS_POOL_NUM_LIMITS; i ++)
+      if (setrlimit(limit_resources[i], &req->limits[i])) {
+	fprintf(stderr, "ERROR: Unable to set resource limit: %s\n",
+		strerror(errno));
+	_exit(1);
+      }
+    execvpe(gs_path, argv, envp);
+    fprintf(stderr, "ERROR: Unable to launch Ghostscript: %s: %s\n",
+	    gs_path, strerror(errno));
+    _exit(1);
+  }
+
+  close(in[0]);
+  close(out[1]);
+  close(err[1]);
+  fcntl(err[0], F_SETFL, fcntl(err[0], F_GETFL) | O_NONBLOCK);
+  free(argv);
+  free(envp);
+
+  inst->req = *req;
+  memcpy(inst->data, data, data_len(req));
+  inst->in_fd = in[1];
+  inst->out_fd = out[0];
+  inst->err_fd = err[0];
+  inst->client_fd = -1;
+  inst->client_err_fd = -1;
+  inst->started = time(NULL);
+  inst->next = instances;
+  instances = inst;
+  log_printf(1, "Started Ghostscript (PID %d)\n", (int)inst->pid);
+  return (inst);
+}
+
+/*
+ * Have a Ghostscript for this request ready for the next job, if needed
+ * making room by stopping the one waiting the longest.
+ */
+static void
+start_ahead(const gs_pool_request_t *req, const char *data)
+{
+  gs_instance_t *inst, *oldest;
+
+  if (max_idle <= 0 || find_idle(req, data))
+    return;
+  if (num_idle() >= max_idle) {
+    oldest = NULL;
+    for (inst = instances; inst; inst = inst->next)
+      if (is_idle(inst) &&
+	  (oldest == NULL || inst->started <= oldest->started))
+	oldest = inst;
+    if (oldest == NULL)
+      return;
+    log_printf(1, "Stopping unused Ghostscript (PID %d)\n", (int)oldest->pid);
+    kill_instance(oldest);
+  }
+  start_instance(req, data);
+}
+
+/*
+ * Send the exit status to the client, once Ghostscript has finished and
+ * all its error output is copied.
+ */
+static void
+check_finished(gs_instance_t *inst)
+{
+  if (!inst->exited || inst->err_fd >= 0)
+    return;
+  if (inst->client_fd >= 0) {
+    log_printf(1, "Ghostscript (PID %d) finished with status %d\n",
+	       (int)inst->pid, inst->status);
+    if (write(inst->client_fd, &inst->status, sizeof(inst->status)) !=
+	sizeof(inst->status))
+      log_printf(1, "Unable to send exit status: %s\n", strerror(errno));
+  } else if (inst->in_fd >= 0 && !inst->killed)
+    log_printf(0, "Ghostscript (PID %d) exited while waiting for a job\n",
+	       (int)inst->pid);
+  remove_instance(inst);
+}
+
+static void
+reap_children(void)
+{
+  gs_instance_t *inst, *next;
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    for (inst = instances; inst; inst = next) {
+      next = inst->next;
+      if (inst->pid == pid) {
+	inst->exited = 1;
+	inst->status = status;
+	check_finished(inst);
+	break;
+      }
+    }
+}
+
+/*
+ * Copy Ghostscript's error output to the client, or throw it away while
+ * Ghostscript is waiting for a job
+ */
+static void
+copy_error_output(gs_instance_t *inst)
+{
+  char buf[4096];
+  ssize_t n;
+
+  while ((n = read(inst->err_fd, buf, sizeof(buf))) > 0) {
+    if (inst->client_err_fd >= 0) {
+      if (write(inst->client_err_fd, buf, n) < 0) {
+	close(inst->client_err_fd);
+	inst->client_err_fd = -1;
+      }
+    } else if (debug)
+      fwrite(buf, 1, n, stderr);
+  }
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    close(inst->err_fd);
+    inst->err_fd = -1;
+    check_finished(inst);
+  }
+}
+
+static int
+send_reply(int fd, char reply, gs_instance_t *inst)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  int fds[2];
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &reply;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (inst) {
+    fds[0] = inst->in_fd;
+    fds[1] = inst->out_fd;
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  }
+  return (sendmsg(fd, &msg, 0) == 1 ? 0 : -1);
+}
+
+static void
+remove_client(gs_client_t *client, int close_fds)
+{
+  gs_client_t **p;
+
+  for (p = &clients; *p; p = &(*p)->next)
+    if (*p == client) {
+      *p = client->next;
+      break;
+    }
+  if (close_fds) {
+    close(client->fd);
+    if (client->err_fd >= 0)
+      close(client->err_fd);
+  }
+  free(client->data);
+  free(client);
+}
+
+/*
+ * Take a new connection, its request is read in the main loop as it comes
+ * in, so that a slow client does not hold up the others
+ */
+static void
+accept_client(int fd)
+{
+  gs_client_t *client;
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  /* Only accept our own user (the one running the filters) and root */
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+      (cred.uid != getuid() && cred.uid != 0)) {
+    log_printf(0, "Rejecting connection from UID %d\n", (int)cred.uid);
+    close(fd);
+    return;
+  }
+#endif /* SO_PEERCRED */
+
+  if ((client = calloc(1, sizeof(gs_client_t))) == NULL) {
+    close(fd);
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  client->fd = fd;
+  client->err_fd = -1;
+  client->connected = time(NULL);
+  client->next = clients;
+  clients = client;
+}
+
+/*
+ * Read what has arrived of the request of a client, returns 1 when it is
+ * complete, 0 when more is to come and -1 on error
+ */
+static int
+read_request(gs_client_t *client)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  size_t total;
+  ssize_t n;
+
+  if (client->got < sizeof(client->req)) {
+    /* The request itself, with the client's stderr */
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = (char *)&client->req + client->got;
+    iov.iov_len = sizeof(client->req) - client->got;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if ((n = recvmsg(client->fd, &msg, 0)) < 0)
+      return ((errno == EAGAIN || errno == EINTR) ? 0 : -1);
+    if (n == 0)
+      return (-1);
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	  cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+	if (client->err_fd >= 0)
+	  close(client->err_fd);
+	memcpy(&client->err_fd, CMSG_DATA(cmsg), sizeof(int));
+	set_cloexec(client->err_fd);
+      }
+    client->got += n;
+    if (client->got < sizeof(client->req))
+      return (0);
+    if (client->req.magic != GS_POOL_MAGIC || client->req.length == 0 ||
+	client->req.length > GS_POOL_MAX_ARGS_LEN ||
+	client->req.env_length > GS_POOL_MAX_ENV_LEN || client->err_fd < 0 ||
+	(client->data = malloc(data_len(&client->req))) == NULL)
+      return (-1);
+    return (0);
+  }
+
+  /* Command line and environment */
+  total = sizeof(client->req) + data_len(&client->req);
+  n = read(client->fd, client->data + client->got - sizeof(client->req),
+	   total - client->got);
+  if (n < 0)
+    return ((errno == EAGAIN || errno == EINTR) ? 0 : -1);
+  if (n == 0)
+    return (-1);
+  client->got += n;
+  if (client->got < total)
+    return (0);
+  if (client->data[client->req.length - 1] != '\0' ||
+      (client->req.env_length > 0 &&
+       client->data[data_len(&client->req) - 1] != '\0'))
+    return (-1);
+  return (1);
+}
+
+/*
+ * Hand over a waiting Ghostscript for the complete request of a client,
+ * if there is one with the same command line, environment and limits
+ */
+static void
+handle_request(gs_client_t *client)
+{
+  gs_instance_t *inst;
+
+  if (!can_apply_limits(&client->req)) {
+    log_printf(1, "Cannot run Ghostscript with the nice value and resource "
+	       "limits of the job\n");
+    send_reply(client->fd, GS_POOL_NONE, NULL);
+    remove_client(client, 1);
+    return;
+  }
+
+  if ((inst = find_idle(&client->req, client->data)) == NULL) {
+    log_printf(1, "No Ghostscript waiting for this command line and "
+	       "environment\n");
+    send_reply(client->fd, GS_POOL_NONE, NULL);
+    start_ahead(&client->req, client->data);
+    remove_client(client, 1);
+    return;
+  }
+  if (send_reply(client->fd, GS_POOL_READY, inst)) {
+    log_printf(1, "Invalid request\n");
+    remove_client(client, 1);
+    return;
+  }
+  log_printf(1, "Handing over Ghostscript (PID %d)\n", (int)inst->pid);
+  close(inst->in_fd);
+  close(inst->out_fd);
+  inst->in_fd = -1;
+  inst->out_fd = -1;
+  inst->client_fd = client->fd;
+  inst->client_err_fd = client->err_fd;
+  start_ahead(&client->req, client->data);
+  remove_client(client, 0);
+}
+
+static int
+open_socket(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    log_printf(0, "Socket path too long: %s\n", path);
+    return (-1);
+  }
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    log_printf(0, "Unable to create socket: %s\n", strerror(errno));
+    return (-1);
+  }
+  set_cloexec(fd);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      chmod(path, 0600) || listen(fd, 16)) {
+    log_printf(0, "Unable to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return (-1);
+  }
+  return (fd);
+}
+
+static void
+usage(void)
+{
+  printf("Usage: gstoraster-pool [-d] [-n processes] [-t timeout] "
+	 "[-s socket] [-g gs] [-u user]\n"
+	 "  -d             Debug output\n"
+	 "  -n processes   Number of waiting Ghostscript processes (%d)\n"
+	 "  -t timeout     Stop a waiting Ghostscript after this many\n"
+	 "                 seconds (%d)\n"
+	 "  -s socket      Socket for gstoraster (%s)\n"
+	 "  -g gs          Ghostscript executable (%s)\n"
+	 "  -u user        User to run as when started as root (lp)\n",
+	 max_idle, idle_timeout, GS_POOL_SOCKET, gs_path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *socket_path = GS_POOL_SOCKET,
+	     *user = "lp";
+  struct sigaction sa;
+  struct pollfd *fds = NULL;
+  gs_instance_t **fd_inst = NULL, *inst, *next;
+  gs_client_t **fd_client = NULL, *client, *next_client;
+  struct passwd *pw;
+  int listen_fd, nfds, i, c, fd;
+  time_t now;
+
+  while ((c = getopt(argc, argv, "dn:t:s:g:u:h")) != -1)
+    switch (c) {
+    case 'd':
+      debug = 1;
+      break;
+    case 'n':
+      max_idle = atoi(optarg);
+      break;
+    case 't':
+      idle_timeout = atoi(optarg);
+      break;
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'g':
+      gs_path = optarg;
+      break;
+    case 'u':
+      user = optarg;
+      break;
+    case 'h':
+      usage();
+      return (0);
+    default:
+      usage();
+      return (1);
+    }
+
+  if ((listen_fd = open_socket(socket_path)) < 0)
+    return (1);
+
+  /* Never run Ghostscript as root */
+  if (getuid() == 0) {
+    if ((pw = getpwnam(user)) == NULL) {
+      log_printf(0, "Unknown user %s\n", user);
+      unlink(socket_path);
+      return (1);
+    }
+    if (chown(socket_path, pw->pw_uid, pw->pw_gid) ||
+	setgid(pw->pw_gid) || initgroups(pw->pw_name, pw->pw_gid) ||
+	setuid(pw->pw_uid)) {
+      log_printf(0, "Unable to switch to user %s: %s\n", user,
+		 strerror(errno));
+      unlink(socket_path);
+      return (1);
+    }
+  }
+
+  if (pipe(sigchld_pipe)) {
+    log_printf(0, "Unable to create pipe: %s\n", strerror(errno));
+    return (1);
+  }
+  set_cloexec(sigchld_pipe[0]);
+  set_cloexec(sigchld_pipe[1]);
+  fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+  sa.sa_handler = sigchld_handler;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+  sa.sa_handler = sigterm_handler;
+  sa.sa_flags = 0;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  log_printf(1, "Listening on %s\n", socket_path);
+
+  while (!terminating) {
+    /* Our socket, the SIGCHLD pipe, the error output and client
+       connection of each Ghostscript, and the clients still sending their
+       requests */
+    nfds = 2;
+    for (inst = instances; inst; inst = inst->next)
+      nfds += 2;
+    for (client = clients; client; client = client->next)
+      nfds ++;
+    fds = realloc(fds, nfds * sizeof(struct pollfd));
+    fd_inst = realloc(fd_inst, nfds * sizeof(gs_instance_t *));
+    fd_client = realloc(fd_client, nfds * sizeof(gs_client_t *));
+    if (fds == NULL || fd_inst == NULL || fd_client == NULL) {
+      log_printf(0, "Out of memory\n");
+      break;
+    }
+    fds[0].fd = listen_fd;
+    fds[1].fd = sigchld_pipe[0];
+    nfds = 2;
+    for (inst = instances; inst; inst = inst->next) {
+      if (inst->err_fd >= 0) {
+	fd_inst[nfds] = inst;
+	fd_client[nfds] = NULL;
+	fds[nfds ++].fd = inst->err_fd;
+      }
+      if (inst->client_fd >= 0) {
+	fd_inst[nfds] = inst;
+	fd_client[nfds] = NULL;
+	fds[nfds ++].fd = inst->client_fd;
+      }
+    }
+    for (client = clients; client; client = client->next) {
+      fd_inst[nfds] = NULL;
+      fd_client[nfds] = client;
+      fds[nfds ++].fd = client->fd;
+    }
+    for (i = 0; i < nfds; i ++) {
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+
+    /* Wake up in time for dropping clients which do not send their
+       requests */
+    if (poll(fds, nfds, clients ? 1000 : 10000) < 0) {
+      if (errno == EINTR)
+	continue;
+      log_printf(0, "poll() failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents) {
+      char buf[64];
+
+      while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+      reap_children();
+    }
+
+    for (i = 2; i < nfds; i ++) {
+      if (!fds[i].revents || fd_inst[i] == NULL)
+	continue;
+      /* The instance may have been removed by an earlier fd */
+      for (inst = instances; inst && inst != fd_inst[i]; inst = inst->next);
+      if (inst == NULL)
+	continue;
+      if (fds[i].fd == inst->err_fd)
+	copy_error_output(inst);
+      else if (fds[i].fd == inst->client_fd) {
+	/* The client went away (job canceled), the only thing it sends */
+	log_printf(1, "Client of Ghostscript (PID %d) has gone\n",
+		   (int)inst->pid);
+	close(inst->client_fd);
+	inst->client_fd = -1;
+	kill_instance(inst);
+      }
+    }
+
+    /* Requests, after the instances, as they start new ones */
+    for (i = 2; i < nfds; i ++) {
+      if (!fds[i].revents || fd_client[i] == NULL)
+	continue;
+      client = fd_client[i];
+      switch (read_request(client)) {
+      case 1:
+	handle_request(client);
+	break;
+      case -1:
+	log_printf(1, "Invalid request\n");
+	remove_client(client, 1);
+	break;
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      if ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+	set_cloexec(fd);
+	accept_client(fd);
+      }
+    }
+
+    now = time(NULL);
+
+    /* The client sends its request right away */
+    for (client = clients; client; client = next_client) {
+      next_client = client->next;
+      if (now - client->connected > 5) {
+	log_printf(1, "Request not received in time\n");
+	remove_client(client, 1);
+      }
+    }
+
+    /* Do not keep Ghostscript processes nobody needs */
+    for (inst = instances; inst; inst = inst->next)
+      if (idle_timeout > 0 && is_idle(inst) &&
+	  now - inst->started > idle_timeout) {
+	log_printf(1, "Stopping unused Ghostscript (PID %d)\n",
+		   (int)inst->pid);
+	kill_instance(inst);
+      }
+  }
+
+  log_printf(1, "Shutting down\n");
+  close(listen_fd);
+  unlink(socket_path);
+  while (clients)
+    remove_client(clients, 1);
+  for (inst = instances; inst; inst = next) {
+    next = inst->next;
+    kill_instance(inst);
+    remove_instance(inst);
+  }
+  while (wait(NULL) > 0);
+  free(fds);
+  free(fd_inst);
+  free(fd_client);
+  return (0);
+}
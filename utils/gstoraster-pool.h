@@ -0,0 +1,73 @@
+/***
+  This file is part of cups-filters.
+
+  This file is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  This file is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with cups-filters; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+  USA.
+***/
+
+/*
+ * Protocol between gstoraster and gstoraster-pool
+ *
+ * The client connects to the pool's Unix domain socket and sends a
+ * gs_pool_request_t, with its stderr file descriptor attached
+ * (SCM_RIGHTS), followed by the Ghostscript command line without argv[0]
+ * as "length" bytes of NUL-terminated strings, and the environment
+ * variables for Ghostscript ("NAME=value") as "env_length" bytes of
+ * NUL-terminated strings.
+ *
+ * The pool answers with one byte: GS_POOL_READY if a Ghostscript with
+ * exactly this command line, environment, nice value and resource limits
+ * was waiting, with its stdin (write end) and stdout (read end) attached
+ * in this order, or GS_POOL_NONE, then the client runs Ghostscript by
+ * itself.
+ *
+ * After GS_POOL_READY the client feeds the job into Ghostscript's stdin
+ * and reads the output. The pool copies Ghostscript's error output to the
+ * client's stderr and, when Ghostscript has finished, sends its exit
+ * status as an int (as returned by waitpid()) and closes the connection.
+ */
+
+#ifndef _GSTORASTER_POOL_H_
+#define _GSTORASTER_POOL_H_
+
+#include <sys/resource.h>
+
+#define GS_POOL_MAGIC		0x47535032	/* "GSP2" */
+#define GS_POOL_MAX_ARGS_LEN	65536
+#define GS_POOL_MAX_ENV_LEN	65536
+
+#define GS_POOL_READY		'Y'
+#define GS_POOL_NONE		'N'
+
+/* Environment variable with the socket path, overrides the default */
+#define GS_POOL_SOCKET_ENV	"GSTORASTER_POOL_SOCKET"
+#define GS_POOL_SOCKET		CUPS_STATEDIR "/gstoraster-pool.sock"
+
+/* Resource limits of the job which Ghostscript gets */
+#define GS_POOL_LIMITS		{ RLIMIT_AS, RLIMIT_CORE, RLIMIT_CPU, \
+				  RLIMIT_DATA, RLIMIT_FSIZE, RLIMIT_NOFILE, \
+				  RLIMIT_STACK }
+#define GS_POOL_NUM_LIMITS	7
+
+typedef struct gs_pool_request_s {
+  unsigned int magic;		/* GS_POOL_MAGIC */
+  unsigned int length;		/* Length of the command line */
+  unsigned int env_length;	/* Length of the environment */
+  int nice;			/* Nice value of the job */
+  struct rlimit limits[GS_POOL_NUM_LIMITS];
+				/* Resource limits, see GS_POOL_LIMITS */
+} gs_pool_request_t;
+
+#endif /* !_GSTORASTER_POOL_H_ */